@@ -0,0 +1,532 @@
+// Two-pass 6502 assembler over a classified listing.
+//
+// Assembler6502 is fed one statement per source line -- labels, constant
+// declarations, instructions, data directives and other directives -- by
+// whichever tool has already split the text up, and turns them into
+// machine code without a round trip through ca65 and ld65.
+//
+// The first pass places every statement. An operand is encoded in zero
+// page when the mnemonic has a zero page form and the operand already
+// folds below $100 from the constants and the labels seen so far; forward
+// references are assumed to be absolute, as ca65 does. The second pass
+// folds every operand with all labels known and writes the bytes.
+//
+// Supported directives are .org, .align and the data directives. Those
+// known not to change the bytes, such as .segment and .export, are
+// ignored; any other directive is rejected rather than risk an image that
+// differs from what ca65 would build. Values that do not fit their field
+// are errors, as in ca65.
+//
+#ifndef ASM6502_HPP
+#define ASM6502_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "expr6502.hpp"
+#include "isa6502.hpp"
+
+class Assembler6502 {
+public:
+    // Where code goes before the first .org: the start of the NES
+    // cartridge's program ROM
+    static constexpr int DEFAULT_ORIGIN = 0x8000;
+    
+    struct Counts {
+        uint64_t instructions = 0;
+        uint64_t zeroPageOperands = 0;
+        uint64_t absoluteOperands = 0;  // also taking a zero page form
+        uint64_t branches = 0;
+        uint64_t dataBytes = 0;
+        uint64_t ignoredDirectives = 0;
+    };
+
+private:
+    enum StatementKind {
+        INSTRUCTION,
+        DATA,
+        ORIGIN,
+        ALIGN
+    };
+    
+    enum DataWidth {
+        DATA_BYTE,
+        DATA_WORD,
+        DATA_WORD_BIG_ENDIAN,
+        DATA_RESERVE
+    };
+    
+    struct Statement {
+        StatementKind kind = INSTRUCTION;
+        int lineNumber = 0;
+        std::string_view directive;         // data directives
+        std::string_view expression;        // operand with the mode syntax removed
+        std::vector<std::string_view> values;
+        int mnemonic = -1;
+        isa6502::AddressingMode mode = isa6502::IMPLIED;
+        int address = 0;
+        int size = 0;
+    };
+    
+    struct Symbol {
+        std::string_view name;
+        int address;
+    };
+    
+    struct Region {
+        int start;
+        int end;
+    };
+    
+    struct Label {
+        std::string_view name;
+        size_t statement;   // index of the statement that follows it
+        int lineNumber;
+    };
+    
+    std::vector<Statement> statements;
+    std::vector<std::pair<std::string_view, std::string_view>> constants;
+    std::vector<Label> labels;
+    std::vector<Symbol> symbols;
+    std::unordered_map<std::string_view, char> symbolNames;
+    std::deque<std::string> symbolValues;   // keeps the views given to the evaluator alive
+    ConstantEvaluator evaluator;
+    std::vector<uint8_t> bytes;
+    int imageStart = DEFAULT_ORIGIN;
+    Counts counts;
+    
+    static std::runtime_error lineError(int lineNumber, const std::string& message) {
+        return std::runtime_error("Line " + std::to_string(lineNumber) + ": " + message);
+    }
+    
+    static std::string_view trim(std::string_view text) {
+        size_t start = 0;
+        while (start < text.size() && std::isspace(static_cast<unsigned char>(text[start]))) start++;
+        size_t end = text.size();
+        while (end > start && std::isspace(static_cast<unsigned char>(text[end - 1]))) end--;
+        return text.substr(start, end - start);
+    }
+    
+    // Strips a trailing ",x" or ",y" and returns the register, or 0
+    static char indexSuffix(std::string_view& operand) {
+        size_t comma = operand.rfind(',');
+        if (comma == std::string_view::npos) return 0;
+        std::string_view index = trim(operand.substr(comma + 1));
+        if (index.size() != 1) return 0;
+        char reg = static_cast<char>(std::tolower(static_cast<unsigned char>(index[0])));
+        if (reg != 'x' && reg != 'y') return 0;
+        operand = trim(operand.substr(0, comma));
+        return reg;
+    }
+    
+    // Position of the ')' closing the '(' at operand[0], or npos
+    static size_t closingParenthesis(std::string_view operand) {
+        int depth = 0;
+        for (size_t i = 0; i < operand.size(); ++i) {
+            if (operand[i] == '(') depth++;
+            else if (operand[i] == ')' && --depth == 0) return i;
+        }
+        return std::string_view::npos;
+    }
+    
+    static DataWidth dataWidth(std::string_view directive) {
+        if (directive == ".dw" || directive == ".word" || directive == ".addr") return DATA_WORD;
+        if (directive == ".dbyte") return DATA_WORD_BIG_ENDIAN;
+        if (directive == ".res") return DATA_RESERVE;
+        return DATA_BYTE;
+    }
+    
+    static bool isStringValue(std::string_view value) {
+        return value.size() >= 2 && value.front() == '"' && value.back() == '"';
+    }
+    
+    // Calls emit for every character of a string value
+    template <typename Emit>
+    static void forEachStringByte(std::string_view value, Emit emit) {
+        for (size_t i = 1; i + 1 < value.size(); ++i) {
+            if (value[i] == '\\' && i + 2 < value.size()) i++;
+            emit(static_cast<uint8_t>(value[i]));
+        }
+    }
+    
+    Statement& addStatement(StatementKind kind, int lineNumber) {
+        statements.emplace_back();
+        statements.back().kind = kind;
+        statements.back().lineNumber = lineNumber;
+        return statements.back();
+    }
+    
+    bool fitsZeroPage(std::string_view expression) {
+        int32_t value;
+        return evaluator.evaluate(expression, value) && value >= 0 && value < 0x100;
+    }
+    
+    // Picks the addressing mode from the operand syntax and, between the
+    // zero page and absolute forms, from what the operand folds to so far
+    void chooseMode(Statement& statement, std::string_view operand) {
+        using namespace isa6502;
+        const InstructionInfo& info = isa6502::instruction(statement.mnemonic);
+        auto unsupported = [&]() {
+            return lineError(statement.lineNumber, std::string(info.mnemonic) +
+                             " has no addressing mode for operand '" + std::string(operand) + "'");
+        };
+        
+        // The wider of a zero page and an absolute form, unless the
+        // operand is known to fit in zero page or the absolute form is
+        // missing
+        auto pick = [&](AddressingMode zeroPage, AddressingMode absolute, std::string_view expression, bool forceAbsolute) {
+            statement.expression = expression;
+            bool zeroPageFits = info.supports(zeroPage) && !forceAbsolute && fitsZeroPage(expression);
+            if (info.supports(absolute) && !zeroPageFits) {
+                statement.mode = absolute;
+                if (info.supports(zeroPage)) counts.absoluteOperands++;
+            } else if (info.supports(zeroPage)) {
+                statement.mode = zeroPage;
+                counts.zeroPageOperands++;
+            } else {
+                throw unsupported();
+            }
+        };
+        
+        if (operand.empty()) {
+            statement.mode = info.supports(IMPLIED) ? IMPLIED : ACCUMULATOR;
+        } else if (operand.size() == 1 && (operand[0] == 'a' || operand[0] == 'A')) {
+            statement.mode = ACCUMULATOR;
+        } else if (operand[0] == '#') {
+            statement.mode = IMMEDIATE;
+            statement.expression = trim(operand.substr(1));
+        } else if (info.supports(RELATIVE)) {
+            statement.mode = RELATIVE;
+            statement.expression = operand;
+            counts.branches++;
+        } else {
+            size_t close = operand[0] == '(' ? closingParenthesis(operand) : std::string_view::npos;
+            std::string_view inner = close == std::string_view::npos ? std::string_view() : trim(operand.substr(1, close - 1));
+            std::string_view after = close == std::string_view::npos ? std::string_view() : operand.substr(close + 1);
+            std::string_view innerExpression = inner;
+            std::string_view afterExpression = after;
+            if (close != std::string_view::npos && trim(after).empty() && indexSuffix(innerExpression) == 'x' &&
+                info.supports(INDEXED_INDIRECT)) {
+                statement.mode = INDEXED_INDIRECT;
+                statement.expression = innerExpression;
+            } else if (close != std::string_view::npos && indexSuffix(afterExpression) == 'y' &&
+                       trim(afterExpression).empty() && info.supports(INDIRECT_INDEXED)) {
+                statement.mode = INDIRECT_INDEXED;
+                statement.expression = inner;
+            } else if (close != std::string_view::npos && trim(after).empty() && info.supports(INDIRECT)) {
+                statement.mode = INDIRECT;
+                statement.expression = inner;
+            } else {
+                // ca65's "a:" prefix asks for the absolute form
+                bool forceAbsolute = operand.size() > 2 && (operand[0] == 'a' || operand[0] == 'A') && operand[1] == ':';
+                if (forceAbsolute) operand = trim(operand.substr(2));
+                std::string_view expression = operand;
+                char index = indexSuffix(expression);
+                if (index == 'x') pick(ZERO_PAGE_X, ABSOLUTE_X, expression, forceAbsolute);
+                else if (index == 'y') pick(ZERO_PAGE_Y, ABSOLUTE_Y, expression, forceAbsolute);
+                else pick(ZERO_PAGE, ABSOLUTE, expression, forceAbsolute);
+            }
+        }
+        
+        if (!info.supports(statement.mode)) {
+            throw unsupported();
+        }
+        statement.size = modeSize(statement.mode);
+    }
+    
+    int dataSize(const Statement& statement) {
+        switch (dataWidth(statement.directive)) {
+            case DATA_WORD:
+            case DATA_WORD_BIG_ENDIAN:
+                return static_cast<int>(statement.values.size()) * 2;
+            case DATA_RESERVE: {
+                int32_t count;
+                if (statement.values.empty() || !evaluator.evaluate(statement.values[0], count) || count < 0) {
+                    throw lineError(statement.lineNumber, "cannot size .res");
+                }
+                return count;
+            }
+            default: {
+                int size = 0;
+                for (std::string_view value : statement.values) {
+                    if (isStringValue(value)) forEachStringByte(value, [&](uint8_t) { size++; });
+                    else size++;
+                }
+                return size;
+            }
+        }
+    }
+    
+    void defineSymbol(std::string_view name, int address, int lineNumber) {
+        if (!symbolNames.emplace(name, 1).second) {
+            throw lineError(lineNumber, "label '" + std::string(name) + "' is defined twice");
+        }
+        symbolValues.push_back(std::to_string(address));
+        evaluator.define(name, symbolValues.back());
+        symbols.push_back(Symbol{name, address});
+    }
+    
+    int32_t fold(const Statement& statement, std::string_view expression) {
+        int32_t value;
+        if (!evaluator.evaluate(expression, value)) {
+            throw lineError(statement.lineNumber, "cannot resolve '" + std::string(expression) + "'");
+        }
+        return value;
+    }
+    
+    int32_t fold(const Statement& statement, std::string_view expression, int32_t low, int32_t high) {
+        int32_t value = fold(statement, expression);
+        if (value < low || value > high) {
+            throw lineError(statement.lineNumber, "'" + std::string(expression) + "' does not fit in " +
+                            (high > 0xFF ? "a word" : "a byte"));
+        }
+        return value;
+    }
+    
+    // Pass 1: addresses of every statement and label
+    void place() {
+        for (const auto& constant : constants) {
+            evaluator.define(constant.first, constant.second);
+        }
+        
+        int address = DEFAULT_ORIGIN;
+        size_t nextLabel = 0;
+        for (size_t i = 0; i <= statements.size(); ++i) {
+            for (; nextLabel < labels.size() && labels[nextLabel].statement == i; ++nextLabel) {
+                defineSymbol(labels[nextLabel].name, address, labels[nextLabel].lineNumber);
+            }
+            if (i == statements.size()) break;
+            
+            Statement& statement = statements[i];
+            switch (statement.kind) {
+                case ORIGIN:
+                    address = fold(statement, statement.expression);
+                    break;
+                case ALIGN: {
+                    int32_t alignment = fold(statement, statement.expression);
+                    statement.size = alignment > 1 ? (alignment - address % alignment) % alignment : 0;
+                    break;
+                }
+                case DATA:
+                    statement.size = dataSize(statement);
+                    break;
+                case INSTRUCTION:
+                    chooseMode(statement, statement.expression);
+                    break;
+            }
+            statement.address = address;
+            address += statement.size;
+            if (address > 0x10000) {
+                throw lineError(statement.lineNumber, "code runs past $FFFF");
+            }
+        }
+    }
+    
+    // Pass 2: the bytes, from the lowest address placed to the highest
+    void encode() {
+        std::vector<Region> regions;
+        for (const Statement& statement : statements) {
+            if (statement.size == 0) continue;
+            if (!regions.empty() && regions.back().end == statement.address) {
+                regions.back().end += statement.size;
+            } else {
+                regions.push_back(Region{statement.address, statement.address + statement.size});
+            }
+        }
+        std::sort(regions.begin(), regions.end(), [](const Region& a, const Region& b) { return a.start < b.start; });
+        for (size_t i = 1; i < regions.size(); ++i) {
+            if (regions[i].start < regions[i - 1].end) {
+                std::ostringstream message;
+                message << "code at $" << std::hex << std::uppercase << regions[i].start << " overlaps earlier code";
+                throw std::runtime_error(message.str());
+            }
+        }
+        
+        imageStart = regions.empty() ? DEFAULT_ORIGIN : regions.front().start;
+        bytes.assign(regions.empty() ? 0 : static_cast<size_t>(regions.back().end - imageStart), 0);
+        
+        for (const Statement& statement : statements) {
+            uint8_t* out = bytes.data() + (statement.address - imageStart);
+            if (statement.kind == DATA) {
+                encodeData(statement, out);
+                counts.dataBytes += statement.size;
+            } else if (statement.kind == INSTRUCTION) {
+                encodeInstruction(statement, out);
+                counts.instructions++;
+            }
+        }
+    }
+    
+    void encodeInstruction(const Statement& statement, uint8_t* out) {
+        using namespace isa6502;
+        out[0] = static_cast<uint8_t>(isa6502::instruction(statement.mnemonic).opcodes[statement.mode]);
+        if (statement.size == 1) return;
+        
+        if (statement.mode == RELATIVE) {
+            int32_t value = fold(statement, statement.expression);
+            int32_t offset = value - (statement.address + 2);
+            if (offset < -128 || offset > 127) {
+                throw lineError(statement.lineNumber, "branch target is " + std::to_string(offset) + " bytes away");
+            }
+            out[1] = static_cast<uint8_t>(offset);
+            return;
+        }
+        if (statement.size == 2) {
+            int32_t value = fold(statement, statement.expression, statement.mode == IMMEDIATE ? -128 : 0, 0xFF);
+            out[1] = static_cast<uint8_t>(value);
+            return;
+        }
+        int32_t value = fold(statement, statement.expression, 0, 0xFFFF);
+        out[1] = static_cast<uint8_t>(value);
+        out[2] = static_cast<uint8_t>(value >> 8);
+    }
+    
+    void encodeData(const Statement& statement, uint8_t* out) {
+        DataWidth width = dataWidth(statement.directive);
+        if (width == DATA_RESERVE) {
+            int32_t fill = statement.values.size() > 1 ? fold(statement, statement.values[1], -128, 0xFF) : 0;
+            std::fill_n(out, statement.size, static_cast<uint8_t>(fill));
+            return;
+        }
+        
+        for (std::string_view value : statement.values) {
+            if (width == DATA_BYTE && isStringValue(value)) {
+                forEachStringByte(value, [&](uint8_t byte) { *out++ = byte; });
+                continue;
+            }
+            int32_t folded = width == DATA_BYTE ? fold(statement, value, -128, 0xFF) : fold(statement, value, 0, 0xFFFF);
+            uint8_t low = static_cast<uint8_t>(folded);
+            uint8_t high = static_cast<uint8_t>(folded >> 8);
+            if (width == DATA_BYTE) {
+                *out++ = low;
+            } else {
+                *out++ = width == DATA_WORD ? low : high;
+                *out++ = width == DATA_WORD ? high : low;
+            }
+        }
+    }
+
+public:
+    // Forgets the listing, keeping the allocations for the next one
+    void reset() {
+        statements.clear();
+        constants.clear();
+        labels.clear();
+        symbols.clear();
+        symbolNames.clear();
+        symbolValues.clear();
+        evaluator.clear();
+        bytes.clear();
+        imageStart = DEFAULT_ORIGIN;
+        counts = Counts();
+    }
+    
+    // The views passed to the statement calls must stay valid until
+    // assemble() has run
+    void label(std::string_view name, int lineNumber) {
+        labels.push_back(Label{name, statements.size(), lineNumber});
+    }
+    
+    void constant(std::string_view name, std::string_view expression) {
+        constants.emplace_back(name, expression);
+    }
+    
+    void instruction(std::string_view mnemonic, std::string_view operand, int lineNumber) {
+        int index = isa6502::mnemonicIndexIgnoreCase(mnemonic);
+        if (index < 0) {
+            throw lineError(lineNumber, "unknown instruction '" + std::string(mnemonic) + "'");
+        }
+        Statement& statement = addStatement(INSTRUCTION, lineNumber);
+        statement.mnemonic = index;
+        statement.expression = trim(operand);
+    }
+    
+    void data(std::string_view directive, const std::vector<std::string_view>& values, int lineNumber) {
+        Statement& statement = addStatement(DATA, lineNumber);
+        statement.directive = directive;
+        statement.values = values;
+    }
+    
+    void directive(std::string_view name, std::string_view operand, int lineNumber) {
+        // Segments, linkage, CPU selection and listing control; none of
+        // them changes a byte of a single-file image
+        static const std::string_view ignored[] = {
+            ".segment", ".code", ".rodata", ".data", ".bss", ".zeropage",
+            ".export", ".exportzp", ".import", ".importzp", ".global", ".globalzp",
+            ".p02", ".debuginfo", ".list", ".listbytes", ".pagelength", ".fileopt", ".fopt", ".out"
+        };
+        
+        if (name == ".org" || name == ".align") {
+            addStatement(name == ".org" ? ORIGIN : ALIGN, lineNumber).expression = trim(operand);
+        } else if (std::find(std::begin(ignored), std::end(ignored), name) != std::end(ignored)) {
+            counts.ignoredDirectives++;
+        } else {
+            throw lineError(lineNumber, "cannot assemble " + std::string(name));
+        }
+    }
+    
+    void assemble() {
+        place();
+        encode();
+    }
+    
+    // The assembled bytes, from origin() up to the highest address any
+    // statement reached; gaps between .org blocks are zero
+    const std::vector<uint8_t>& image() const {
+        return bytes;
+    }
+    
+    int origin() const {
+        return imageStart;
+    }
+    
+    const Counts& statistics() const {
+        return counts;
+    }
+    
+    void writeBinary(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot create output file: " + filename);
+        }
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        file.close();
+        if (!file) {
+            throw std::runtime_error("Cannot write output file: " + filename);
+        }
+    }
+    
+    // One "Name = $XXXX" line per label, in address order, which ca65 can
+    // read back as constant declarations
+    void writeSymbols(const std::string& filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot create symbol file: " + filename);
+        }
+        std::vector<Symbol> sorted = symbols;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Symbol& a, const Symbol& b) {
+            return a.address < b.address;
+        });
+        file << std::hex << std::uppercase << std::setfill('0');
+        for (const Symbol& symbol : sorted) {
+            file << symbol.name << " = $" << std::setw(4) << symbol.address << "\n";
+        }
+        file.close();
+        if (!file) {
+            throw std::runtime_error("Cannot write symbol file: " + filename);
+        }
+    }
+};
+
+#endif // ASM6502_HPP
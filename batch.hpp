@@ -0,0 +1,177 @@
+// Batch mode shared by the tools: many conversions in one process.
+//
+// A batch is given either as a manifest file or as a wildcard pattern.
+// The jobs run on a WorkStealingPool, and each tool keeps one converter per
+// worker and resets it between files, so buffers, arenas and tables are
+// allocated once per thread rather than once per file.
+//
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "threadpool.hpp"
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// Matches a file name against a pattern of literal characters, '*' and '?'
+inline bool matchWildcard(const std::string& pattern, const std::string& name) {
+    size_t p = 0;
+    size_t n = 0;
+    size_t starPattern = std::string::npos;
+    size_t starName = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            starPattern = p++;
+            starName = n;
+        } else if (starPattern != std::string::npos) {
+            p = starPattern + 1;
+            n = ++starName;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Output for an input when only an output directory is given: the input's
+// file name with its extension replaced by outputSuffix
+inline std::string batchOutputName(const std::string& input, const std::string& outputDir,
+                                   const std::string& outputSuffix) {
+    std::filesystem::path stem = std::filesystem::path(input).stem();
+    return (std::filesystem::path(outputDir) / stem).string() + outputSuffix;
+}
+
+// Expands spec into jobs. A spec containing '*' or '?' is a pattern over
+// the file names in one directory, e.g. "hacks/*.asm", and needs
+// outputDir. Anything else is a manifest with one job per line: an input
+// and an output separated by a tab or spaces, or just an input when
+// outputDir is given. Blank lines and lines starting with '#' are skipped.
+inline std::vector<BatchJob> loadBatchJobs(const std::string& spec, const std::string& outputDir,
+                                           const std::string& outputSuffix) {
+    std::vector<BatchJob> jobs;
+    
+    if (spec.find_first_of("*?") != std::string::npos) {
+        if (outputDir.empty()) {
+            throw std::runtime_error("A batch pattern needs an output directory");
+        }
+        std::filesystem::path path(spec);
+        std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        std::string pattern = path.filename().string();
+        
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+            if (entry.is_regular_file() && matchWildcard(pattern, entry.path().filename().string())) {
+                std::string input = entry.path().string();
+                jobs.push_back(BatchJob{input, batchOutputName(input, outputDir, outputSuffix)});
+            }
+        }
+        if (error) {
+            throw std::runtime_error("Cannot read directory: " + directory.string());
+        }
+        std::sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) {
+            return a.input < b.input;
+        });
+        return jobs;
+    }
+    
+    std::ifstream manifest(spec);
+    if (!manifest.is_open()) {
+        throw std::runtime_error("Cannot open batch manifest: " + spec);
+    }
+    
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') continue;
+        size_t end = line.find_last_not_of(" \t") + 1;
+        std::string entry = line.substr(start, end - start);
+        
+        size_t split = entry.find('\t');
+        if (split == std::string::npos) split = entry.find(' ');
+        if (split == std::string::npos) {
+            if (outputDir.empty()) {
+                throw std::runtime_error("Batch manifest line " + std::to_string(lineNumber) +
+                                         " has no output and no output directory was given");
+            }
+            jobs.push_back(BatchJob{entry, batchOutputName(entry, outputDir, outputSuffix)});
+        } else {
+            size_t outputStart = entry.find_first_not_of(" \t", split);
+            jobs.push_back(BatchJob{entry.substr(0, split), entry.substr(outputStart)});
+        }
+    }
+    return jobs;
+}
+
+// Runs convert(job, worker) for every job on the pool. A failing job is
+// reported and the rest carry on. Prints the throughput at the end and
+// returns the number of failed jobs.
+template <typename Convert>
+int runBatch(const std::vector<BatchJob>& jobs, WorkStealingPool& pool, Convert convert) {
+    std::mutex outputMutex;
+    std::vector<char> failed(jobs.size(), 0);
+    std::vector<uint64_t> inputBytes(jobs.size(), 0);
+    
+    auto start = std::chrono::steady_clock::now();
+    pool.run(jobs.size(), [&](size_t index, int worker) {
+        const BatchJob& job = jobs[index];
+        try {
+            std::filesystem::path outputParent = std::filesystem::path(job.output).parent_path();
+            if (!outputParent.empty()) {
+                std::error_code error;
+                std::filesystem::create_directories(outputParent, error);
+            }
+            convert(job, worker);
+            std::error_code error;
+            uintmax_t size = std::filesystem::file_size(job.input, error);
+            inputBytes[index] = error ? 0 : static_cast<uint64_t>(size);
+        } catch (const std::exception& e) {
+            failed[index] = 1;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cerr << "Error: " << job.input << ": " << e.what() << std::endl;
+        }
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    int failures = static_cast<int>(std::count(failed.begin(), failed.end(), 1));
+    uint64_t totalBytes = 0;
+    for (uint64_t bytes : inputBytes) {
+        totalBytes += bytes;
+    }
+    
+    double seconds = std::max(elapsed.count(), 1e-9);
+    double mebibytes = static_cast<double>(totalBytes) / (1024.0 * 1024.0);
+    std::cout << "Converted " << jobs.size() - failures << " of " << jobs.size() << " files ("
+              << std::fixed << std::setprecision(1) << mebibytes << " MiB) in "
+              << std::setprecision(2) << elapsed.count() << " s on " << pool.size() << " threads: "
+              << std::setprecision(1) << (jobs.size() - failures) / seconds << " files/s, "
+              << mebibytes / seconds << " MiB/s" << std::endl;
+    return failures;
+}
+
+#endif // BATCH_HPP
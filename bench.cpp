@@ -0,0 +1,505 @@
+// Benchmark for every stage of the pipeline.
+//
+// Generates a synthetic ca65 listing of the requested size, then times
+// convert's parseFile and generateJson, createcpp's parseJsonFile and
+// generateCppFiles, and unconvert's parseJsonFile and generateAssembly, each
+// on its own. Results are written as JSON. Given a previous result file
+// with --baseline, every stage is compared against it and the run fails
+// when one got slower than the threshold allows.
+//
+#define SMB_TOOLS_NO_MAIN
+#include "convert.cpp"
+#include "createcpp.cpp"
+#include "unconvert.cpp"
+
+#include <filesystem>
+#include <functional>
+
+// Deterministic generator for ca65 listings shaped like the SMB
+// disassembly: constants, labels, subroutines, branches, .db/.dw tables,
+// strings and comments with quoted semicolons. The same lines and seed
+// produce the same listing on every platform.
+//
+// Every instruction uses an addressing mode the 6502 has and every branch
+// stays in range, so convert --assemble accepts the listing as long as
+// it fits between $8000 and $FFFF, which is up to about 12000 lines.
+class ListingGenerator {
+private:
+    uint64_t state;
+    
+    // splitmix64, since the standard distributions differ between libraries
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    
+    int below(int limit) {
+        return static_cast<int>(next() % static_cast<uint64_t>(limit));
+    }
+    
+    double unit() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    
+    template <size_t N>
+    const char* pick(const char* const (&choices)[N]) {
+        return choices[below(static_cast<int>(N))];
+    }
+    
+    static std::string hex(int value, int digits) {
+        std::ostringstream text;
+        text << '$' << std::uppercase << std::hex << std::setw(digits) << std::setfill('0') << value;
+        return text.str();
+    }
+
+public:
+    explicit ListingGenerator(uint64_t seed) : state(seed) {}
+    
+    std::string generate(int lineCount) {
+        static const char* const memoryMnemonics[] = {
+            "lda", "ldx", "ldy", "sta", "stx", "sty", "and", "eor", "ora",
+            "adc", "sbc", "cmp", "cpx", "cpy", "bit", "inc", "dec"
+        };
+        static const char* const impliedMnemonics[] = {
+            "tax", "tay", "txa", "tya", "inx", "iny", "dex", "dey", "clc",
+            "sec", "pha", "pla", "php", "plp", "nop", "cld", "sei"
+        };
+        static const char* const branches[] = {"bcc", "bcs", "beq", "bne", "bmi", "bpl", "bvc", "bvs"};
+        static const char* const shifts[] = {"asl", "lsr a", "rol"};
+        static const char* const comments[] = {"", "", " ;comment", " ; \"quoted;semi\""};
+        static const isa6502::AddressingMode memoryModes[] = {
+            isa6502::IMMEDIATE, isa6502::ZERO_PAGE, isa6502::ZERO_PAGE_X, isa6502::ZERO_PAGE_Y,
+            isa6502::ABSOLUTE, isa6502::ABSOLUTE_X, isa6502::ABSOLUTE_Y,
+            isa6502::INDEXED_INDIRECT, isa6502::INDIRECT_INDEXED
+        };
+        
+        // Const_0 up to zeroPageCount are zero page addresses, the rest
+        // are in the rest of internal RAM
+        const int constantCount = 200;
+        const int zeroPageCount = 50;
+        const int labelCount = lineCount / 12 + 2;
+        std::vector<std::string> lines;
+        lines.reserve(static_cast<size_t>(lineCount) + static_cast<size_t>(labelCount) * 2 + 16);
+        
+        lines.push_back("; synthetic listing");
+        lines.push_back(".segment \"CODE\"");
+        lines.push_back("\t.org $8000");
+        for (int i = 0; i < constantCount; ++i) {
+            int address = i < zeroPageCount ? below(0xFF) : 0x100 + below(0x700);
+            lines.push_back("Const_" + std::to_string(i) + " = " + hex(address, 4) +
+                            " ; ram var " + std::to_string(i));
+        }
+        lines.push_back("PPU_CTRL = $2000");
+        lines.push_back("Weird = PPU_CTRL | %10000000 ; quoted \"a;b\"");
+        lines.push_back("JumpPointer = $00F0");
+        lines.push_back("JumpTarget = $00F2");
+        lines.push_back("Start:");
+        lines.push_back("  jsr JumpEngine");
+        lines.push_back("  .dw L0, L1");
+        lines.push_back("  .dw L2");
+        lines.push_back("NonMaskableInterrupt:");
+        lines.push_back("  rti");
+        
+        // SMB's: jumps to entry A of the table after the jsr
+        lines.push_back("JumpEngine:");
+        for (const char* line : {"asl", "tay", "pla", "sta JumpPointer", "pla", "sta JumpPointer+1", "iny",
+                                 "lda (JumpPointer),y", "sta JumpTarget", "iny", "lda (JumpPointer),y",
+                                 "sta JumpTarget+1", "jmp (JumpTarget)"}) {
+            lines.push_back(std::string("  ") + line);
+        }
+        
+        auto zeroPage = [&]() { return "Const_" + std::to_string(below(zeroPageCount)); };
+        auto absolute = [&]() { return "Const_" + std::to_string(zeroPageCount + below(constantCount - zeroPageCount)); };
+        auto constant = [&]() { return "Const_" + std::to_string(below(constantCount)); };
+        auto label = [&]() { return "L" + std::to_string(below(labelCount)); };
+        
+        // An operand in one of the modes mnemonic has
+        auto memoryOperand = [&](std::string_view mnemonic) {
+            const isa6502::InstructionInfo& info = isa6502::instruction(isa6502::mnemonicIndex(mnemonic));
+            isa6502::AddressingMode mode;
+            do {
+                mode = memoryModes[below(static_cast<int>(std::size(memoryModes)))];
+            } while (!info.supports(mode));
+            
+            switch (mode) {
+                case isa6502::IMMEDIATE: {
+                    int form = below(3);
+                    return form == 0 ? "#" + hex(below(256), 2) : form == 1 ? "#" + zeroPage() : std::string("#%0101");
+                }
+                case isa6502::ZERO_PAGE: return zeroPage();
+                case isa6502::ZERO_PAGE_X: return zeroPage() + ",x";
+                case isa6502::ZERO_PAGE_Y: return zeroPage() + ",y";
+                case isa6502::ABSOLUTE: return below(4) == 0 ? hex(0x100 + below(0x1F00), 4) : absolute();
+                case isa6502::ABSOLUTE_X: return absolute() + ",x";
+                case isa6502::ABSOLUTE_Y: return absolute() + ",y";
+                case isa6502::INDEXED_INDIRECT: return "(" + zeroPage() + ",x)";
+                default: return "(" + zeroPage() + "),y";
+            }
+        };
+        
+        // Branches go back to the last label while it is in reach; lines
+        // other than data count as three bytes, the longest instruction
+        int labelsPlaced = 0;
+        int bytesSinceLabel = 0;
+        while (static_cast<int>(lines.size()) < lineCount) {
+            double r = unit();
+            if (r < 0.08 && labelsPlaced < labelCount) {
+                lines.push_back("L" + std::to_string(labelsPlaced++) + ":" +
+                                (below(3) == 1 ? " ; label comment \"x;y\"" : ""));
+                bytesSinceLabel = 0;
+                continue;
+            } else if (r < 0.12) {
+                std::string table = "      .db ";
+                int count = below(16) + 1;
+                for (int i = 0; i < count; ++i) {
+                    if (i > 0) table += ", ";
+                    std::ostringstream value;
+                    value << '$' << std::hex << std::setw(2) << std::setfill('0') << below(256);
+                    table += value.str();
+                }
+                lines.push_back(table);
+                bytesSinceLabel += count;
+                continue;
+            } else if (r < 0.13) {
+                lines.push_back("      .byte \"hi;there\\\"x\", $00 ; str");
+                bytesSinceLabel += 11;
+                continue;
+            } else if (r < 0.14) {
+                lines.push_back("      .dw " + label() + ", Const_1");
+                bytesSinceLabel += 4;
+                continue;
+            } else if (r < 0.16) {
+                lines.push_back("; full comment line " + std::to_string(lines.size()));
+            } else if (r < 0.17) {
+                lines.push_back("");
+            } else if (r < 0.45) {
+                std::string mnemonic = pick(memoryMnemonics);
+                lines.push_back("      " + mnemonic + " " + memoryOperand(mnemonic) + pick(comments));
+            } else if (r < 0.65) {
+                lines.push_back(std::string("      ") + pick(impliedMnemonics));
+            } else if (r < 0.75) {
+                if (labelsPlaced > 0 && bytesSinceLabel + 2 <= 128) {
+                    lines.push_back(std::string("      ") + pick(branches) + " L" + std::to_string(labelsPlaced - 1));
+                } else {
+                    lines.push_back(std::string("      ") + pick(impliedMnemonics));
+                }
+            } else if (r < 0.80) {
+                lines.push_back("      jsr " + label());
+            } else if (r < 0.84) {
+                lines.push_back("      rts");
+            } else if (r < 0.86) {
+                lines.push_back("      jmp " + label());
+            } else if (r < 0.90) {
+                lines.push_back(below(4) == 3 ? "      ror " + constant() : std::string("      ") + pick(shifts));
+            } else {
+                lines.push_back("      lda " + absolute() + ",y");
+            }
+            bytesSinceLabel += 3;
+        }
+        
+        // Every label a branch or table may name has to exist
+        while (labelsPlaced < labelCount) {
+            lines.push_back("L" + std::to_string(labelsPlaced++) + ":");
+            lines.push_back("      rts");
+        }
+        
+        std::string listing;
+        for (const auto& line : lines) {
+            listing += line;
+            listing += '\n';
+        }
+        return listing;
+    }
+};
+
+struct StageResult {
+    std::string name;
+    uint64_t bytes = 0;             // input read or output written by the stage
+    std::vector<int64_t> samples;   // nanoseconds, one per iteration
+    
+    int64_t minimum() const {
+        return *std::min_element(samples.begin(), samples.end());
+    }
+    
+    int64_t median() const {
+        std::vector<int64_t> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        size_t middle = sorted.size() / 2;
+        return sorted.size() % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+    }
+};
+
+// Median and bytes of each stage in a previous result file
+struct BaselineStage {
+    int64_t medianNs = 0;
+    uint64_t bytes = 0;
+};
+
+struct BaselineLoader {
+    std::map<std::string, BaselineStage> stages;
+    std::string name;
+    BaselineStage current;
+    bool inStage = false;
+    
+    void beginRecord(std::string_view section) {
+        inStage = section == "stages";
+        name.clear();
+        current = BaselineStage();
+    }
+    
+    void stringField(std::string_view key, std::string_view value) {
+        if (inStage && key == "name") name = std::string(value);
+    }
+    
+    void numberField(std::string_view key, long long value) {
+        if (!inStage) return;
+        if (key == "median_ns") current.medianNs = value;
+        else if (key == "bytes") current.bytes = static_cast<uint64_t>(value);
+    }
+    
+    void arrayString(std::string_view, std::string_view) {}
+    
+    void endRecord() {
+        if (inStage && !name.empty()) stages[name] = current;
+        inStage = false;
+    }
+};
+
+static uint64_t directorySize(const std::filesystem::path& directory) {
+    uint64_t total = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if (entry.is_regular_file()) total += entry.file_size();
+    }
+    return total;
+}
+
+// Minimal JSON string literal for the file names in the results
+static std::string quoted(const std::string& text) {
+    std::string literal = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') literal += '\\';
+        literal += c;
+    }
+    return literal + "\"";
+}
+
+static int64_t timeNs(const std::function<void()>& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs the whole pipeline iterations + 1 times, dropping the first run
+// as a warm-up, with fresh converters each time
+static std::vector<StageResult> runPipeline(const std::filesystem::path& workDir, const std::string& asmName,
+                                            int iterations) {
+    const std::string jsonName = (workDir / "listing.json").string();
+    const std::filesystem::path cppDir = workDir / "listing_cpp";
+    
+    std::vector<StageResult> stages(6);
+    stages[0].name = "convert.parseFile";
+    stages[1].name = "convert.generateJson";
+    stages[2].name = "createcpp.parseJsonFile";
+    stages[3].name = "createcpp.generateCppFiles";
+    stages[4].name = "unconvert.parseJsonFile";
+    stages[5].name = "unconvert.generateAssembly";
+    
+    for (int iteration = 0; iteration <= iterations; ++iteration) {
+        int64_t times[6];
+        
+        AssemblyToJsonConverter assembler;
+        times[0] = timeNs([&]() { assembler.parseFile(asmName); });
+        times[1] = timeNs([&]() {
+            JsonWriter json(jsonName);
+            assembler.generateJson(json);
+            json.close();
+        });
+        
+        // Unchanged outputs are not rewritten, so start from nothing each time
+        std::filesystem::remove_all(cppDir);
+        JsonToCppConverter cppGenerator;
+        times[2] = timeNs([&]() { cppGenerator.parseJsonFile(jsonName); });
+        times[3] = timeNs([&]() { cppGenerator.generateCppFiles(cppDir.string()); });
+        
+        JsonToAssemblyConverter disassembler;
+        std::string assembly;
+        times[4] = timeNs([&]() { disassembler.parseJsonFile(jsonName); });
+        times[5] = timeNs([&]() { assembly = disassembler.generateAssembly(); });
+        
+        if (iteration == 0) {
+            uint64_t jsonBytes = std::filesystem::file_size(jsonName);
+            stages[0].bytes = std::filesystem::file_size(asmName);
+            stages[1].bytes = jsonBytes;
+            stages[2].bytes = jsonBytes;
+            stages[3].bytes = directorySize(cppDir);
+            stages[4].bytes = jsonBytes;
+            stages[5].bytes = assembly.size();
+            continue;
+        }
+        for (int i = 0; i < 6; ++i) {
+            stages[i].samples.push_back(times[i]);
+        }
+    }
+    return stages;
+}
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]" << std::endl;
+    std::cerr << "  --lines N           size of the synthetic listing (default 50000)" << std::endl;
+    std::cerr << "  --seed N            seed for the listing generator (default 1)" << std::endl;
+    std::cerr << "  --input FILE        benchmark a real listing instead" << std::endl;
+    std::cerr << "  --iterations N      timed runs per stage after one warm-up (default 5)" << std::endl;
+    std::cerr << "  --output FILE       write the JSON results to FILE instead of stdout" << std::endl;
+    std::cerr << "  --baseline FILE     compare against earlier results" << std::endl;
+    std::cerr << "  --threshold PCT     slowdown of a median that fails the comparison (default 10)" << std::endl;
+    std::cerr << "  --write-listing F   write the synthetic listing to F and exit" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int lineCount = 50000;
+    uint64_t seed = 1;
+    int iterations = 5;
+    double threshold = 10.0;
+    std::string inputName;
+    std::string outputName;
+    std::string baselineName;
+    std::string listingName;
+    
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string option = argv[argi];
+        if (argi + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++argi];
+        if (option == "--lines") {
+            lineCount = std::max(1, std::atoi(value.c_str()));
+        } else if (option == "--seed") {
+            seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--input") {
+            inputName = value;
+        } else if (option == "--iterations") {
+            iterations = std::max(1, std::atoi(value.c_str()));
+        } else if (option == "--output") {
+            outputName = value;
+        } else if (option == "--baseline") {
+            baselineName = value;
+        } else if (option == "--threshold") {
+            threshold = std::atof(value.c_str());
+        } else if (option == "--write-listing") {
+            listingName = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    std::filesystem::path workDir;
+    try {
+        if (!listingName.empty()) {
+            std::ofstream listing(listingName, std::ios::binary);
+            if (!listing.is_open()) {
+                throw std::runtime_error("Cannot create file: " + listingName);
+            }
+            listing << ListingGenerator(seed).generate(lineCount);
+            return 0;
+        }
+        
+        std::map<std::string, BaselineStage> baseline;
+        if (!baselineName.empty()) {
+            MappedFile baselineFile(baselineName);
+            BaselineLoader loader;
+            JsonReader().parse(baselineFile.view(), loader);
+            baseline = std::move(loader.stages);
+        }
+        
+        workDir = std::filesystem::temp_directory_path() / ("smb-bench-" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()));
+        std::filesystem::create_directories(workDir);
+        std::string asmName = inputName;
+        if (asmName.empty()) {
+            asmName = (workDir / "listing.asm").string();
+            std::ofstream listing(asmName, std::ios::binary);
+            listing << ListingGenerator(seed).generate(lineCount);
+        }
+        
+        std::vector<StageResult> stages = runPipeline(workDir, asmName, iterations);
+        std::filesystem::remove_all(workDir);
+        workDir.clear();
+        
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(1);
+        json << "{\n";
+        json << "  \"input\": " << quoted(inputName.empty() ? "synthetic" : inputName) << ",\n";
+        if (inputName.empty()) {
+            json << "  \"lines\": " << lineCount << ",\n";
+            json << "  \"seed\": " << seed << ",\n";
+        }
+        json << "  \"iterations\": " << iterations << ",\n";
+        json << "  \"stages\": [\n";
+        
+        int regressions = 0;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const StageResult& stage = stages[i];
+            int64_t median = stage.median();
+            double mibPerSecond = median > 0 ? stage.bytes / (1024.0 * 1024.0) / (median / 1e9) : 0.0;
+            
+            json << "    {\"name\": \"" << stage.name << "\", \"bytes\": " << stage.bytes
+                 << ", \"min_ns\": " << stage.minimum() << ", \"median_ns\": " << median
+                 << ", \"mib_per_s\": " << mibPerSecond;
+            
+            auto previous = baseline.find(stage.name);
+            if (previous != baseline.end() && previous->second.medianNs > 0) {
+                double change = 100.0 * (median - previous->second.medianNs) / previous->second.medianNs;
+                bool regressed = change > threshold;
+                regressions += regressed;
+                json << ", \"baseline_median_ns\": " << previous->second.medianNs
+                     << ", \"change_percent\": " << change
+                     << ", \"regressed\": " << (regressed ? "true" : "false");
+                
+                std::cerr << std::left << std::setw(28) << stage.name << std::right << std::fixed
+                          << std::setprecision(2) << std::setw(10) << previous->second.medianNs / 1e6 << " ms -> "
+                          << std::setw(10) << median / 1e6 << " ms  " << std::showpos << std::setprecision(1)
+                          << change << std::noshowpos << "%" << (regressed ? "  REGRESSION" : "") << std::endl;
+                if (previous->second.bytes != stage.bytes) {
+                    std::cerr << "  warning: baseline measured " << previous->second.bytes
+                              << " bytes here, this run " << stage.bytes << std::endl;
+                }
+            }
+            json << "}" << (i + 1 < stages.size() ? "," : "") << "\n";
+        }
+        json << "  ]";
+        if (!baseline.empty()) {
+            json << ",\n  \"threshold_percent\": " << threshold << ",\n";
+            json << "  \"regressions\": " << regressions;
+        }
+        json << "\n}\n";
+        
+        if (outputName.empty()) {
+            std::cout << json.str();
+        } else {
+            std::ofstream output(outputName, std::ios::binary);
+            if (!output.is_open()) {
+                throw std::runtime_error("Cannot create output file: " + outputName);
+            }
+            output << json.str();
+        }
+        
+        if (regressions > 0) {
+            std::cerr << regressions << " stage(s) slower than the baseline by more than "
+                      << threshold << "%" << std::endl;
+            return 2;
+        }
+        
+    } catch (const std::exception& e) {
+        if (!workDir.empty()) {
+            std::error_code error;
+            std::filesystem::remove_all(workDir, error);
+        }
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    return 0;
+}
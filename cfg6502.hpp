@@ -0,0 +1,372 @@
+// Control-flow graph over a classified 6502 listing.
+//
+// ControlFlowGraph is fed the listing in program order -- labels,
+// instructions, data and directives -- and splits it into basic blocks:
+// a block starts at a label, after a branch, jump, call, return or jump
+// table, and where code turns into data or back. Branch, jmp and table
+// targets are resolved against the labels to give successor and
+// predecessor edges. jsr is an edge to the instruction after it, with the
+// callee kept separately, so a subroutine's blocks are not successors of
+// its callers.
+//
+// Data and directives in the instruction stream form blocks of their own
+// that flow nowhere. A block that can reach code the graph cannot name --
+// through an indirect jmp, a target that is not a label or by running
+// off the end of the listing -- is marked as escaping.
+//
+#ifndef CFG6502_HPP
+#define CFG6502_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "isa6502.hpp"
+
+class ControlFlowGraph {
+public:
+    enum StatementKind {
+        STATEMENT_INSTRUCTION,
+        STATEMENT_DATA          // data and other directives
+    };
+    
+    // How control leaves a block
+    enum BlockExit {
+        EXIT_FALLTHROUGH,       // into the next block, which starts at a label
+        EXIT_BRANCH,            // to the target or the next block
+        EXIT_JUMP,
+        EXIT_INDIRECT_JUMP,     // jmp (pointer)
+        EXIT_CALL,              // jsr, returning to the next block
+        EXIT_TABLE,             // to one of the targets of a jump table
+        EXIT_RETURN,            // rts
+        EXIT_INTERRUPT_RETURN,  // rti
+        EXIT_BREAK,             // brk
+        EXIT_DATA,              // a data block; nothing can be followed
+        EXIT_END                // off the end of the listing
+    };
+    
+    struct Statement {
+        StatementKind kind;
+        std::string_view mnemonic;      // or the directive
+        std::string_view operand;
+        int lineNumber;
+    };
+    
+    struct Label {
+        std::string_view name;
+        size_t statement;               // index of the statement it names
+    };
+    
+    struct BasicBlock {
+        size_t first = 0;               // statements [first, end)
+        size_t end = 0;
+        std::vector<std::string_view> labels;
+        BlockExit exit = EXIT_END;
+        std::vector<std::string_view> targets;  // of the branch, jmp or table; the callee of a jsr
+        int callee = -1;                // block of the jsr target, -1 if unknown
+        std::vector<size_t> successors;
+        std::vector<size_t> predecessors;
+        bool escapes = false;
+    };
+
+private:
+    std::vector<Statement> statements;
+    std::vector<Label> labels;
+    std::vector<BasicBlock> blocks;
+    std::vector<size_t> blockByStatement;
+    std::unordered_map<std::string_view, size_t> blockByLabel;
+    std::unordered_map<size_t, std::vector<std::string_view>> tableTargets;     // by statement
+    
+    bool isData(size_t statement) const {
+        return statements[statement].kind == STATEMENT_DATA;
+    }
+    
+    // The exit a statement ends its block with, or EXIT_FALLTHROUGH when
+    // control simply continues
+    BlockExit transfer(size_t statement) const {
+        using namespace isa6502;
+        const Statement& s = statements[statement];
+        if (s.kind == STATEMENT_DATA) return EXIT_FALLTHROUGH;
+        if (tableTargets.count(statement)) return EXIT_TABLE;
+        switch (packMnemonic(s.mnemonic)) {
+            case packMnemonic("jmp"):
+                return !s.operand.empty() && s.operand[0] == '(' ? EXIT_INDIRECT_JUMP : EXIT_JUMP;
+            case packMnemonic("jsr"): return EXIT_CALL;
+            case packMnemonic("rts"): return EXIT_RETURN;
+            case packMnemonic("rti"): return EXIT_INTERRUPT_RETURN;
+            case packMnemonic("brk"): return EXIT_BREAK;
+            default: {
+                int index = mnemonicIndex(s.mnemonic);
+                return index >= 0 && isa6502::instruction(index).supports(RELATIVE) ? EXIT_BRANCH : EXIT_FALLTHROUGH;
+            }
+        }
+    }
+    
+    void addEdge(size_t from, size_t to) {
+        std::vector<size_t>& successors = blocks[from].successors;
+        if (std::find(successors.begin(), successors.end(), to) == successors.end()) {
+            successors.push_back(to);
+            blocks[to].predecessors.push_back(from);
+        }
+    }
+    
+    // Adds an edge to a named target, or marks the block as escaping
+    void addTargetEdge(size_t from, std::string_view target) {
+        auto block = blockByLabel.find(target);
+        if (block == blockByLabel.end()) {
+            blocks[from].escapes = true;
+        } else {
+            addEdge(from, block->second);
+        }
+    }
+    
+    static void writeEscaped(std::ostream& out, std::string_view text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\') out << '\\';
+            out << c;
+        }
+    }
+    
+    static void writeValue(std::ostream& out, size_t value) {
+        out << value;
+    }
+    
+    static void writeValue(std::ostream& out, std::string_view text) {
+        out << '"';
+        writeEscaped(out, text);
+        out << '"';
+    }
+    
+    template <typename Values>
+    static void writeList(std::ostream& out, const char* key, const Values& values) {
+        out << "      \"" << key << "\": [";
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i > 0) out << ", ";
+            writeValue(out, values[i]);
+        }
+        out << "]";
+    }
+
+public:
+    static const char* exitName(BlockExit exit) {
+        static const char* const names[] = {
+            "fallthrough", "branch", "jump", "indirect_jump", "call", "table",
+            "return", "interrupt_return", "break", "data", "end"
+        };
+        return names[exit];
+    }
+    
+    void clear() {
+        statements.clear();
+        labels.clear();
+        blocks.clear();
+        blockByStatement.clear();
+        blockByLabel.clear();
+        tableTargets.clear();
+    }
+    
+    // The views passed in must stay valid as long as the graph is used
+    void label(std::string_view name) {
+        labels.push_back(Label{name, statements.size()});
+    }
+    
+    void instruction(std::string_view mnemonic, std::string_view operand, int lineNumber) {
+        statements.push_back(Statement{STATEMENT_INSTRUCTION, mnemonic, operand, lineNumber});
+    }
+    
+    // An instruction that continues at one of targets, such as a
+    // jsr JumpEngine followed by its table
+    void jumpTable(std::string_view mnemonic, std::string_view operand, const std::vector<std::string_view>& targets,
+                   int lineNumber) {
+        tableTargets[statements.size()] = targets;
+        instruction(mnemonic, operand, lineNumber);
+    }
+    
+    void data(std::string_view directive, int lineNumber) {
+        statements.push_back(Statement{STATEMENT_DATA, directive, std::string_view(), lineNumber});
+    }
+    
+    // Splits the statements into blocks and links them
+    void build() {
+        blocks.clear();
+        blockByLabel.clear();
+        size_t count = statements.size();
+        
+        std::vector<char> leader(count + 1, 0);
+        leader[0] = 1;
+        for (const Label& label : labels) {
+            leader[label.statement] = 1;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (transfer(i) != EXIT_FALLTHROUGH) leader[i + 1] = 1;
+            if (i > 0 && isData(i) != isData(i - 1)) leader[i] = 1;
+        }
+        
+        // Blocks, with an empty one at the end only for labels there
+        blockByStatement.assign(count, 0);
+        bool labelAtEnd = !labels.empty() && labels.back().statement == count;
+        for (size_t i = 0; i < count || (i == count && labelAtEnd); ++i) {
+            if (leader[i] || blocks.empty()) {
+                if (!blocks.empty()) blocks.back().end = i;
+                blocks.emplace_back();
+                blocks.back().first = i;
+            }
+            if (i == count) break;
+            blockByStatement[i] = blocks.size() - 1;
+        }
+        if (!blocks.empty()) blocks.back().end = count;
+        
+        for (const Label& label : labels) {
+            size_t block = label.statement < count ? blockByStatement[label.statement] : blocks.size() - 1;
+            blocks[block].labels.push_back(label.name);
+            blockByLabel.emplace(label.name, block);
+        }
+        
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            BasicBlock& block = blocks[b];
+            bool last = b + 1 == blocks.size();
+            if (block.first == block.end) {
+                block.exit = last ? EXIT_END : EXIT_FALLTHROUGH;
+            } else if (isData(block.end - 1)) {
+                block.exit = EXIT_DATA;
+            } else {
+                block.exit = transfer(block.end - 1);
+                if (block.exit == EXIT_FALLTHROUGH && last) block.exit = EXIT_END;
+            }
+            
+            switch (block.exit) {
+                case EXIT_BRANCH:
+                case EXIT_JUMP:
+                case EXIT_CALL:
+                    block.targets.push_back(statements[block.end - 1].operand);
+                    break;
+                case EXIT_TABLE:
+                    block.targets = tableTargets[block.end - 1];
+                    break;
+                default:
+                    break;
+            }
+        }
+        
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            bool last = b + 1 == blocks.size();
+            switch (blocks[b].exit) {
+                case EXIT_BRANCH:
+                    addTargetEdge(b, blocks[b].targets[0]);
+                    if (last) blocks[b].escapes = true;
+                    else addEdge(b, b + 1);
+                    break;
+                case EXIT_JUMP:
+                    addTargetEdge(b, blocks[b].targets[0]);
+                    break;
+                case EXIT_TABLE:
+                    for (std::string_view target : blocks[b].targets) addTargetEdge(b, target);
+                    break;
+                case EXIT_CALL: {
+                    auto callee = blockByLabel.find(blocks[b].targets[0]);
+                    if (callee != blockByLabel.end()) blocks[b].callee = static_cast<int>(callee->second);
+                    if (last) blocks[b].escapes = true;
+                    else addEdge(b, b + 1);
+                    break;
+                }
+                case EXIT_FALLTHROUGH:
+                    addEdge(b, b + 1);
+                    break;
+                case EXIT_INDIRECT_JUMP:
+                case EXIT_END:
+                    blocks[b].escapes = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    
+    const std::vector<BasicBlock>& basicBlocks() const {
+        return blocks;
+    }
+    
+    const std::vector<Statement>& statementList() const {
+        return statements;
+    }
+    
+    // Labels in program order, with the statements they name
+    const std::vector<Label>& labelList() const {
+        return labels;
+    }
+    
+    size_t blockOf(size_t statement) const {
+        return blockByStatement[statement];
+    }
+    
+    // The block a label names, or -1; the first definition wins
+    int blockOf(std::string_view label) const {
+        auto block = blockByLabel.find(label);
+        return block == blockByLabel.end() ? -1 : static_cast<int>(block->second);
+    }
+    
+    // Graphviz: one box per block listing its statements, solid edges for
+    // control flow and dashed ones from calls to their callees
+    void writeDot(std::ostream& out) const {
+        out << "digraph cfg {\n";
+        out << "    node [shape=box, fontname=\"monospace\"];\n";
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            const BasicBlock& block = blocks[b];
+            out << "    b" << b << " [label=\"";
+            for (std::string_view name : block.labels) {
+                writeEscaped(out, name);
+                out << ":\\l";
+            }
+            for (size_t s = block.first; s < block.end; ++s) {
+                out << "    ";
+                writeEscaped(out, statements[s].mnemonic);
+                if (!statements[s].operand.empty()) {
+                    out << ' ';
+                    writeEscaped(out, statements[s].operand);
+                }
+                out << "\\l";
+            }
+            out << "\"" << (block.escapes ? ", color=red" : "") << "];\n";
+            for (size_t successor : block.successors) {
+                out << "    b" << b << " -> b" << successor << ";\n";
+            }
+            if (block.callee >= 0) {
+                out << "    b" << b << " -> b" << block.callee << " [style=dashed];\n";
+            }
+        }
+        out << "}\n";
+    }
+    
+    void writeJson(std::ostream& out) const {
+        out << "{\n  \"blocks\": [\n";
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            const BasicBlock& block = blocks[b];
+            int firstLine = block.first < block.end ? statements[block.first].lineNumber : -1;
+            int lastLine = block.first < block.end ? statements[block.end - 1].lineNumber : -1;
+            out << "    {\n";
+            out << "      \"id\": " << b << ",\n";
+            writeList(out, "labels", block.labels);
+            out << ",\n";
+            out << "      \"first_line\": " << firstLine << ",\n";
+            out << "      \"last_line\": " << lastLine << ",\n";
+            out << "      \"statements\": " << block.end - block.first << ",\n";
+            out << "      \"exit\": \"" << exitName(block.exit) << "\",\n";
+            writeList(out, "targets", block.targets);
+            out << ",\n";
+            out << "      \"callee\": " << block.callee << ",\n";
+            writeList(out, "successors", block.successors);
+            out << ",\n";
+            writeList(out, "predecessors", block.predecessors);
+            out << ",\n";
+            out << "      \"escapes\": " << (block.escapes ? "true" : "false") << "\n";
+            out << "    }" << (b + 1 < blocks.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+};
+
+#endif // CFG6502_HPP
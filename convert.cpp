@@ -2,10 +2,46 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <regex>
 #include <iomanip>
+#include <cctype>
+#include <memory>
+#include <stdexcept>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <type_traits>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include "asm6502.hpp"
+#include "batch.hpp"
+#include "ir6502.hpp"
+#include "isa6502.hpp"
+#include "mappedfile.hpp"
+#include "stats.hpp"
+#include "threadpool.hpp"
+#include "watch.hpp"
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 enum TokenType {
     LABEL,
@@ -18,181 +54,387 @@ enum TokenType {
     UNKNOWN
 };
 
+static_assert(static_cast<int>(IR_LABEL) == LABEL && static_cast<int>(IR_UNKNOWN) == UNKNOWN,
+              "IrTokenType mirrors TokenType");
+
+// Token fields are slices of the input buffer owned by the converter,
+// so a Token must not outlive the AssemblyToJsonConverter that made it.
 struct Token {
     TokenType type;
-    std::string value;
-    std::string operand;
-    std::string comment;
+    std::string_view value;
+    std::string_view operand;
+    std::string_view comment;
     int lineNumber;
-    std::vector<std::string> dataValues;
+    std::vector<std::string_view> dataValues;
 };
 
-class AssemblyToJsonConverter {
+// Finds the characters the line lexer cares about -- newline, ';', '"',
+// '\\', ',' and '=' -- 64 bytes at a time. Each block is turned into a
+// bitmask with one bit per byte, using AVX2 or SSE2 compares when the
+// compiler targets them and a table lookup otherwise. Whitespace is left
+// out of the mask on purpose: it only matters at the edges of a field,
+// and column-aligned listings would flood the mask with spaces.
+class StructuralScanner {
 private:
-    std::vector<Token> tokens;
-    std::map<std::string, std::string> constants;
-    
-    bool isInstruction(const std::string& word) {
-        static const std::vector<std::string> instructions = {
-            "lda", "ldx", "ldy", "sta", "stx", "sty",
-            "tax", "tay", "txa", "tya", "tsx", "txs",
-            "pha", "php", "pla", "plp",
-            "and", "eor", "ora", "bit",
-            "adc", "sbc", "cmp", "cpx", "cpy",
-            "inc", "inx", "iny", "dec", "dex", "dey",
-            "asl", "lsr", "rol", "ror",
-            "jmp", "jsr", "rts",
-            "bcc", "bcs", "beq", "bmi", "bne", "bpl", "bvc", "bvs",
-            "clc", "cld", "cli", "clv", "sec", "sed", "sei",
-            "brk", "nop", "rti"
-        };
+    static constexpr size_t BLOCK_SIZE = 64;
+    
+    const char* base;
+    size_t length;
+    size_t blockStart = 0;
+    uint64_t mask = 0;
+    bool useSimd;
+    
+    static bool isStructural(unsigned char c) {
+        return c == '\n' || c == ';' || c == '"' || c == '\\' || c == ',' || c == '=';
+    }
+    
+    static uint64_t scalarMask(const char* block) {
+        static const struct Table {
+            bool entries[256];
+            Table() : entries() {
+                for (int c = 0; c < 256; ++c) {
+                    entries[c] = isStructural(static_cast<unsigned char>(c));
+                }
+            }
+        } table;
         
-        for (const auto& inst : instructions) {
-            if (word == inst) return true;
+        uint64_t bits = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+            bits |= static_cast<uint64_t>(table.entries[static_cast<unsigned char>(block[i])]) << i;
         }
-        return false;
+        return bits;
     }
     
-    bool isDataDirective(const std::string& word) {
-        static const std::vector<std::string> dataDirectives = {
-            ".byte", ".db", ".word", ".dw", ".dbyte", ".addr", ".res", ".byt"
-        };
+#if defined(__AVX2__)
+    static uint64_t simdMask(const char* block) {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i semicolon = _mm256_set1_epi8(';');
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i comma = _mm256_set1_epi8(',');
+        const __m256i equals = _mm256_set1_epi8('=');
         
-        for (const auto& dir : dataDirectives) {
-            if (word == dir) return true;
+        uint64_t bits = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; i += 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+            __m256i hits = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline), _mm256_cmpeq_epi8(chunk, semicolon)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)));
+            hits = _mm256_or_si256(hits,
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, comma), _mm256_cmpeq_epi8(chunk, equals)));
+            bits |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hits))) << i;
         }
-        return false;
+        return bits;
     }
-    
-    std::string trim(const std::string& str) {
-        size_t start = str.find_first_not_of(" \t\r\n");
-        if (start == std::string::npos) return "";
-        size_t end = str.find_last_not_of(" \t\r\n");
-        return str.substr(start, end - start + 1);
+#elif defined(__SSE2__)
+    static uint64_t simdMask(const char* block) {
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i semicolon = _mm_set1_epi8(';');
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i equals = _mm_set1_epi8('=');
+        
+        uint64_t bits = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, semicolon)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+            hits = _mm_or_si128(hits,
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, equals)));
+            bits |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(hits))) << i;
+        }
+        return bits;
+    }
+#else
+    static uint64_t simdMask(const char* block) {
+        return scalarMask(block);
     }
+#endif
     
-    std::vector<std::string> parseDataValues(const std::string& str) {
-        std::vector<std::string> values;
-        std::string current;
-        bool inQuotes = false;
-        bool escaped = false;
-        
-        for (size_t i = 0; i < str.length(); ++i) {
-            char c = str[i];
-            
-            if (escaped) {
-                current += c;
-                escaped = false;
-                continue;
-            }
-            
-            if (c == '\\' && inQuotes) {
-                current += c;
-                escaped = true;
-                continue;
-            }
-            
-            if (c == '"') {
-                current += c;
-                inQuotes = !inQuotes;
-                continue;
-            }
-            
-            if (c == ',' && !inQuotes) {
-                std::string trimmed = trim(current);
-                if (!trimmed.empty()) {
-                    values.push_back(trimmed);
-                }
-                current.clear();
-                continue;
-            }
-            
-            current += c;
+    uint64_t blockMask(size_t offset) const {
+        if (offset + BLOCK_SIZE <= length) {
+            return useSimd ? simdMask(base + offset) : scalarMask(base + offset);
         }
         
-        // Add the last value
-        std::string trimmed = trim(current);
-        if (!trimmed.empty()) {
-            values.push_back(trimmed);
+        // Pad the final partial block with zeros, which are never structural
+        char tail[BLOCK_SIZE] = {};
+        std::memcpy(tail, base + offset, length - offset);
+        return useSimd ? simdMask(tail) : scalarMask(tail);
+    }
+    
+    static unsigned lowestBit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+        unsigned index = 0;
+        while (!(bits & 1)) {
+            bits >>= 1;
+            index++;
         }
-        
-        return values;
+        return index;
+#endif
     }
     
-    std::vector<std::string> split(const std::string& str, char delimiter) {
-        std::vector<std::string> tokens;
-        std::string token;
-        std::istringstream tokenStream(str);
-        while (std::getline(tokenStream, token, delimiter)) {
-            tokens.push_back(trim(token));
+public:
+    StructuralScanner(std::string_view buffer, bool simd)
+        : base(buffer.data()), length(buffer.size()), useSimd(simd) {
+        if (length > 0) {
+            mask = blockMask(0);
         }
-        return tokens;
     }
     
-    std::string extractComment(const std::string& line) {
-        bool inQuotes = false;
-        bool escaped = false;
-        
-        for (size_t i = 0; i < line.length(); ++i) {
-            char c = line[i];
-            
-            if (escaped) {
-                escaped = false;
-                continue;
-            }
-            
-            if (c == '\\' && inQuotes) {
-                escaped = true;
-                continue;
-            }
-            
-            if (c == '"') {
-                inQuotes = !inQuotes;
-                continue;
-            }
-            
-            if (c == ';' && !inQuotes) {
-                return trim(line.substr(i + 1));
+    static const char* simdName() {
+#if defined(__AVX2__)
+        return "AVX2";
+#elif defined(__SSE2__)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+    
+    // Returns the offset of the next structural character, or the buffer
+    // length once the input is exhausted.
+    size_t next() {
+        while (mask == 0) {
+            blockStart += BLOCK_SIZE;
+            if (blockStart >= length) {
+                return length;
             }
+            mask = blockMask(blockStart);
         }
         
-        return "";
+        size_t pos = blockStart + lowestBit(mask);
+        mask &= mask - 1;
+        return pos;
     }
+};
+
+// Marks text that must be JSON-escaped as it is written
+struct JsonEscaped {
+    std::string_view text;
+};
+
+// Buffered writer that streams the JSON document straight to a file
+// descriptor in fixed-size chunks, so memory use stays bounded however
+// large the output grows.
+class JsonWriter {
+private:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
     
-    std::string removeComment(const std::string& line) {
-        bool inQuotes = false;
-        bool escaped = false;
-        
-        for (size_t i = 0; i < line.length(); ++i) {
-            char c = line[i];
-            
-            if (escaped) {
-                escaped = false;
-                continue;
-            }
-            
-            if (c == '\\' && inQuotes) {
-                escaped = true;
-                continue;
+    std::unique_ptr<char[]> buffer;
+    size_t used = 0;
+    int fd = -1;
+    std::string filename;
+    
+    void writeAll(const char* data, size_t length) {
+        while (length > 0) {
+#ifdef _WIN32
+            int written = _write(fd, data, static_cast<unsigned>(std::min<size_t>(length, 1u << 30)));
+#else
+            ssize_t written = ::write(fd, data, length);
+#endif
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("Cannot write output file: " + filename);
             }
-            
-            if (c == '"') {
-                inQuotes = !inQuotes;
-                continue;
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+    }
+    
+    void append(const char* data, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        if (length >= BUFFER_SIZE) {
+            flush();
+            writeAll(data, length);
+            return;
+        }
+        if (used + length > BUFFER_SIZE) {
+            flush();
+        }
+        std::memcpy(buffer.get() + used, data, length);
+        used += length;
+    }
+    
+    // Escape sequences for the characters escapeJson has always handled;
+    // everything else is copied through unchanged.
+    static const char* escapeFor(unsigned char c) {
+        switch (c) {
+            case '"': return "\\\"";
+            case '\\': return "\\\\";
+            case '\b': return "\\b";
+            case '\f': return "\\f";
+            case '\n': return "\\n";
+            case '\r': return "\\r";
+            case '\t': return "\\t";
+            default: return nullptr;
+        }
+    }
+    
+public:
+    explicit JsonWriter(const std::string& outputFilename)
+        : buffer(new char[BUFFER_SIZE]), filename(outputFilename) {
+#ifdef _WIN32
+        fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE);
+#else
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create output file: " + filename);
+        }
+    }
+    
+    ~JsonWriter() {
+        if (fd >= 0) {
+            try {
+                flush();
+            } catch (const std::exception&) {
+                // Destructors must not throw; close() reports write errors
             }
-            
-            if (c == ';' && !inQuotes) {
-                return trim(line.substr(0, i));
+#ifdef _WIN32
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+        }
+    }
+    
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+    
+    void flush() {
+        if (used > 0) {
+            writeAll(buffer.get(), used);
+            used = 0;
+        }
+    }
+    
+    void close() {
+        flush();
+#ifdef _WIN32
+        int result = _close(fd);
+#else
+        int result = ::close(fd);
+#endif
+        fd = -1;
+        if (result != 0) {
+            throw std::runtime_error("Cannot write output file: " + filename);
+        }
+    }
+    
+    JsonWriter& operator<<(std::string_view text) {
+        append(text.data(), text.length());
+        return *this;
+    }
+    
+    JsonWriter& operator<<(char c) {
+        if (used == BUFFER_SIZE) {
+            flush();
+        }
+        buffer[used++] = c;
+        return *this;
+    }
+    
+    template <typename Integer, typename = std::enable_if_t<std::is_integral<Integer>::value>>
+    JsonWriter& operator<<(Integer value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        append(digits, static_cast<size_t>(result.ptr - digits));
+        return *this;
+    }
+    
+    // Runs of characters that need no escaping are copied in bulk
+    JsonWriter& operator<<(JsonEscaped escaped) {
+        std::string_view text = escaped.text;
+        size_t runStart = 0;
+        for (size_t i = 0; i < text.length(); ++i) {
+            const char* replacement = escapeFor(static_cast<unsigned char>(text[i]));
+            if (replacement) {
+                append(text.data() + runStart, i - runStart);
+                append(replacement, 2);
+                runStart = i + 1;
             }
         }
+        append(text.data() + runStart, text.length() - runStart);
+        return *this;
+    }
+};
+
+class AssemblyToJsonConverter {
+private:
+    // Everything the lexer produces for one run over a buffer. Parallel
+    // parsing gives each chunk its own, so workers share no state.
+    struct LexState {
+        std::vector<Token> tokens;
+        std::map<std::string_view, std::string_view> constants;
+        std::vector<size_t> commaScratch;
+        int lines = 0;
+    };
+    
+    // Chunks smaller than this are not worth a hand-off to another thread
+    static constexpr size_t MIN_CHUNK_SIZE = 256 * 1024;
+    
+    std::vector<std::unique_ptr<MappedFile>> inputs;
+    std::string source;     // watch mode keeps its own copy of the input
+    std::vector<Token> tokens;
+    std::map<std::string_view, std::string_view> constants;
+    bool useSimdLexer = true;
+    std::unique_ptr<WorkStealingPool> pool;     // only with more than one thread
+    RunStats* stats = nullptr;
+    int linesRead = 0;
+    Assembler6502 assembler;    // kept so batch runs reuse its buffers
+    
+    bool isInstruction(std::string_view word) {
+        return isa6502::isInstruction(word);
+    }
+    
+    bool isDataDirective(std::string_view word) {
+        static const std::vector<std::string> dataDirectives = {
+            ".byte", ".db", ".word", ".dw", ".dbyte", ".addr", ".res", ".byt"
+        };
         
-        return trim(line);
+        for (const auto& dir : dataDirectives) {
+            if (word == dir) return true;
+        }
+        return false;
+    }
+    
+    std::string_view trim(std::string_view str) {
+        size_t start = str.find_first_not_of(" \t\r\n");
+        if (start == std::string_view::npos) return std::string_view();
+        size_t end = str.find_last_not_of(" \t\r\n");
+        return str.substr(start, end - start + 1);
     }
     
-    TokenType classifyLine(const std::string& line, Token& token) {
-        std::string cleanLine = removeComment(line);
-        token.comment = extractComment(line);
+    std::vector<std::string> split(const std::string& str, char delimiter) {
+        std::vector<std::string> tokens;
+        std::string token;
+        std::istringstream tokenStream(str);
+        while (std::getline(tokenStream, token, delimiter)) {
+            tokens.emplace_back(trim(token));
+        }
+        return tokens;
+    }
+    
+    // Builds a token from the structural positions the lexer collected for
+    // one line: the first unquoted ';' and the first '=' before it (npos
+    // if absent) and every unquoted ',' before the comment.
+    TokenType classifyLine(std::string_view buffer, size_t lineStart, size_t lineEnd,
+                           size_t commentPos, size_t equalPos,
+                           const std::vector<size_t>& commas, Token& token,
+                           std::map<std::string_view, std::string_view>& constants) {
+        size_t codeEnd = lineEnd;
+        if (commentPos != std::string_view::npos) {
+            codeEnd = commentPos;
+            token.comment = trim(buffer.substr(commentPos + 1, lineEnd - commentPos - 1));
+        }
         
+        std::string_view cleanLine = trim(buffer.substr(lineStart, codeEnd - lineStart));
         if (cleanLine.empty()) {
             return COMMENT;
         }
@@ -204,28 +446,48 @@ private:
         }
         
         // Check for constant declaration (contains =)
-        size_t equalPos = cleanLine.find('=');
-        if (equalPos != std::string::npos) {
-            token.value = trim(cleanLine.substr(0, equalPos));
-            token.operand = trim(cleanLine.substr(equalPos + 1));
+        if (equalPos != std::string_view::npos) {
+            size_t cleanStart = static_cast<size_t>(cleanLine.data() - buffer.data());
+            token.value = trim(cleanLine.substr(0, equalPos - cleanStart));
+            token.operand = trim(cleanLine.substr(equalPos - cleanStart + 1));
             constants[token.value] = token.operand;
             return CONSTANT_DECL;
         }
         
-        // Parse first word to check directive type
-        std::istringstream iss(cleanLine);
-        std::string firstWord;
-        iss >> firstWord;
+        // Split off the first word to check directive type
+        size_t wordStart = 0;
+        while (wordStart < cleanLine.length() && std::isspace(static_cast<unsigned char>(cleanLine[wordStart]))) {
+            wordStart++;
+        }
+        size_t wordEnd = wordStart;
+        while (wordEnd < cleanLine.length() && !std::isspace(static_cast<unsigned char>(cleanLine[wordEnd]))) {
+            wordEnd++;
+        }
+        std::string_view firstWord = cleanLine.substr(wordStart, wordEnd - wordStart);
+        std::string_view rest = trim(cleanLine.substr(wordEnd));
         
         // Check for data directives (more comprehensive)
         if (isDataDirective(firstWord)) {
             token.value = firstWord;
-            std::string rest;
-            std::getline(iss, rest);
-            rest = trim(rest);
             
+            // The directive name never holds a quote, so the lexer's quote
+            // state was clean when the values started and its commas apply
             if (!rest.empty()) {
-                token.dataValues = parseDataValues(rest);
+                size_t restStart = static_cast<size_t>(rest.data() - buffer.data());
+                size_t restEnd = restStart + rest.length();
+                size_t valueStart = restStart;
+                for (size_t comma : commas) {
+                    if (comma < restStart) continue;
+                    std::string_view trimmed = trim(buffer.substr(valueStart, comma - valueStart));
+                    if (!trimmed.empty()) {
+                        token.dataValues.push_back(trimmed);
+                    }
+                    valueStart = comma + 1;
+                }
+                std::string_view trimmed = trim(buffer.substr(valueStart, restEnd - valueStart));
+                if (!trimmed.empty()) {
+                    token.dataValues.push_back(trimmed);
+                }
             }
             
             // Determine if it's bytes or words
@@ -237,68 +499,424 @@ private:
         }
         
         // Check for other directives (start with .)
-        if (firstWord[0] == '.') {
+        if (!firstWord.empty() && firstWord[0] == '.') {
             token.value = firstWord;
-            std::string rest;
-            std::getline(iss, rest);
-            token.operand = trim(rest);
+            token.operand = rest;
             return DIRECTIVE;
         }
         
         // Check for instructions
         if (isInstruction(firstWord)) {
             token.value = firstWord;
-            std::string rest;
-            std::getline(iss, rest);
-            token.operand = trim(rest);
+            token.operand = rest;
             return INSTRUCTION;
         }
         
         return UNKNOWN;
     }
     
-    std::string escapeJson(const std::string& str) {
-        std::string escaped;
-        for (char c : str) {
-            switch (c) {
-                case '"': escaped += "\\\""; break;
-                case '\\': escaped += "\\\\"; break;
-                case '\b': escaped += "\\b"; break;
-                case '\f': escaped += "\\f"; break;
-                case '\n': escaped += "\\n"; break;
-                case '\r': escaped += "\\r"; break;
-                case '\t': escaped += "\\t"; break;
-                default: escaped += c; break;
-            }
-        }
-        return escaped;
-    }
-    
-public:
-    void parseFile(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open file: " + filename);
-        }
+    // Single pass over the buffer: the structural scanner yields every
+    // interesting character in order, quote and escape state is tracked
+    // across them, and each line is classified once its newline is seen.
+    // Lines are numbered from 1 within the buffer. No state carries from
+    // one line to the next, so any run of whole lines can be lexed alone.
+    void lexBuffer(std::string_view buffer, LexState& state) {
+        std::vector<size_t>& commaScratch = state.commaScratch;
+        StructuralScanner scanner(buffer, useSimdLexer);
+        const size_t npos = std::string_view::npos;
         
-        std::string line;
+        size_t lineStart = 0;
+        size_t pos = scanner.next();
         int lineNumber = 1;
         
-        while (std::getline(file, line)) {
+        while (lineStart < buffer.size()) {
+            size_t commentPos = npos;
+            size_t equalPos = npos;
+            size_t skipPos = npos;
+            bool inQuotes = false;
+            commaScratch.clear();
+            
+            while (pos < buffer.size() && buffer[pos] != '\n') {
+                if (commentPos == npos) {
+                    char c = buffer[pos];
+                    
+                    // find('=') never cared about quoting or escapes
+                    if (c == '=' && equalPos == npos) {
+                        equalPos = pos;
+                    }
+                    
+                    if (pos != skipPos) {
+                        switch (c) {
+                            case ';':
+                                if (!inQuotes) commentPos = pos;
+                                break;
+                            case '"':
+                                inQuotes = !inQuotes;
+                                break;
+                            case '\\':
+                                if (inQuotes) skipPos = pos + 1;
+                                break;
+                            case ',':
+                                if (!inQuotes) commaScratch.push_back(pos);
+                                break;
+                        }
+                    }
+                }
+                pos = scanner.next();
+            }
+            
+            size_t lineEnd = pos;
+            if (pos < buffer.size()) {
+                pos = scanner.next();
+            }
+            
             Token token;
             token.lineNumber = lineNumber;
-            token.type = classifyLine(line, token);
+            token.type = classifyLine(buffer, lineStart, lineEnd, commentPos, equalPos,
+                                      commaScratch, token, state.constants);
             
             if (token.type != COMMENT || !token.comment.empty()) {
-                tokens.push_back(token);
+                state.tokens.push_back(std::move(token));
             }
             
+            lineStart = lineEnd + 1;
             lineNumber++;
         }
+        
+        state.lines = lineNumber - 1;
+    }
+    
+    // Appends one lexed buffer, shifting its line numbers by lineOffset.
+    // Later constant declarations override earlier ones, as in one pass.
+    void appendLexed(LexState& state, int lineOffset) {
+        if (tokens.empty() && lineOffset == 0) {
+            tokens.swap(state.tokens);
+        } else {
+            tokens.reserve(tokens.size() + state.tokens.size());
+            for (Token& token : state.tokens) {
+                token.lineNumber += lineOffset;
+                tokens.push_back(std::move(token));
+            }
+        }
+        for (const auto& constant : state.constants) {
+            constants[constant.first] = constant.second;
+        }
+    }
+    
+    // Splits the buffer into chunks of whole lines, lexes them on a pool
+    // of threads and appends the results in input order, so the tokens
+    // are exactly those of a single pass
+    void lexBufferParallel(std::string_view buffer) {
+        // A few chunks per thread keeps the threads busy when lines vary in cost
+        size_t threadCount = pool ? static_cast<size_t>(pool->size()) : 1;
+        size_t chunkCount = std::max<size_t>(1, std::min(buffer.size() / MIN_CHUNK_SIZE, threadCount * 4));
+        if (threadCount == 1 || chunkCount == 1) {
+            LexState state;
+            lexBuffer(buffer, state);
+            appendLexed(state, 0);
+            linesRead += state.lines;
+            return;
+        }
+        
+        // Every chunk but the last ends just after a newline
+        std::vector<std::string_view> chunks;
+        size_t chunkStart = 0;
+        for (size_t i = 1; i < chunkCount && chunkStart < buffer.size(); ++i) {
+            size_t target = std::max(chunkStart, buffer.size() * i / chunkCount);
+            size_t newline = buffer.find('\n', target);
+            if (newline == std::string_view::npos) break;
+            chunks.push_back(buffer.substr(chunkStart, newline + 1 - chunkStart));
+            chunkStart = newline + 1;
+        }
+        if (chunkStart < buffer.size()) {
+            chunks.push_back(buffer.substr(chunkStart));
+        }
+        
+        std::vector<LexState> states(chunks.size());
+        pool->run(chunks.size(), [&](size_t i, int) {
+            StatsPhase phase(stats, "classify chunk", true);
+            lexBuffer(chunks[i], states[i]);
+        });
+        
+        int lineOffset = 0;
+        for (LexState& state : states) {
+            appendLexed(state, lineOffset);
+            lineOffset += state.lines;
+        }
+        linesRead += lineOffset;
+    }
+    
+    JsonEscaped escapeJson(std::string_view str) {
+        return JsonEscaped{str};
+    }
+    
+    void countTokens() {
+        if (!stats) return;
+        static const char* const typeNames[] = {
+            "LABEL", "INSTRUCTION", "DATA_BYTES", "DATA_WORDS", "DIRECTIVE", "CONSTANT_DECL", "COMMENT", "UNKNOWN"
+        };
+        uint64_t counts[UNKNOWN + 1] = {};
+        for (const Token& token : tokens) {
+            counts[token.type]++;
+        }
+        for (int type = LABEL; type <= UNKNOWN; ++type) {
+            stats->addCount("Tokens", typeNames[type], counts[type]);
+        }
+    }
+    
+public:
+    void parseFile(const std::string& filename) {
+        {
+            StatsPhase phase(stats, "read");
+            inputs.push_back(std::make_unique<MappedFile>(filename));
+        }
+        {
+            StatsPhase phase(stats, "classify");
+            lexBufferParallel(inputs.back()->view());
+        }
+        countTokens();
+    }
+    
+    // Watch mode: replaces the input with a new revision of the text and
+    // re-lexes only the lines between the unchanged head and tail of the
+    // file. Tokens outside that range are kept, with their views moved to
+    // the new text and their line numbers shifted. Returns the number of
+    // lines lexed.
+    size_t updateSource(std::string text) {
+        if (text == source && !tokens.empty()) {
+            return 0;
+        }
+        
+        // Token views are rebased by offset from the old text's address,
+        // which a short string does not keep across the swap
+        const char* previousBase = source.data();
+        std::string previous;
+        previous.swap(source);
+        source = std::move(text);
+        const std::string& current = source;
+        
+        // Unchanged head, backed up to the start of the first changed line
+        size_t limit = std::min(previous.size(), current.size());
+        size_t head = static_cast<size_t>(
+            std::mismatch(previous.begin(), previous.begin() + limit, current.begin()).first - previous.begin());
+        size_t prefixEnd = head == 0 ? 0 : previous.rfind('\n', head - 1) + 1;
+        
+        // Unchanged tail, not overlapping the head, moved forward to the
+        // start of the first line that is whole in both revisions
+        size_t tail = 0;
+        while (tail < limit - prefixEnd &&
+               previous[previous.size() - 1 - tail] == current[current.size() - 1 - tail]) {
+            tail++;
+        }
+        size_t suffixNew = current.size() - tail;
+        size_t suffixOld = previous.size() - tail;
+        if ((suffixNew > 0 && current[suffixNew - 1] != '\n') ||
+            (suffixOld > 0 && previous[suffixOld - 1] != '\n')) {
+            size_t newline = current.find('\n', suffixNew);
+            size_t advance = newline == std::string::npos ? tail : newline + 1 - suffixNew;
+            suffixNew += advance;
+            suffixOld += advance;
+        }
+        
+        auto linesBefore = [](const std::string& text, size_t end) {
+            return static_cast<int>(std::count(text.begin(), text.begin() + end, '\n'));
+        };
+        int prefixLines = linesBefore(current, prefixEnd);
+        int suffixOldLine = linesBefore(previous, suffixOld);
+        int lineShift = linesBefore(current, suffixNew) - suffixOldLine;
+        
+        auto rebase = [&](std::string_view view, size_t byteShift) {
+            if (view.empty()) return std::string_view();
+            size_t offset = static_cast<size_t>(view.data() - previousBase) + byteShift;
+            return std::string_view(current.data() + offset, view.size());
+        };
+        auto rebaseToken = [&](Token& token, size_t byteShift) {
+            token.value = rebase(token.value, byteShift);
+            token.operand = rebase(token.operand, byteShift);
+            token.comment = rebase(token.comment, byteShift);
+            for (auto& dataValue : token.dataValues) {
+                dataValue = rebase(dataValue, byteShift);
+            }
+        };
+        
+        LexState changed;
+        StatsPhase classifying(stats, "classify");
+        lexBuffer(std::string_view(current).substr(prefixEnd, suffixNew - prefixEnd), changed);
+        
+        std::vector<Token> previousTokens;
+        previousTokens.swap(tokens);
+        tokens.reserve(previousTokens.size() + changed.tokens.size());
+        size_t next = 0;
+        for (; next < previousTokens.size() && previousTokens[next].lineNumber <= prefixLines; ++next) {
+            rebaseToken(previousTokens[next], 0);
+            tokens.push_back(std::move(previousTokens[next]));
+        }
+        for (Token& token : changed.tokens) {
+            token.lineNumber += prefixLines;
+            tokens.push_back(std::move(token));
+        }
+        for (; next < previousTokens.size() && suffixOld < previous.size(); ++next) {
+            if (previousTokens[next].lineNumber > suffixOldLine) {
+                rebaseToken(previousTokens[next], suffixNew - suffixOld);
+                previousTokens[next].lineNumber += lineShift;
+                tokens.push_back(std::move(previousTokens[next]));
+            }
+        }
+        
+        constants.clear();
+        for (const Token& token : tokens) {
+            if (token.type == CONSTANT_DECL) {
+                constants[token.value] = token.operand;
+            }
+        }
+        
+        linesRead = static_cast<int>(std::count(current.begin(), current.end(), '\n'));
+        if (!current.empty() && current.back() != '\n') {
+            linesRead++;
+        }
+        classifying.stop();
+        countTokens();
+        return static_cast<size_t>(changed.lines);
+    }
+    
+    // Number of threads parseFile lexes with; 1 keeps everything serial
+    // and 0 means one per hardware thread
+    void setThreadCount(int count) {
+        pool.reset();
+        if (count != 1) {
+            pool = std::make_unique<WorkStealingPool>(count);
+            if (pool->size() == 1) pool.reset();
+        }
     }
     
-    std::string generateJson() {
-        std::ostringstream json;
+    // Forgets the previous input so the converter can be reused for the
+    // next file, keeping the capacity it has grown
+    void reset() {
+        tokens.clear();
+        constants.clear();
+        inputs.clear();
+        source.clear();
+        linesRead = 0;
+    }
+    
+    // Phases and token counts go to runStats; null turns them off
+    void setStats(RunStats* runStats) {
+        stats = runStats;
+    }
+    
+    // Selects between the SIMD structural scanner and its scalar fallback
+    void setSimdLexer(bool enabled) {
+        useSimdLexer = enabled;
+    }
+    
+    int lineCount() const {
+        return linesRead;
+    }
+    
+    // Writes the tokens as a .6502ir image: every token once, with the
+    // sections stored as index lists into the token table
+    void generateIr(const std::string& filename) {
+        StatsPhase building(stats, "codegen");
+        IrBuilder builder;
+        
+        for (const auto& token : tokens) {
+            uint32_t index = builder.addToken(token.lineNumber, static_cast<IrTokenType>(token.type),
+                                              token.value, token.operand, token.comment, token.dataValues);
+            switch (token.type) {
+                case CONSTANT_DECL: builder.addToSection(IR_CONSTANTS, index); break;
+                case LABEL: builder.addToSection(IR_LABELS, index); break;
+                case INSTRUCTION: builder.addToSection(IR_INSTRUCTIONS, index); break;
+                case DATA_BYTES:
+                case DATA_WORDS: builder.addToSection(IR_DATA, index); break;
+                case DIRECTIVE: builder.addToSection(IR_DIRECTIVES, index); break;
+                default: break;
+            }
+            if (token.type != COMMENT) {
+                builder.addToSection(IR_PROGRAM_FLOW, index);
+            }
+        }
+        
+        std::string image = builder.finish();
+        building.stop();
+        
+        StatsPhase writing(stats, "write");
+        std::ofstream outputFile(filename, std::ios::binary);
+        if (!outputFile.is_open()) {
+            throw std::runtime_error("Cannot create output file: " + filename);
+        }
+        outputFile.write(image.data(), static_cast<std::streamsize>(image.size()));
+        outputFile.close();
+        if (!outputFile) {
+            throw std::runtime_error("Cannot write output file: " + filename);
+        }
+    }
+    
+    // Assembles the tokens to a raw binary at filename, with the label
+    // addresses written next to it as filename.sym
+    void generateBinary(const std::string& filename) {
+        StatsPhase assembling(stats, "assemble");
+        assembler.reset();
+        for (const auto& token : tokens) {
+            switch (token.type) {
+                case LABEL: assembler.label(token.value, token.lineNumber); break;
+                case CONSTANT_DECL: assembler.constant(token.value, token.operand); break;
+                case INSTRUCTION: assembler.instruction(token.value, token.operand, token.lineNumber); break;
+                case DATA_BYTES:
+                case DATA_WORDS: assembler.data(token.value, token.dataValues, token.lineNumber); break;
+                case DIRECTIVE: assembler.directive(token.value, token.operand, token.lineNumber); break;
+                case UNKNOWN:
+                    throw std::runtime_error("Line " + std::to_string(token.lineNumber) +
+                                             ": cannot assemble an unrecognized line");
+                default: break;
+            }
+        }
+        assembler.assemble();
+        assembling.stop();
+        
+        StatsPhase writing(stats, "write");
+        assembler.writeBinary(filename);
+        assembler.writeSymbols(filename + ".sym");
+        
+        if (stats) {
+            const Assembler6502::Counts& counts = assembler.statistics();
+            stats->addCount("Assembler", "instructions", counts.instructions);
+            stats->addCount("Assembler", "zero page operands", counts.zeroPageOperands);
+            stats->addCount("Assembler", "absolute operands", counts.absoluteOperands);
+            stats->addCount("Assembler", "branches", counts.branches);
+            stats->addCount("Assembler", "data bytes", counts.dataBytes);
+            stats->addCount("Assembler", "ignored directives", counts.ignoredDirectives);
+            stats->addCount("Assembler", "image bytes", assembler.image().size());
+        }
+    }
+    
+    void generateJson(JsonWriter& json) {
+        StatsPhase phase(stats, "write");
+        
+        // Bucket the tokens by section in one pass, so each section below
+        // only visits its own records
+        std::vector<const Token*> constantTokens;
+        std::vector<const Token*> labelTokens;
+        std::vector<const Token*> instructionTokens;
+        std::vector<const Token*> dataTokens;
+        std::vector<const Token*> directiveTokens;
+        std::vector<const Token*> flowTokens;
+        flowTokens.reserve(tokens.size());
+        
+        for (const auto& token : tokens) {
+            switch (token.type) {
+                case CONSTANT_DECL: constantTokens.push_back(&token); break;
+                case LABEL: labelTokens.push_back(&token); break;
+                case INSTRUCTION: instructionTokens.push_back(&token); break;
+                case DATA_BYTES:
+                case DATA_WORDS: dataTokens.push_back(&token); break;
+                case DIRECTIVE: directiveTokens.push_back(&token); break;
+                default: break;
+            }
+            if (token.type != COMMENT) {
+                flowTokens.push_back(&token);
+            }
+        }
+        
         json << "{\n";
         json << "  \"assembly_program\": {\n";
         json << "    \"metadata\": {\n";
@@ -309,174 +927,305 @@ public:
         // Constants section
         json << "    \"constants\": [\n";
         bool firstConstant = true;
-        for (const auto& token : tokens) {
-            if (token.type == CONSTANT_DECL) {
-                if (!firstConstant) json << ",\n";
-                json << "      {\n";
-                json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
-                json << "        \"value\": \"" << escapeJson(token.operand) << "\",\n";
-                json << "        \"line\": " << token.lineNumber;
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
-                }
-                json << "\n      }";
-                firstConstant = false;
+        for (const Token* tokenPtr : constantTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstConstant) json << ",\n";
+            json << "      {\n";
+            json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
+            json << "        \"value\": \"" << escapeJson(token.operand) << "\",\n";
+            json << "        \"line\": " << token.lineNumber;
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
             }
+            json << "\n      }";
+            firstConstant = false;
         }
         json << "\n    ],\n";
         
         // Labels section
         json << "    \"labels\": [\n";
         bool firstLabel = true;
-        for (const auto& token : tokens) {
-            if (token.type == LABEL) {
-                if (!firstLabel) json << ",\n";
-                json << "      {\n";
-                json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
-                json << "        \"line\": " << token.lineNumber;
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
-                }
-                json << "\n      }";
-                firstLabel = false;
+        for (const Token* tokenPtr : labelTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstLabel) json << ",\n";
+            json << "      {\n";
+            json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
+            json << "        \"line\": " << token.lineNumber;
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
             }
+            json << "\n      }";
+            firstLabel = false;
         }
         json << "\n    ],\n";
         
         // Instructions section
         json << "    \"instructions\": [\n";
         bool firstInstruction = true;
-        for (const auto& token : tokens) {
-            if (token.type == INSTRUCTION) {
-                if (!firstInstruction) json << ",\n";
-                json << "      {\n";
-                json << "        \"mnemonic\": \"" << escapeJson(token.value) << "\",\n";
-                json << "        \"operand\": \"" << escapeJson(token.operand) << "\",\n";
-                json << "        \"line\": " << token.lineNumber;
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
-                }
-                json << "\n      }";
-                firstInstruction = false;
+        for (const Token* tokenPtr : instructionTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstInstruction) json << ",\n";
+            json << "      {\n";
+            json << "        \"mnemonic\": \"" << escapeJson(token.value) << "\",\n";
+            json << "        \"operand\": \"" << escapeJson(token.operand) << "\",\n";
+            json << "        \"line\": " << token.lineNumber;
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
             }
+            json << "\n      }";
+            firstInstruction = false;
         }
         json << "\n    ],\n";
         
         // Data section
         json << "    \"data\": [\n";
         bool firstData = true;
-        for (const auto& token : tokens) {
-            if (token.type == DATA_BYTES || token.type == DATA_WORDS) {
-                if (!firstData) json << ",\n";
-                json << "      {\n";
-                json << "        \"directive\": \"" << escapeJson(token.value) << "\",\n";
-                json << "        \"type\": \"" << (token.type == DATA_BYTES ? "bytes" : "words") << "\",\n";
-                json << "        \"values\": [";
-                for (size_t i = 0; i < token.dataValues.size(); ++i) {
-                    if (i > 0) json << ", ";
-                    json << "\"" << escapeJson(token.dataValues[i]) << "\"";
-                }
-                json << "],\n";
-                json << "        \"line\": " << token.lineNumber;
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
-                }
-                json << "\n      }";
-                firstData = false;
+        for (const Token* tokenPtr : dataTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstData) json << ",\n";
+            json << "      {\n";
+            json << "        \"directive\": \"" << escapeJson(token.value) << "\",\n";
+            json << "        \"type\": \"" << (token.type == DATA_BYTES ? "bytes" : "words") << "\",\n";
+            json << "        \"values\": [";
+            for (size_t i = 0; i < token.dataValues.size(); ++i) {
+                if (i > 0) json << ", ";
+                json << "\"" << escapeJson(token.dataValues[i]) << "\"";
+            }
+            json << "],\n";
+            json << "        \"line\": " << token.lineNumber;
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
             }
+            json << "\n      }";
+            firstData = false;
         }
         json << "\n    ],\n";
         
         // Directives section
         json << "    \"directives\": [\n";
         bool firstDirective = true;
-        for (const auto& token : tokens) {
-            if (token.type == DIRECTIVE) {
-                if (!firstDirective) json << ",\n";
-                json << "      {\n";
-                json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
-                json << "        \"operand\": \"" << escapeJson(token.operand) << "\",\n";
-                json << "        \"line\": " << token.lineNumber;
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
-                }
-                json << "\n      }";
-                firstDirective = false;
+        for (const Token* tokenPtr : directiveTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstDirective) json << ",\n";
+            json << "      {\n";
+            json << "        \"name\": \"" << escapeJson(token.value) << "\",\n";
+            json << "        \"operand\": \"" << escapeJson(token.operand) << "\",\n";
+            json << "        \"line\": " << token.lineNumber;
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
             }
+            json << "\n      }";
+            firstDirective = false;
         }
         json << "\n    ],\n";
         
         // Sequential program flow
         json << "    \"program_flow\": [\n";
         bool firstFlow = true;
-        for (const auto& token : tokens) {
-            if (token.type != COMMENT) {
-                if (!firstFlow) json << ",\n";
-                json << "      {\n";
-                json << "        \"line\": " << token.lineNumber << ",\n";
-                json << "        \"type\": \"";
-                
-                switch (token.type) {
-                    case LABEL: json << "label"; break;
-                    case INSTRUCTION: json << "instruction"; break;
-                    case DATA_BYTES: 
-                    case DATA_WORDS: json << "data"; break;
-                    case DIRECTIVE: json << "directive"; break;
-                    case CONSTANT_DECL: json << "constant"; break;
-                    default: json << "unknown"; break;
-                }
-                
-                json << "\",\n";
-                json << "        \"content\": \"" << escapeJson(token.value);
-                if (!token.operand.empty()) {
-                    json << " " << escapeJson(token.operand);
-                } else if (!token.dataValues.empty()) {
-                    json << " ";
-                    for (size_t i = 0; i < token.dataValues.size(); ++i) {
-                        if (i > 0) json << ", ";
-                        json << escapeJson(token.dataValues[i]);
-                    }
-                }
-                json << "\"";
-                
-                if (!token.comment.empty()) {
-                    json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
+        for (const Token* tokenPtr : flowTokens) {
+            const Token& token = *tokenPtr;
+            if (!firstFlow) json << ",\n";
+            json << "      {\n";
+            json << "        \"line\": " << token.lineNumber << ",\n";
+            json << "        \"type\": \"";
+            
+            switch (token.type) {
+                case LABEL: json << "label"; break;
+                case INSTRUCTION: json << "instruction"; break;
+                case DATA_BYTES: 
+                case DATA_WORDS: json << "data"; break;
+                case DIRECTIVE: json << "directive"; break;
+                case CONSTANT_DECL: json << "constant"; break;
+                default: json << "unknown"; break;
+            }
+            
+            json << "\",\n";
+            json << "        \"content\": \"" << escapeJson(token.value);
+            if (!token.operand.empty()) {
+                json << " " << escapeJson(token.operand);
+            } else if (!token.dataValues.empty()) {
+                json << " ";
+                for (size_t i = 0; i < token.dataValues.size(); ++i) {
+                    if (i > 0) json << ", ";
+                    json << escapeJson(token.dataValues[i]);
                 }
-                
-                json << "\n      }";
-                firstFlow = false;
             }
+            json << "\"";
+            
+            if (!token.comment.empty()) {
+                json << ",\n        \"comment\": \"" << escapeJson(token.comment) << "\"";
+            }
+            
+            json << "\n      }";
+            firstFlow = false;
         }
         json << "\n    ]\n";
         
         json << "  }\n";
         json << "}\n";
-        
-        return json.str();
     }
 };
 
+// Times the lexer alone over one file, once with the SIMD structural
+// scanner and once with its scalar fallback, and reports lines per second.
+void benchmarkLexer(const std::string& filename, int iterations) {
+    for (bool simd : {true, false}) {
+        double bestSeconds = 0.0;
+        int lines = 0;
+        
+        for (int i = 0; i < iterations; ++i) {
+            AssemblyToJsonConverter converter;
+            converter.setSimdLexer(simd);
+            
+            auto start = std::chrono::steady_clock::now();
+            converter.parseFile(filename);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            
+            if (i == 0 || elapsed.count() < bestSeconds) {
+                bestSeconds = elapsed.count();
+            }
+            lines = converter.lineCount();
+        }
+        
+        std::cout << std::left << std::setw(8) << (simd ? StructuralScanner::simdName() : "scalar")
+                  << std::fixed << std::setprecision(0) << std::right << std::setw(14)
+                  << (bestSeconds > 0.0 ? lines / bestSeconds : 0.0) << " lines/s  ("
+                  << lines << " lines, best of " << iterations << ")" << std::endl;
+    }
+}
+
+#ifndef SMB_TOOLS_NO_MAIN  // bench.cpp includes this file for the converter
+
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input.asm> <output.json>" << std::endl;
+    if (argc >= 3 && std::string(argv[1]) == "--bench-lexer") {
+        try {
+            benchmarkLexer(argv[2], argc > 3 ? std::max(1, std::atoi(argv[3])) : 5);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    // -j N runs on N threads; 0 means one per hardware thread.
+    // --watch keeps running and reconverts whenever the input changes.
+    // --batch converts every file named by a manifest or pattern.
+    // --assemble writes machine code and a symbol map instead of tokens.
+    // --stats prints phase timings and counts to stderr; --trace writes
+    // them as Chrome trace events.
+    int threadCount = 1;
+    bool watch = false;
+    bool batch = false;
+    bool assemble = false;
+    bool printStats = false;
+    std::string traceName;
+    std::vector<std::string> arguments;
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string option = argv[argi];
+        if (option == "-j" && argi + 1 < argc) {
+            threadCount = std::atoi(argv[++argi]);
+        } else if (option == "--watch") {
+            watch = true;
+        } else if (option == "--batch") {
+            batch = true;
+        } else if (option == "--assemble") {
+            assemble = true;
+        } else if (option == "--stats") {
+            printStats = true;
+        } else if (option == "--trace" && argi + 1 < argc) {
+            traceName = argv[++argi];
+        } else {
+            arguments.push_back(option);
+        }
+    }
+    
+    bool validArguments = batch ? !watch && (arguments.size() == 1 || arguments.size() == 2)
+                                : arguments.size() == 2;
+    if (!validArguments) {
+        std::cerr << "Usage: " << argv[0] << " [-j threads] [--watch] [--stats] [--trace trace.json] "
+                  << "<input.asm> <output.json|output.6502ir>" << std::endl;
+        std::cerr << "       " << argv[0] << " [-j threads] [--watch] [--stats] [--trace trace.json] "
+                  << "--assemble <input.asm> <output.bin>" << std::endl;
+        std::cerr << "       " << argv[0] << " [-j threads] [--assemble] [--stats] [--trace trace.json] "
+                  << "--batch <manifest|pattern> [output_dir]" << std::endl;
+        std::cerr << "       " << argv[0] << " --bench-lexer <input.asm> [iterations]" << std::endl;
         return 1;
     }
     
+    auto writeOutput = [assemble](AssemblyToJsonConverter& converter, const std::string& outputName) {
+        const std::string irExtension = ".6502ir";
+        if (assemble) {
+            converter.generateBinary(outputName);
+        } else if (outputName.size() >= irExtension.size() &&
+            outputName.compare(outputName.size() - irExtension.size(), irExtension.size(), irExtension) == 0) {
+            converter.generateIr(outputName);
+        } else {
+            JsonWriter outputFile(outputName);
+            converter.generateJson(outputFile);
+            outputFile.close();
+        }
+    };
+    
+    RunStats stats;
+    RunStats* runStats = printStats || !traceName.empty() ? &stats : nullptr;
+    if (!traceName.empty()) {
+        stats.enableTrace();
+    }
+    auto reportStats = [&]() {
+        if (printStats) stats.print(std::cerr);
+        if (!traceName.empty()) stats.writeTrace(traceName);
+    };
+    
+    if (batch) {
+        try {
+            std::vector<BatchJob> jobs = loadBatchJobs(arguments[0], arguments.size() > 1 ? arguments[1] : "",
+                                                    assemble ? ".bin" : ".json");
+            WorkStealingPool pool(threadCount);
+            std::vector<AssemblyToJsonConverter> converters(static_cast<size_t>(pool.size()));
+            for (auto& converter : converters) {
+                converter.setStats(runStats);
+            }
+            int failures = runBatch(jobs, pool, [&](const BatchJob& job, int worker) {
+                AssemblyToJsonConverter& converter = converters[worker];
+                converter.reset();
+                converter.parseFile(job.input);
+                writeOutput(converter, job.output);
+            });
+            reportStats();
+            return failures == 0 ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    std::string inputName = arguments[0];
+    std::string outputName = arguments[1];
+    
     try {
         AssemblyToJsonConverter converter;
-        converter.parseFile(argv[1]);
+        converter.setThreadCount(threadCount);
+        converter.setStats(runStats);
         
-        std::string jsonOutput = converter.generateJson();
-        
-        std::ofstream outputFile(argv[2]);
-        if (!outputFile.is_open()) {
-            throw std::runtime_error("Cannot create output file: " + std::string(argv[2]));
+        if (watch) {
+            // The file is copied rather than mapped, since editors rewrite
+            // it in place while we hold on to the text
+            watchFile(inputName, [&]() {
+                MappedFile input(inputName);
+                size_t lexed = converter.updateSource(std::string(input.view()));
+                writeOutput(converter, outputName);
+                std::cout << "Relexed " << lexed << " of " << converter.lineCount() << " lines, wrote "
+                          << outputName << std::endl;
+                reportStats();
+                stats.clear();
+            });
         }
         
-        outputFile << jsonOutput;
-        outputFile.close();
+        converter.parseFile(inputName);
+        writeOutput(converter, outputName);
         
-        std::cout << "Successfully converted " << argv[1] << " to " << argv[2] << std::endl;
+        std::cout << "Successfully converted " << inputName << " to " << outputName << std::endl;
+        reportStats();
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -485,3 +1234,5 @@ int main(int argc, char* argv[]) {
     
     return 0;
 }
+
+#endif // SMB_TOOLS_NO_MAIN
@@ -0,0 +1,395 @@
+// Reference 6502 interpreter.
+//
+// Cpu6502 runs a program image instruction by instruction, decoding every
+// opcode through a table derived from isa6502::OPCODES, so it shares its
+// notion of the instruction set with the translator. It is the baseline
+// the generated engine is checked and timed against (see harness6502.hpp),
+// which makes plainness more important than speed: each instruction is
+// one table lookup, one operand fetch and one switch case.
+//
+// Memory goes through a Bus, any type with
+//
+//   uint8_t read(uint16_t address);
+//   void write(uint16_t address, uint8_t value);
+//
+// The NES's 2A03 has no decimal mode, so adc and sbc ignore the D flag.
+// Cycle counts include page-crossing and taken-branch penalties. Opcodes
+// outside the official set throw.
+//
+#ifndef CPU6502_HPP
+#define CPU6502_HPP
+
+#include <array>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "isa6502.hpp"
+
+namespace cpu6502 {
+
+struct DecodedOpcode {
+    int32_t key;    // packed mnemonic; -1 outside the official set
+    isa6502::AddressingMode mode;
+    uint8_t cycles;
+};
+
+constexpr std::array<DecodedOpcode, 256> buildDecodeTable() {
+    std::array<DecodedOpcode, 256> table{};
+    for (DecodedOpcode& entry : table) {
+        entry = DecodedOpcode{-1, isa6502::IMPLIED, 0};
+    }
+    for (const isa6502::OpcodeInfo& info : isa6502::OPCODES) {
+        table[info.opcode] = DecodedOpcode{isa6502::packMnemonic(info.mnemonic), info.mode, info.cycles};
+    }
+    return table;
+}
+
+constexpr std::array<DecodedOpcode, 256> DECODE = buildDecodeTable();
+
+static_assert(DECODE[0xA9].key == isa6502::packMnemonic("lda") && DECODE[0xA9].mode == isa6502::IMMEDIATE &&
+              DECODE[0x02].key == -1, "decode table follows OPCODES");
+
+// Bit 5 of the status register reads as set on the 6502
+constexpr uint8_t FLAG_UNUSED = 0x20;
+
+} // namespace cpu6502
+
+template <typename Bus>
+class Cpu6502 {
+public:
+    struct State {
+        uint8_t a = 0;
+        uint8_t x = 0;
+        uint8_t y = 0;
+        uint8_t s = 0xFD;
+        uint8_t p = isa6502::FLAG_I | cpu6502::FLAG_UNUSED;
+        uint16_t pc = 0;
+    };
+
+private:
+    Bus& bus;
+    State state;
+    uint8_t lastOpcode = 0;
+    uint64_t instructionCount = 0;
+    uint64_t cycleCount = 0;
+    
+    uint8_t read(uint16_t address) {
+        return bus.read(address);
+    }
+    
+    uint16_t read16(uint16_t address) {
+        return static_cast<uint16_t>(read(address) | (read(static_cast<uint16_t>(address + 1)) << 8));
+    }
+    
+    // A pointer in zero page, whose high byte wraps to $00 rather than
+    // crossing into page one
+    uint16_t readZeroPagePointer(uint8_t address) {
+        return static_cast<uint16_t>(read(address) | (read(static_cast<uint8_t>(address + 1)) << 8));
+    }
+    
+    void push(uint8_t value) {
+        bus.write(static_cast<uint16_t>(0x100 | state.s--), value);
+    }
+    
+    uint8_t pull() {
+        return read(static_cast<uint16_t>(0x100 | ++state.s));
+    }
+    
+    void setFlag(uint8_t flag, bool set) {
+        state.p = static_cast<uint8_t>(set ? state.p | flag : state.p & ~flag);
+    }
+    
+    uint8_t setNZ(uint8_t value) {
+        setFlag(isa6502::FLAG_Z, value == 0);
+        setFlag(isa6502::FLAG_N, (value & 0x80) != 0);
+        return value;
+    }
+    
+    void addWithCarry(uint8_t value) {
+        unsigned sum = state.a + value + (state.p & isa6502::FLAG_C);
+        setFlag(isa6502::FLAG_V, (~(state.a ^ value) & (state.a ^ sum) & 0x80) != 0);
+        setFlag(isa6502::FLAG_C, sum > 0xFF);
+        state.a = setNZ(static_cast<uint8_t>(sum));
+    }
+    
+    void compare(uint8_t reg, uint8_t value) {
+        setFlag(isa6502::FLAG_C, reg >= value);
+        setNZ(static_cast<uint8_t>(reg - value));
+    }
+    
+    void interrupt(uint16_t vector, uint8_t pushedFlags) {
+        push(static_cast<uint8_t>(state.pc >> 8));
+        push(static_cast<uint8_t>(state.pc));
+        push(pushedFlags);
+        setFlag(isa6502::FLAG_I, true);
+        state.pc = read16(vector);
+    }
+
+public:
+    explicit Cpu6502(Bus& memory) : bus(memory) {}
+    
+    // Power-on registers and the reset vector
+    void reset() {
+        state = State();
+        state.pc = read16(0xFFFC);
+        cycleCount += 7;
+    }
+    
+    void nmi() {
+        interrupt(0xFFFA, static_cast<uint8_t>((state.p & ~isa6502::FLAG_B) | cpu6502::FLAG_UNUSED));
+        cycleCount += 7;
+    }
+    
+    // Executes one instruction and returns the cycles it took
+    int step() {
+        using namespace isa6502;
+        uint16_t start = state.pc;
+        lastOpcode = read(state.pc++);
+        const cpu6502::DecodedOpcode& decoded = cpu6502::DECODE[lastOpcode];
+        if (decoded.key < 0) {
+            std::ostringstream message;
+            message << std::hex << std::uppercase << "Illegal opcode $" << static_cast<int>(lastOpcode)
+                    << " at $" << start;
+            throw std::runtime_error(message.str());
+        }
+        
+        // Effective address; immediates address the operand byte itself
+        uint16_t address = 0;
+        bool pageCrossed = false;
+        switch (decoded.mode) {
+            case IMPLIED:
+            case ACCUMULATOR:
+            case MODE_COUNT:
+                break;
+            case IMMEDIATE:
+                address = state.pc++;
+                break;
+            case ZERO_PAGE:
+                address = read(state.pc++);
+                break;
+            case ZERO_PAGE_X:
+                address = static_cast<uint8_t>(read(state.pc++) + state.x);
+                break;
+            case ZERO_PAGE_Y:
+                address = static_cast<uint8_t>(read(state.pc++) + state.y);
+                break;
+            case ABSOLUTE:
+                address = read16(state.pc);
+                state.pc += 2;
+                break;
+            case ABSOLUTE_X:
+            case ABSOLUTE_Y: {
+                uint16_t base = read16(state.pc);
+                state.pc += 2;
+                address = static_cast<uint16_t>(base + (decoded.mode == ABSOLUTE_X ? state.x : state.y));
+                pageCrossed = ((base ^ address) & 0xFF00) != 0;
+                break;
+            }
+            case INDIRECT: {
+                // The pointer's high byte comes from the same page, as on
+                // the real chip: jmp ($10FF) reads $10FF and $1000
+                uint16_t pointer = read16(state.pc);
+                state.pc += 2;
+                uint16_t highAddress = static_cast<uint16_t>((pointer & 0xFF00) | ((pointer + 1) & 0x00FF));
+                address = static_cast<uint16_t>(read(pointer) | (read(highAddress) << 8));
+                break;
+            }
+            case INDEXED_INDIRECT:
+                address = readZeroPagePointer(static_cast<uint8_t>(read(state.pc++) + state.x));
+                break;
+            case INDIRECT_INDEXED: {
+                uint16_t base = readZeroPagePointer(read(state.pc++));
+                address = static_cast<uint16_t>(base + state.y);
+                pageCrossed = ((base ^ address) & 0xFF00) != 0;
+                break;
+            }
+            case RELATIVE: {
+                int8_t offset = static_cast<int8_t>(read(state.pc++));
+                address = static_cast<uint16_t>(state.pc + offset);
+                break;
+            }
+        }
+        
+        int cycles = decoded.cycles;
+        auto load = [&]() {
+            cycles += pageCrossed;
+            return read(address);
+        };
+        auto branch = [&](bool taken) {
+            if (!taken) return;
+            cycles += 1 + (((state.pc ^ address) & 0xFF00) != 0);
+            state.pc = address;
+        };
+        
+        // Shifts and rotates work on the accumulator or on memory
+        auto modify = [&](auto operation) {
+            if (decoded.mode == ACCUMULATOR) {
+                state.a = setNZ(operation(state.a));
+            } else {
+                bus.write(address, setNZ(operation(read(address))));
+            }
+        };
+        
+        switch (decoded.key) {
+            case packMnemonic("lda"): state.a = setNZ(load()); break;
+            case packMnemonic("ldx"): state.x = setNZ(load()); break;
+            case packMnemonic("ldy"): state.y = setNZ(load()); break;
+            case packMnemonic("sta"): bus.write(address, state.a); break;
+            case packMnemonic("stx"): bus.write(address, state.x); break;
+            case packMnemonic("sty"): bus.write(address, state.y); break;
+            
+            case packMnemonic("tax"): state.x = setNZ(state.a); break;
+            case packMnemonic("tay"): state.y = setNZ(state.a); break;
+            case packMnemonic("txa"): state.a = setNZ(state.x); break;
+            case packMnemonic("tya"): state.a = setNZ(state.y); break;
+            case packMnemonic("tsx"): state.x = setNZ(state.s); break;
+            case packMnemonic("txs"): state.s = state.x; break;
+            
+            case packMnemonic("and"): state.a = setNZ(state.a & load()); break;
+            case packMnemonic("ora"): state.a = setNZ(state.a | load()); break;
+            case packMnemonic("eor"): state.a = setNZ(state.a ^ load()); break;
+            case packMnemonic("adc"): addWithCarry(load()); break;
+            case packMnemonic("sbc"): addWithCarry(static_cast<uint8_t>(~load())); break;
+            case packMnemonic("cmp"): compare(state.a, load()); break;
+            case packMnemonic("cpx"): compare(state.x, read(address)); break;
+            case packMnemonic("cpy"): compare(state.y, read(address)); break;
+            case packMnemonic("bit"): {
+                uint8_t value = read(address);
+                setFlag(FLAG_Z, (state.a & value) == 0);
+                setFlag(FLAG_N, (value & 0x80) != 0);
+                setFlag(FLAG_V, (value & 0x40) != 0);
+                break;
+            }
+            
+            case packMnemonic("inc"): bus.write(address, setNZ(static_cast<uint8_t>(read(address) + 1))); break;
+            case packMnemonic("dec"): bus.write(address, setNZ(static_cast<uint8_t>(read(address) - 1))); break;
+            case packMnemonic("inx"): state.x = setNZ(static_cast<uint8_t>(state.x + 1)); break;
+            case packMnemonic("iny"): state.y = setNZ(static_cast<uint8_t>(state.y + 1)); break;
+            case packMnemonic("dex"): state.x = setNZ(static_cast<uint8_t>(state.x - 1)); break;
+            case packMnemonic("dey"): state.y = setNZ(static_cast<uint8_t>(state.y - 1)); break;
+            
+            case packMnemonic("asl"):
+                modify([&](uint8_t value) {
+                    setFlag(FLAG_C, (value & 0x80) != 0);
+                    return static_cast<uint8_t>(value << 1);
+                });
+                break;
+            case packMnemonic("lsr"):
+                modify([&](uint8_t value) {
+                    setFlag(FLAG_C, (value & 0x01) != 0);
+                    return static_cast<uint8_t>(value >> 1);
+                });
+                break;
+            case packMnemonic("rol"):
+                modify([&](uint8_t value) {
+                    uint8_t carry = state.p & FLAG_C;
+                    setFlag(FLAG_C, (value & 0x80) != 0);
+                    return static_cast<uint8_t>((value << 1) | carry);
+                });
+                break;
+            case packMnemonic("ror"):
+                modify([&](uint8_t value) {
+                    uint8_t carry = state.p & FLAG_C;
+                    setFlag(FLAG_C, (value & 0x01) != 0);
+                    return static_cast<uint8_t>((value >> 1) | (carry << 7));
+                });
+                break;
+            
+            case packMnemonic("bcc"): branch(!(state.p & FLAG_C)); break;
+            case packMnemonic("bcs"): branch(state.p & FLAG_C); break;
+            case packMnemonic("bne"): branch(!(state.p & FLAG_Z)); break;
+            case packMnemonic("beq"): branch(state.p & FLAG_Z); break;
+            case packMnemonic("bpl"): branch(!(state.p & FLAG_N)); break;
+            case packMnemonic("bmi"): branch(state.p & FLAG_N); break;
+            case packMnemonic("bvc"): branch(!(state.p & FLAG_V)); break;
+            case packMnemonic("bvs"): branch(state.p & FLAG_V); break;
+            
+            case packMnemonic("jmp"): state.pc = address; break;
+            case packMnemonic("jsr"): {
+                uint16_t returnAddress = static_cast<uint16_t>(state.pc - 1);
+                push(static_cast<uint8_t>(returnAddress >> 8));
+                push(static_cast<uint8_t>(returnAddress));
+                state.pc = address;
+                break;
+            }
+            case packMnemonic("rts"): {
+                uint8_t low = pull();
+                state.pc = static_cast<uint16_t>((low | (pull() << 8)) + 1);
+                break;
+            }
+            case packMnemonic("rti"): {
+                state.p = static_cast<uint8_t>((pull() & ~FLAG_B) | cpu6502::FLAG_UNUSED);
+                uint8_t low = pull();
+                state.pc = static_cast<uint16_t>(low | (pull() << 8));
+                break;
+            }
+            case packMnemonic("brk"):
+                // The byte after brk is padding the return skips
+                state.pc++;
+                interrupt(0xFFFE, state.p | FLAG_B | cpu6502::FLAG_UNUSED);
+                break;
+            
+            case packMnemonic("pha"): push(state.a); break;
+            case packMnemonic("php"): push(state.p | FLAG_B | cpu6502::FLAG_UNUSED); break;
+            case packMnemonic("pla"): state.a = setNZ(pull()); break;
+            case packMnemonic("plp"): state.p = static_cast<uint8_t>((pull() & ~FLAG_B) | cpu6502::FLAG_UNUSED); break;
+            
+            case packMnemonic("clc"): setFlag(FLAG_C, false); break;
+            case packMnemonic("sec"): setFlag(FLAG_C, true); break;
+            case packMnemonic("cli"): setFlag(FLAG_I, false); break;
+            case packMnemonic("sei"): setFlag(FLAG_I, true); break;
+            case packMnemonic("cld"): setFlag(FLAG_D, false); break;
+            case packMnemonic("sed"): setFlag(FLAG_D, true); break;
+            case packMnemonic("clv"): setFlag(FLAG_V, false); break;
+            case packMnemonic("nop"): break;
+        }
+        
+        instructionCount++;
+        cycleCount += cycles;
+        return cycles;
+    }
+    
+    // Runs until an instruction jumps to itself, the idle loop a game
+    // sits in between interrupts. Throws if that takes more than limit
+    // instructions.
+    void runUntilIdle(uint64_t limit) {
+        for (uint64_t count = 0; count < limit; ++count) {
+            uint16_t start = state.pc;
+            step();
+            if (state.pc == start) return;
+        }
+        throw std::runtime_error("No idle loop reached within " + std::to_string(limit) + " instructions");
+    }
+    
+    // Takes an NMI and runs the handler until its rti. Throws if that
+    // takes more than limit instructions.
+    void runNmi(uint64_t limit) {
+        uint8_t entryStack = state.s;
+        nmi();
+        for (uint64_t count = 0; count < limit; ++count) {
+            step();
+            if (lastOpcode == 0x40 && state.s == entryStack) return;
+        }
+        throw std::runtime_error("NMI handler did not return within " + std::to_string(limit) + " instructions");
+    }
+    
+    const State& registers() const {
+        return state;
+    }
+    
+    State& registers() {
+        return state;
+    }
+    
+    uint64_t instructions() const {
+        return instructionCount;
+    }
+    
+    uint64_t cycles() const {
+        return cycleCount;
+    }
+};
+
+#endif // CPU6502_HPP
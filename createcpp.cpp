@@ -5,7 +5,22 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <cstdlib>
 #include <regex>
+#include <string_view>
+#include <unordered_map>
+#include <iterator>
+
+#include "batch.hpp"
+#include "cfg6502.hpp"
+#include "expr6502.hpp"
+#include "intern.hpp"
+#include "ir6502.hpp"
+#include "isa6502.hpp"
+#include "jsonreader.hpp"
+#include "mappedfile.hpp"
+#include "stats.hpp"
+#include "watch.hpp"
 
 // Directory creation
 #ifdef _WIN32
@@ -15,48 +30,90 @@
     #include <sys/types.h>
 #endif
 
+// String fields are interned views owned by the converter's StringInterner
 struct JsonInstruction {
-    std::string mnemonic;
-    std::string operand;
-    std::string comment;
+    std::string_view mnemonic;
+    std::string_view operand;
+    std::string_view comment;
     int lineNumber;
 };
 
 struct JsonData {
-    std::string directive;
-    std::string type;
-    std::vector<std::string> values;
-    std::string comment;
+    std::string_view directive;
+    std::string_view type;
+    StringList values;
+    std::string_view comment;
     int lineNumber;
 };
 
 struct JsonLabel {
-    std::string name;
-    std::string comment;
+    std::string_view name;
+    std::string_view comment;
     int lineNumber;
 };
 
 struct JsonConstant {
-    std::string name;
-    std::string value;
-    std::string comment;
+    std::string_view name;
+    std::string_view value;
+    std::string_view comment;
     int lineNumber;
 };
 
 struct JsonDirective {
-    std::string name;
-    std::string operand;
-    std::string comment;
+    std::string_view name;
+    std::string_view operand;
+    std::string_view comment;
     int lineNumber;
 };
 
 struct ProgramFlowItem {
-    std::string type;
-    std::string content;
-    std::string comment;
+    std::string_view type;
+    std::string_view content;
+    std::string_view comment;
     int lineNumber;
 };
 
+// How generated code keeps the N, Z, C and V flags
+enum FlagMode {
+    // Registers and M() are SMBEngine's proxies, which update N and Z on
+    // every write, and the flag helpers compute all their flags
+    FLAGS_RUNTIME,
+    // Registers are the plain bytes registerA/X/Y/S, memory goes through
+    // ram[], readData() and writeData(), and each instruction sets only
+    // the flags a later branch, php, call or return can observe. The
+    // engine's pha(), pla(), php() and plp() work on the same bytes and
+    // the bools c, z, n and v.
+    FLAGS_EXPLICIT,
+    // Registers as for FLAGS_EXPLICIT, but instructions only store their
+    // result in uint16_t nzc and branches decode it when they test a flag:
+    // bits 0-7 are the last result (Z when zero, N from bit 7), bit 8 is
+    // the carry and bit 9 forces N, as bit needs. v stays a bool. pla()
+    // and plp() must leave nzc in the same form.
+    FLAGS_LAZY
+};
+
+// Choices about the code createcpp emits
+struct CodegenOptions {
+    // Loads and stores whose operand folds to an address in the 2 KiB of
+    // internal RAM or its mirrors index SMBEngine::ram directly instead of
+    // going through M() and writeData(). Read-modify-write instructions
+    // keep M(), whose proxy updates the flags.
+    bool directRamAccess = true;
+    
+    FlagMode flagMode = FLAGS_RUNTIME;
+    
+    // Emit well-formed subroutines as SMBEngine member functions
+    bool subroutineFunctions = false;
+    
+    // Under GCC and Clang, keep label addresses on the return stack so
+    // rts is one indirect goto instead of the Return switch
+    bool threadedReturns = false;
+    
+    // Lay the data tables out in one constexpr ROM image instead of
+    // copying them into memory in loadConstantData()
+    bool romImage = false;
+};
+
 class JsonToCppConverter {
 private:
     std::vector<JsonConstant> constants;
@@ -65,432 +122,1391 @@ private:
     std::vector<JsonData> data;
     std::vector<JsonDirective> directives;
     std::vector<ProgramFlowItem> programFlow;
-    std::map<int, std::string> commentMap;
+    std::map<int, std::string_view> commentMap;
+    StringInterner strings;
+    
+    // Lookup indexes built once after parsing, so code generation never
+    // scans the section vectors
+    std::vector<int> instructionIndexByLine;
+    std::vector<int> dataIndexByLine;
+    std::unordered_map<std::string_view, size_t> labelIndexByName;
+    
+    CodegenOptions options;
+    ConstantEvaluator evaluator;
+    
+    // Label addresses from the symbol map of convert --assemble, kept
+    // across reset(); empty to pack the data tables from DATA_STORAGE_BASE
+    std::unordered_map<std::string, int> symbolAddresses;
+    
+    // Internal RAM is mirrored every RAM_SIZE bytes below RAM_MIRROR_END
+    static constexpr int32_t RAM_SIZE = 0x800;
+    static constexpr int32_t RAM_MIRROR_END = 0x2000;
+    
+    enum OperandAccess {
+        READ_OPERAND,
+        MODIFY_OPERAND
+    };
+    
+    // Flags still needed after each instruction, by index into
+    // instructions; filled by analyzeFlagLiveness for FLAGS_EXPLICIT
+    std::vector<uint8_t> liveFlagsAfter;
+    
+    // An operand as explicit-mode code reads and writes it
+    struct MemoryOperand {
+        bool immediate = false;
+        bool direct = false;        // value is an lvalue: ram[...] or a register
+        std::string value;          // expression reading the operand
+        std::string address;        // for writeData() when not direct
+    };
+    MemoryOperand operandScratch;
     
     int returnLabelIndex = 0;
     
-    std::string unescapeJson(const std::string& str) {
-        std::string unescaped;
-        for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '\\' && i + 1 < str.length()) {
-                switch (str[i + 1]) {
-                    case '"': unescaped += '"'; i++; break;
-                    case '\\': unescaped += '\\'; i++; break;
-                    case 'n': unescaped += '\n'; i++; break;
-                    case 'r': unescaped += '\r'; i++; break;
-                    case 't': unescaped += '\t'; i++; break;
-                    default: unescaped += str[i]; break;
-                }
+    // SMB.cpp is generated one label block at a time: a label and the
+    // items up to the next one
+    struct LabelBlock {
+        std::string_view name;      // without the colon
+        std::string_view labelName; // as in the program flow
+        std::vector<const ProgramFlowItem*> items;
+    };
+    std::vector<LabelBlock> labelBlocks;
+    
+    // Basic blocks of the program flow, rebuilt for every generation
+    ControlFlowGraph cfg;
+    
+    // Subroutines emitted as functions, filled by findSubroutines: the
+    // function each label block belongs to (-1 for code()), and the entry
+    // block of each function
+    std::vector<int> blockFunction;
+    std::vector<size_t> functionEntries;
+    std::unordered_map<std::string_view, int> functionByEntry;
+    bool inFunction = false;        // rendering a block of a function
+    
+    // The .dw table after each jsr JumpEngine, by the jsr's line. A table
+    // is resolved when every entry names a label, so it can become a jump.
+    struct JumpTable {
+        std::vector<std::string_view> targets;
+        std::vector<int> lines;     // the .dw lines, which are not data tables
+        bool resolved = false;
+    };
+    std::unordered_map<int, JumpTable> jumpTableByLine;
+    
+    // Reused for every generated line
+    std::string lineBuffer;
+    
+    // Rendered SMB.cpp label blocks keyed by a hash of everything they are
+    // rendered from, kept across runs in watch mode. Return indices are
+    // left as RETURN_INDEX_MARKER and numbered when the block is emitted.
+    static constexpr char RETURN_INDEX_MARKER = '\x01';
+    std::unordered_map<uint64_t, std::string> blockCache;
+    size_t blocksRendered = 0;
+    size_t blocksTotal = 0;
+    uint64_t blockHashSeed = 0;     // constants and options every block depends on
+    
+    RunStats* stats = nullptr;
+    
+    // Generated files as (name, content), written once codegen is done
+    using OutputFiles = std::vector<std::pair<std::string, std::string>>;
+    
+    enum Section {
+        SECTION_NONE,
+        SECTION_CONSTANTS,
+        SECTION_LABELS,
+        SECTION_INSTRUCTIONS,
+        SECTION_DATA,
+        SECTION_DIRECTIVES,
+        SECTION_PROGRAM_FLOW
+    };
+    
+    // Receives records from JsonReader and fills the section vectors in place
+    struct SectionLoader {
+        JsonToCppConverter& owner;
+        Section section = SECTION_NONE;
+        std::vector<std::string_view> values;
+        
+        explicit SectionLoader(JsonToCppConverter& converter) : owner(converter) {}
+        
+        void beginRecord(std::string_view name) {
+            if (name == "constants") {
+                section = SECTION_CONSTANTS;
+                owner.constants.emplace_back();
+                owner.constants.back().lineNumber = -1;
+            } else if (name == "labels") {
+                section = SECTION_LABELS;
+                owner.labels.emplace_back();
+                owner.labels.back().lineNumber = -1;
+            } else if (name == "instructions") {
+                section = SECTION_INSTRUCTIONS;
+                owner.instructions.emplace_back();
+                owner.instructions.back().lineNumber = -1;
+            } else if (name == "data") {
+                section = SECTION_DATA;
+                owner.data.emplace_back();
+                owner.data.back().lineNumber = -1;
+            } else if (name == "directives") {
+                section = SECTION_DIRECTIVES;
+                owner.directives.emplace_back();
+                owner.directives.back().lineNumber = -1;
+            } else if (name == "program_flow") {
+                section = SECTION_PROGRAM_FLOW;
+                owner.programFlow.emplace_back();
+                owner.programFlow.back().lineNumber = -1;
             } else {
-                unescaped += str[i];
+                section = SECTION_NONE;
             }
         }
-        return unescaped;
-    }
-    
-    std::string extractStringValue(const std::string& json, const std::string& key) {
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return "";
         
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return "";
+        void stringField(std::string_view key, std::string_view text) {
+            std::string_view value = owner.strings.intern(text);
+            switch (section) {
+                case SECTION_CONSTANTS: {
+                    JsonConstant& constant = owner.constants.back();
+                    if (key == "name") constant.name = value;
+                    else if (key == "value") constant.value = value;
+                    else if (key == "comment") constant.comment = value;
+                    break;
+                }
+                case SECTION_LABELS: {
+                    JsonLabel& label = owner.labels.back();
+                    if (key == "name") label.name = value;
+                    else if (key == "comment") label.comment = value;
+                    break;
+                }
+                case SECTION_INSTRUCTIONS: {
+                    JsonInstruction& instruction = owner.instructions.back();
+                    if (key == "mnemonic") instruction.mnemonic = value;
+                    else if (key == "operand") instruction.operand = value;
+                    else if (key == "comment") instruction.comment = value;
+                    break;
+                }
+                case SECTION_DATA: {
+                    JsonData& dataItem = owner.data.back();
+                    if (key == "directive") dataItem.directive = value;
+                    else if (key == "type") dataItem.type = value;
+                    else if (key == "comment") dataItem.comment = value;
+                    break;
+                }
+                case SECTION_DIRECTIVES: {
+                    JsonDirective& directive = owner.directives.back();
+                    if (key == "name") directive.name = value;
+                    else if (key == "operand") directive.operand = value;
+                    else if (key == "comment") directive.comment = value;
+                    break;
+                }
+                case SECTION_PROGRAM_FLOW: {
+                    ProgramFlowItem& item = owner.programFlow.back();
+                    if (key == "type") item.type = value;
+                    else if (key == "content") item.content = value;
+                    else if (key == "comment") item.comment = value;
+                    break;
+                }
+                case SECTION_NONE:
+                    break;
+            }
+        }
         
-        size_t startQuote = json.find("\"", colonPos);
-        if (startQuote == std::string::npos) return "";
+        void numberField(std::string_view key, long long value) {
+            if (key != "line") return;
+            int line = static_cast<int>(value);
+            switch (section) {
+                case SECTION_CONSTANTS: owner.constants.back().lineNumber = line; break;
+                case SECTION_LABELS: owner.labels.back().lineNumber = line; break;
+                case SECTION_INSTRUCTIONS: owner.instructions.back().lineNumber = line; break;
+                case SECTION_DATA: owner.data.back().lineNumber = line; break;
+                case SECTION_DIRECTIVES: owner.directives.back().lineNumber = line; break;
+                case SECTION_PROGRAM_FLOW: owner.programFlow.back().lineNumber = line; break;
+                case SECTION_NONE: break;
+            }
+        }
         
-        size_t endQuote = startQuote + 1;
-        while (endQuote < json.length()) {
-            if (json[endQuote] == '"' && (endQuote == 0 || json[endQuote - 1] != '\\')) {
-                break;
+        void arrayString(std::string_view key, std::string_view value) {
+            if (section == SECTION_DATA && key == "values") {
+                values.push_back(owner.strings.intern(value));
             }
-            endQuote++;
         }
         
-        if (endQuote >= json.length()) return "";
-        return unescapeJson(json.substr(startQuote + 1, endQuote - startQuote - 1));
-    }
+        void endRecord() {
+            if (section == SECTION_DATA) {
+                owner.data.back().values = owner.strings.internList(values);
+                values.clear();
+            }
+            section = SECTION_NONE;
+        }
+    };
     
-    int extractIntValue(const std::string& json, const std::string& key) {
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return -1;
+    void buildIndexes() {
+        // Line numbers are dense, so a flat vector beats a hash map here
+        int maxLine = 0;
+        for (const auto& instruction : instructions) {
+            maxLine = std::max(maxLine, instruction.lineNumber);
+        }
         
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return -1;
+        instructionIndexByLine.assign(static_cast<size_t>(maxLine) + 1, -1);
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            int line = instructions[i].lineNumber;
+            if (line >= 0 && instructionIndexByLine[line] < 0) {
+                instructionIndexByLine[line] = static_cast<int>(i);
+            }
+        }
         
-        size_t numStart = colonPos + 1;
-        while (numStart < json.length() && (json[numStart] == ' ' || json[numStart] == '\t')) {
-            numStart++;
+        maxLine = 0;
+        for (const auto& record : data) {
+            maxLine = std::max(maxLine, record.lineNumber);
+        }
+        dataIndexByLine.assign(static_cast<size_t>(maxLine) + 1, -1);
+        for (size_t i = 0; i < data.size(); ++i) {
+            int line = data[i].lineNumber;
+            if (line >= 0 && dataIndexByLine[line] < 0) {
+                dataIndexByLine[line] = static_cast<int>(i);
+            }
         }
         
-        size_t numEnd = numStart;
-        while (numEnd < json.length() && (std::isdigit(json[numEnd]) || json[numEnd] == '-')) {
-            numEnd++;
+        labelIndexByName.clear();
+        labelIndexByName.reserve(labels.size());
+        for (size_t i = 0; i < labels.size(); ++i) {
+            labelIndexByName.emplace(labels[i].name, i);
         }
         
-        if (numEnd > numStart) {
-            return std::stoi(json.substr(numStart, numEnd - numStart));
+        evaluator.clear();
+        for (const auto& constant : constants) {
+            evaluator.define(constant.name, constant.value);
         }
-        return -1;
+        
+        findJumpTables();
     }
     
-    std::vector<std::string> extractArrayValues(const std::string& json, const std::string& key) {
-        std::vector<std::string> values;
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return values;
-        
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return values;
-        
-        size_t arrayStart = json.find("[", colonPos);
-        if (arrayStart == std::string::npos) return values;
-        
-        size_t arrayEnd = json.find("]", arrayStart);
-        if (arrayEnd == std::string::npos) return values;
-        
-        std::string arrayContent = json.substr(arrayStart + 1, arrayEnd - arrayStart - 1);
-        
-        size_t pos = 0;
-        while (pos < arrayContent.length()) {
-            while (pos < arrayContent.length() && (arrayContent[pos] == ' ' || 
-                   arrayContent[pos] == '\t' || arrayContent[pos] == ',' || 
-                   arrayContent[pos] == '\n' || arrayContent[pos] == '\r')) {
-                pos++;
-            }
-            
-            if (pos >= arrayContent.length()) break;
-            
-            if (arrayContent[pos] == '"') {
-                size_t startQuote = pos;
-                size_t endQuote = startQuote + 1;
-                while (endQuote < arrayContent.length()) {
-                    if (arrayContent[endQuote] == '"' && (endQuote == 0 || arrayContent[endQuote - 1] != '\\')) {
-                        break;
-                    }
-                    endQuote++;
-                }
-                
-                if (endQuote < arrayContent.length()) {
-                    values.push_back(unescapeJson(arrayContent.substr(startQuote + 1, endQuote - startQuote - 1)));
-                    pos = endQuote + 1;
+    // Collects the .dw and .word lines that directly follow each
+    // jsr JumpEngine, which reads its jump table from the return address
+    void findJumpTables() {
+        jumpTableByLine.clear();
+        JumpTable* table = nullptr;
+        for (const auto& item : programFlow) {
+            if (item.type == "instruction") {
+                const JsonInstruction* inst = findInstruction(item.lineNumber);
+                table = inst && inst->mnemonic == "jsr" && inst->operand == "JumpEngine"
+                      ? &jumpTableByLine[inst->lineNumber] : nullptr;
+            } else if (table && item.type == "data") {
+                const JsonData* record = findData(item.lineNumber);
+                if (record && (record->directive == ".dw" || record->directive == ".word")) {
+                    table->targets.insert(table->targets.end(), record->values.begin(), record->values.end());
+                    table->lines.push_back(record->lineNumber);
                 } else {
-                    break;
+                    table = nullptr;
                 }
             } else {
-                size_t valueStart = pos;
-                while (pos < arrayContent.length() && arrayContent[pos] != ',' && 
-                       arrayContent[pos] != ']' && arrayContent[pos] != '\n') {
-                    pos++;
-                }
-                std::string value = arrayContent.substr(valueStart, pos - valueStart);
-                value = std::regex_replace(value, std::regex("^\\s+|\\s+$"), "");
-                if (!value.empty()) {
-                    values.push_back(value);
-                }
+                table = nullptr;
             }
         }
         
-        return values;
+        size_t resolved = 0;
+        for (auto& entry : jumpTableByLine) {
+            JumpTable& jumpTable = entry.second;
+            jumpTable.resolved = !jumpTable.targets.empty() &&
+                std::all_of(jumpTable.targets.begin(), jumpTable.targets.end(), [&](std::string_view target) {
+                    return findLabel(target) != nullptr;
+                });
+            resolved += jumpTable.resolved;
+        }
+        if (stats) {
+            stats->addCount("Jump tables", "jsr JumpEngine", jumpTableByLine.size());
+            stats->addCount("Jump tables", "resolved", resolved);
+        }
     }
     
-    void parseJsonSection(const std::string& json, const std::string& sectionName) {
-        std::string searchPattern = "\"" + sectionName + "\"";
-        size_t sectionStart = json.find(searchPattern);
-        if (sectionStart == std::string::npos) return;
+    const JsonData* findData(int lineNumber) const {
+        if (lineNumber < 0 || static_cast<size_t>(lineNumber) >= dataIndexByLine.size()) {
+            return nullptr;
+        }
+        int index = dataIndexByLine[lineNumber];
+        return index < 0 ? nullptr : &data[index];
+    }
+    
+    const JsonInstruction* findInstruction(int lineNumber) const {
+        if (lineNumber < 0 || static_cast<size_t>(lineNumber) >= instructionIndexByLine.size()) {
+            return nullptr;
+        }
+        int index = instructionIndexByLine[lineNumber];
+        return index < 0 ? nullptr : &instructions[index];
+    }
+    
+    const JsonLabel* findLabel(std::string_view name) const {
+        auto it = labelIndexByName.find(name);
+        return it == labelIndexByName.end() ? nullptr : &labels[it->second];
+    }
+    
+    static std::string_view trimWhitespace(std::string_view text) {
+        const char* whitespace = " \t\n\v\f\r";
+        size_t first = text.find_first_not_of(whitespace);
+        if (first == std::string_view::npos) return std::string_view();
+        size_t last = text.find_last_not_of(whitespace);
+        return text.substr(first, last - first + 1);
+    }
+    
+    // Based on translator.cpp translateExpression patterns. The translate
+    // functions append to out, so a whole line is built in one buffer.
+    void translateExpression(std::string_view expr, std::string& out) {
+        if (expr.empty()) return;
         
-        size_t arrayStart = json.find("[", sectionStart);
-        if (arrayStart == std::string::npos) return;
+        // Handle hex constants: $FF -> 0xFF
+        if (expr[0] == '$') {
+            out += "0x";
+            out += expr.substr(1);
+            return;
+        }
         
-        int bracketCount = 0;
-        size_t pos = arrayStart;
+        // Handle binary constants: %11001100 -> BOOST_BINARY(11001100)
+        if (expr[0] == '%') {
+            out += "BOOST_BINARY(";
+            out += expr.substr(1);
+            out += ')';
+            return;
+        }
         
-        while (pos < json.length()) {
-            if (json[pos] == '[') bracketCount++;
-            else if (json[pos] == ']') bracketCount--;
-            if (bracketCount == 0) break;
-            pos++;
+        // Handle decimal constants and names as-is
+        out += expr;
+    }
+    
+    // Folds operand to an address in internal RAM or its mirrors
+    bool resolveRamAddress(std::string_view operand, int32_t& address) {
+        return options.directRamAccess && evaluator.evaluate(operand, address) &&
+               address >= 0 && address < RAM_MIRROR_END;
+    }
+    
+    // Appends ram[...] for a resolved address, keeping the operand's
+    // constant name when it is not a mirror
+    void appendRamAccess(std::string_view operand, int32_t address, std::string& out) {
+        out += "ram[";
+        if (address < RAM_SIZE) {
+            translateExpression(operand, out);
+        } else {
+            static const char digits[] = "0123456789ABCDEF";
+            int32_t offset = address % RAM_SIZE;
+            out += "0x";
+            out += digits[(offset >> 8) & 0xF];
+            out += digits[(offset >> 4) & 0xF];
+            out += digits[offset & 0xF];
         }
+        out += ']';
+    }
+    
+    // Based on translator.cpp translateOperand patterns
+    void translateOperand(std::string_view operand, std::string& out, OperandAccess access = READ_OPERAND) {
+        if (operand.empty()) return;
         
-        if (pos >= json.length()) return;
+        // Handle immediate addressing: #value -> value
+        if (operand[0] == '#') {
+            translateExpression(operand.substr(1), out);
+            return;
+        }
         
-        std::string arrayContent = json.substr(arrayStart + 1, pos - arrayStart - 1);
+        // Handle indirect addressing: (value) -> M(value)
+        if (operand.front() == '(' && operand.back() == ')') {
+            out += "M(";
+            translateExpression(operand.substr(1, operand.length() - 2), out);
+            out += ')';
+            return;
+        }
         
-        size_t objStart = 0;
-        while (objStart < arrayContent.length()) {
-            size_t objBegin = arrayContent.find("{", objStart);
-            if (objBegin == std::string::npos) break;
+        // Handle indexed addressing: value,x -> value + x
+        size_t commaPos = operand.find(',');
+        if (commaPos != std::string_view::npos) {
+            std::string_view base = trimWhitespace(operand.substr(0, commaPos));
+            std::string_view index = trimWhitespace(operand.substr(commaPos + 1));
             
-            int braceCount = 0;
-            size_t objEnd = objBegin;
+            // Special case for (value),y -> W(value) + y
+            if (!base.empty() && base.front() == '(' && base.back() == ')' && index == "y") {
+                out += "W(";
+                translateExpression(base.substr(1, base.length() - 2), out);
+                out += ") + y";
+                return;
+            }
+            
+            translateExpression(base, out);
+            out += " + ";
+            out += index;
+            return;
+        }
+        
+        // Plain reads of internal RAM index it directly
+        int32_t address;
+        if (access == READ_OPERAND && resolveRamAddress(operand, address)) {
+            appendRamAccess(operand, address, out);
+            return;
+        }
+        
+        // Everything else needs memory access: value -> M(value)
+        out += "M(";
+        translateExpression(operand, out);
+        out += ')';
+    }
+    
+    // Appends prefix, the translated operand and suffix
+    void translateOperand(const char* prefix, std::string_view operand, const char* suffix, std::string& out,
+                          OperandAccess access = READ_OPERAND) {
+        out += prefix;
+        translateOperand(operand, out, access);
+        out += suffix;
+    }
+    
+    // Based on translator.cpp translateBranch pattern
+    void translateBranch(const char* condition, std::string_view destination, std::string& out) {
+        out += "if (";
+        out += condition;
+        out += ")\n        goto ";
+        out += destination;
+        out += ';';
+    }
+    
+    // JumpEngine jumps to entry A of the table after the jsr, and that
+    // routine's rts returns to the caller of the dispatching one, so the
+    // dispatch is a plain indexed goto: a labels-as-values table where GCC
+    // and Clang allow it, otherwise a dense switch
+    void translateJumpEngine(int lineNumber, std::string& out) {
+        auto table = jumpTableByLine.find(lineNumber);
+        if (table == jumpTableByLine.end() || !table->second.resolved) {
+            out += "/* JSR JumpEngine - jump table not resolved */";
+            return;
+        }
+        
+        const char* index = options.flagMode == FLAGS_RUNTIME ? "a" : "registerA";
+        const std::vector<std::string_view>& targets = table->second.targets;
+        out += "#if defined(__GNUC__)\n    { static void* const jumpTable[] = {";
+        for (size_t i = 0; i < targets.size(); ++i) {
+            out += i == 0 ? "&&" : ", &&";
+            out += targets[i];
+        }
+        out += "}; goto *jumpTable[";
+        out += index;
+        out += "]; }\n    #else\n    switch (";
+        out += index;
+        out += ") {";
+        for (size_t i = 0; i < targets.size(); ++i) {
+            out += " case ";
+            out += std::to_string(i);
+            out += ": goto ";
+            out += targets[i];
+            out += ';';
+        }
+        out += " }\n    #endif";
+    }
+    
+    // Based on translator.cpp translateInstruction patterns. Mnemonics are
+    // dispatched on their packed isa6502 key rather than by string compare.
+    void translateInstruction(const JsonInstruction& inst, std::string& out) {
+        using isa6502::packMnemonic;
+        std::string_view operand = inst.operand;
+        
+        switch (packMnemonic(inst.mnemonic)) {
+            // Load instructions
+            case packMnemonic("lda"): translateOperand("a = ", operand, ";", out); return;
+            case packMnemonic("ldx"): translateOperand("x = ", operand, ";", out); return;
+            case packMnemonic("ldy"): translateOperand("y = ", operand, ";", out); return;
             
-            while (objEnd < arrayContent.length()) {
-                if (arrayContent[objEnd] == '{') braceCount++;
-                else if (arrayContent[objEnd] == '}') braceCount--;
-                if (braceCount == 0) break;
-                objEnd++;
+            // Store instructions
+            case packMnemonic("sta"):
+            case packMnemonic("stx"):
+            case packMnemonic("sty"): {
+                int32_t address;
+                if (resolveRamAddress(operand, address)) {
+                    appendRamAccess(operand, address, out);
+                    out += " = ";
+                    out += inst.mnemonic.back();
+                    out += ';';
+                    return;
+                }
+                out += "writeData(";
+                translateExpression(operand, out);
+                out += ", ";
+                out += inst.mnemonic.back();
+                out += ");";
+                return;
             }
             
-            if (objEnd >= arrayContent.length()) break;
+            // Transfer instructions
+            case packMnemonic("tax"): out += "x = a;"; return;
+            case packMnemonic("tay"): out += "y = a;"; return;
+            case packMnemonic("txa"): out += "a = x;"; return;
+            case packMnemonic("tya"): out += "a = y;"; return;
+            case packMnemonic("tsx"): out += "x = s;"; return;
+            case packMnemonic("txs"): out += "s = x;"; return;
+            
+            // Stack instructions
+            case packMnemonic("pha"): out += "pha();"; return;
+            case packMnemonic("php"): out += "php();"; return;
+            case packMnemonic("pla"): out += "pla();"; return;
+            case packMnemonic("plp"): out += "plp();"; return;
+            
+            // Logical instructions
+            case packMnemonic("and"): translateOperand("a &= ", operand, ";", out); return;
+            case packMnemonic("eor"): translateOperand("a ^= ", operand, ";", out); return;
+            case packMnemonic("ora"): translateOperand("a |= ", operand, ";", out); return;
+            case packMnemonic("bit"): translateOperand("bit(", operand, ");", out); return;
+            
+            // Arithmetic instructions
+            case packMnemonic("adc"): translateOperand("a += ", operand, ";", out); return;
+            case packMnemonic("sbc"): translateOperand("a -= ", operand, ";", out); return;
+            
+            // Compare instructions
+            case packMnemonic("cmp"): translateOperand("compare(a, ", operand, ");", out); return;
+            case packMnemonic("cpx"): translateOperand("compare(x, ", operand, ");", out); return;
+            case packMnemonic("cpy"): translateOperand("compare(y, ", operand, ");", out); return;
+            
+            // Increment/Decrement
+            case packMnemonic("inc"): translateOperand("++", operand, ";", out, MODIFY_OPERAND); return;
+            case packMnemonic("inx"): out += "++x;"; return;
+            case packMnemonic("iny"): out += "++y;"; return;
+            case packMnemonic("dec"): translateOperand("--", operand, ";", out, MODIFY_OPERAND); return;
+            case packMnemonic("dex"): out += "--x;"; return;
+            case packMnemonic("dey"): out += "--y;"; return;
+            
+            // Shift instructions
+            case packMnemonic("asl"):
+                if (operand.empty()) out += "a <<= 1;";
+                else translateOperand("", operand, " <<= 1;", out, MODIFY_OPERAND);
+                return;
+            case packMnemonic("lsr"):
+                if (operand.empty()) out += "a >>= 1;";
+                else translateOperand("", operand, " >>= 1;", out, MODIFY_OPERAND);
+                return;
+            case packMnemonic("rol"):
+                if (operand.empty()) out += "a.rol();";
+                else translateOperand("", operand, ".rol();", out, MODIFY_OPERAND);
+                return;
+            case packMnemonic("ror"):
+                if (operand.empty()) out += "a.ror();";
+                else translateOperand("", operand, ".ror();", out, MODIFY_OPERAND);
+                return;
+            
+            // Jump instructions
+            case packMnemonic("jmp"):
+                if (operand == "EndlessLoop") {
+                    out += "return;";
+                } else {
+                    out += "goto ";
+                    out += operand;
+                    out += ';';
+                }
+                return;
+            
+            case packMnemonic("jsr"):
+                if (operand == "JumpEngine") {
+                    translateJumpEngine(inst.lineNumber, out);
+                } else if (functionByEntry.count(operand)) {
+                    out += "sub_";
+                    out += operand;
+                    out += "();";
+                } else {
+                    out += options.threadedReturns ? "SMB_JSR(" : "JSR(";
+                    out += operand;
+                    out += ", ";
+                    out += RETURN_INDEX_MARKER;
+                    out += ");";
+                }
+                return;
+            
+            case packMnemonic("rts"):
+                out += inFunction ? "return;" : options.threadedReturns ? "SMB_RTS();" : "goto Return;";
+                return;
+            
+            // Branch instructions
+            case packMnemonic("bcc"): translateBranch("!c", operand, out); return;
+            case packMnemonic("bcs"): translateBranch("c", operand, out); return;
+            case packMnemonic("beq"): translateBranch("z", operand, out); return;
+            case packMnemonic("bmi"): translateBranch("n", operand, out); return;
+            case packMnemonic("bne"): translateBranch("!z", operand, out); return;
+            case packMnemonic("bpl"): translateBranch("!n", operand, out); return;
+            case packMnemonic("bvc"): translateBranch("!v", operand, out); return;
+            case packMnemonic("bvs"): translateBranch("v", operand, out); return;
             
-            std::string objContent = arrayContent.substr(objBegin, objEnd - objBegin + 1);
-            parseJsonObject(objContent, sectionName);
+            // Flag instructions
+            case packMnemonic("clc"): out += "c = 0;"; return;
+            case packMnemonic("cld"): out += "/* cld */"; return;
+            case packMnemonic("cli"): out += "/* cli */"; return;
+            case packMnemonic("clv"): out += "/* clv */"; return;
+            case packMnemonic("sec"): out += "c = 1;"; return;
+            case packMnemonic("sed"): out += "/* sed */"; return;
+            case packMnemonic("sei"): out += "/* sei */"; return;
             
-            objStart = objEnd + 1;
+            // Misc instructions
+            case packMnemonic("brk"): out += "/* brk */"; return;
+            case packMnemonic("nop"): out += "; // nop"; return;
+            case packMnemonic("rti"): out += "return;"; return;
+            
+            default: break;
         }
+        
+        out += "/* Unknown instruction: ";
+        out += inst.mnemonic;
+        out += " */";
     }
     
-    void parseJsonObject(const std::string& objJson, const std::string& sectionName) {
-        if (sectionName == "constants") {
-            JsonConstant constant;
-            constant.name = extractStringValue(objJson, "name");
-            constant.value = extractStringValue(objJson, "value");
-            constant.comment = extractStringValue(objJson, "comment");
-            constant.lineNumber = extractIntValue(objJson, "line");
-            constants.push_back(constant);
+    // Feeds the program flow to the control-flow graph. A resolved
+    // jsr JumpEngine continues at the labels in its table.
+    void buildControlFlowGraph() {
+        cfg.clear();
+        for (const auto& item : programFlow) {
+            if (item.type == "label") {
+                std::string_view name = item.content;
+                if (!name.empty() && name.back() == ':') name.remove_suffix(1);
+                cfg.label(name);
+            } else if (item.type == "instruction") {
+                const JsonInstruction* inst = findInstruction(item.lineNumber);
+                if (!inst) continue;
+                auto table = jumpTableByLine.find(inst->lineNumber);
+                if (table != jumpTableByLine.end() && table->second.resolved) {
+                    cfg.jumpTable(inst->mnemonic, inst->operand, table->second.targets, inst->lineNumber);
+                } else {
+                    cfg.instruction(inst->mnemonic, inst->operand, inst->lineNumber);
+                }
+            } else if (item.type == "data" || item.type == "directive") {
+                cfg.data(item.content, item.lineNumber);
+            }
         }
-        else if (sectionName == "labels") {
-            JsonLabel label;
-            label.name = extractStringValue(objJson, "name");
-            label.comment = extractStringValue(objJson, "comment");
-            label.lineNumber = extractIntValue(objJson, "line");
-            labels.push_back(label);
+        cfg.build();
+        
+        if (stats) {
+            size_t edges = 0;
+            for (const auto& block : cfg.basicBlocks()) {
+                edges += block.successors.size();
+            }
+            stats->addCount("Control flow", "basic blocks", cfg.basicBlocks().size());
+            stats->addCount("Control flow", "edges", edges);
         }
-        else if (sectionName == "instructions") {
-            JsonInstruction instruction;
-            instruction.mnemonic = extractStringValue(objJson, "mnemonic");
-            instruction.operand = extractStringValue(objJson, "operand");
-            instruction.comment = extractStringValue(objJson, "comment");
-            instruction.lineNumber = extractIntValue(objJson, "line");
-            instructions.push_back(instruction);
+    }
+    
+    // Backward dataflow over the basic blocks, giving the flags each
+    // instruction's results must still provide. Whatever the graph cannot
+    // follow -- calls, returns, data, jumps through pointers or to unknown
+    // names -- needs all of N, Z, C, V.
+    void analyzeFlagLiveness() {
+        using namespace isa6502;
+        const auto& blocks = cfg.basicBlocks();
+        const auto& statements = cfg.statementList();
+        
+        std::vector<uint8_t> reads(statements.size(), FLAGS_NZCV);
+        std::vector<uint8_t> writes(statements.size(), 0);
+        for (size_t i = 0; i < statements.size(); ++i) {
+            const ControlFlowGraph::Statement& statement = statements[i];
+            if (statement.kind != ControlFlowGraph::STATEMENT_INSTRUCTION) continue;
+            int index = mnemonicIndex(statement.mnemonic);
+            if (index < 0) continue;
+            writes[i] = instruction(index).flagsWritten & FLAGS_NZCV;
+            switch (packMnemonic(statement.mnemonic)) {
+                case packMnemonic("jsr"): case packMnemonic("rts"):
+                case packMnemonic("rti"): case packMnemonic("brk"):
+                    // The other side of a call or return may test any flag
+                    break;
+                default:
+                    reads[i] = instruction(index).flagsRead & FLAGS_NZCV;
+                    break;
+            }
         }
-        else if (sectionName == "data") {
-            JsonData dataItem;
-            dataItem.directive = extractStringValue(objJson, "directive");
-            dataItem.type = extractStringValue(objJson, "type");
-            dataItem.values = extractArrayValues(objJson, "values");
-            dataItem.comment = extractStringValue(objJson, "comment");
-            dataItem.lineNumber = extractIntValue(objJson, "line");
-            data.push_back(dataItem);
+        
+        auto liveOut = [&](const ControlFlowGraph::BasicBlock& block, const std::vector<uint8_t>& liveIn) {
+            uint8_t out = block.escapes ? FLAGS_NZCV : 0;
+            for (size_t successor : block.successors) {
+                out |= liveIn[successor];
+            }
+            return out;
+        };
+        
+        std::vector<uint8_t> liveIn(blocks.size(), 0);
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (size_t b = blocks.size(); b-- > 0; ) {
+                uint8_t live = liveOut(blocks[b], liveIn);
+                for (size_t i = blocks[b].end; i-- > blocks[b].first; ) {
+                    live = static_cast<uint8_t>(reads[i] | (live & ~writes[i]));
+                }
+                if (live != liveIn[b]) {
+                    liveIn[b] = live;
+                    changed = true;
+                }
+            }
         }
-        else if (sectionName == "directives") {
-            JsonDirective directive;
-            directive.name = extractStringValue(objJson, "name");
-            directive.operand = extractStringValue(objJson, "operand");
-            directive.comment = extractStringValue(objJson, "comment");
-            directive.lineNumber = extractIntValue(objJson, "line");
-            directives.push_back(directive);
+        
+        liveFlagsAfter.assign(instructions.size(), FLAGS_NZCV);
+        uint64_t written = 0;
+        uint64_t live = 0;
+        for (const auto& block : blocks) {
+            uint8_t out = liveOut(block, liveIn);
+            for (size_t i = block.end; i-- > block.first; ) {
+                const JsonInstruction* inst = statements[i].kind == ControlFlowGraph::STATEMENT_INSTRUCTION
+                                            ? findInstruction(statements[i].lineNumber) : nullptr;
+                if (inst) {
+                    liveFlagsAfter[inst - instructions.data()] = out;
+                    for (uint8_t flag : {FLAG_N, FLAG_Z, FLAG_C, FLAG_V}) {
+                        written += (writes[i] & flag) != 0;
+                        live += (writes[i] & out & flag) != 0;
+                    }
+                }
+                out = static_cast<uint8_t>(reads[i] | (out & ~writes[i]));
+            }
+        }
+        if (stats) {
+            stats->addCount("Flag updates", "written by instructions", written);
+            stats->addCount("Flag updates", "live", live);
         }
-        else if (sectionName == "program_flow") {
-            ProgramFlowItem item;
-            item.type = extractStringValue(objJson, "type");
-            item.content = extractStringValue(objJson, "content");
-            item.comment = extractStringValue(objJson, "comment");
-            item.lineNumber = extractIntValue(objJson, "line");
-            programFlow.push_back(item);
+    }
+    
+    // Groups the program flow into label blocks. Items before the first
+    // label are not generated.
+    void buildLabelBlocks() {
+        labelBlocks.clear();
+        for (const auto& item : programFlow) {
+            if (item.type == "label") {
+                std::string_view name = item.content;
+                if (!name.empty() && name.back() == ':') name.remove_suffix(1);
+                labelBlocks.push_back(LabelBlock{name, item.content, {}});
+            } else if (!labelBlocks.empty()) {
+                labelBlocks.back().items.push_back(&item);
+            }
         }
     }
     
-    // Based on translator.cpp translateExpression patterns
-    std::string translateExpression(const std::string& expr) {
-        if (expr.empty()) return "";
+    // Picks the jsr targets that can become C++ functions, working on the
+    // label blocks that are rendered as a unit. A subroutine's
+    // region is every block reachable from its entry through fallthrough,
+    // branches and jmp. It qualifies when nothing outside the region jumps
+    // or falls into it, no other jsr enters it part way, it has no code the
+    // graph cannot follow (rti, brk, indirect or unknown jumps, data in the
+    // instruction stream) and every jsr in it calls another function, since
+    // a function cannot goto into code(). Everything else keeps JSR() and
+    // the Return switch.
+    void findSubroutines() {
+        size_t blockCount = labelBlocks.size();
+        blockFunction.assign(blockCount, -1);
+        functionEntries.clear();
+        functionByEntry.clear();
+        if (!options.subroutineFunctions) return;
+        
+        std::unordered_map<std::string_view, size_t> blockByName;
+        for (size_t i = 0; i < blockCount; ++i) {
+            blockByName.emplace(labelBlocks[i].name, i);
+        }
         
-        // Handle hex constants: $FF -> 0xFF
-        if (expr[0] == '$') {
-            return "0x" + expr.substr(1);
+        // Control flow between blocks
+        std::vector<std::vector<size_t>> successors(blockCount);
+        std::vector<std::vector<size_t>> predecessors(blockCount);
+        std::vector<std::vector<std::string_view>> calls(blockCount);
+        std::vector<char> irregular(blockCount, 0);
+        std::vector<char> called(blockCount, 0);
+        std::vector<char> entered(blockCount, 0);     // by the mode switch or a jump table
+        for (const char* entry : {"Start", "NonMaskableInterrupt"}) {
+            auto block = blockByName.find(entry);
+            if (block != blockByName.end()) entered[block->second] = 1;
         }
         
-        // Handle binary constants: %11001100 -> BOOST_BINARY(11001100)
-        if (expr[0] == '%') {
-            return "BOOST_BINARY(" + expr.substr(1) + ")";
+        // Each label block is a run of basic blocks, since every label
+        // starts one
+        const auto& basicBlocks = cfg.basicBlocks();
+        const auto& cfgLabels = cfg.labelList();
+        size_t statementCount = cfg.statementList().size();
+        for (size_t i = 0; i < blockCount; ++i) {
+            bool reachable = true;
+            auto addEdge = [&](std::string_view target) {
+                auto block = blockByName.find(target);
+                if (block == blockByName.end()) {
+                    irregular[i] = 1;
+                } else {
+                    successors[i].push_back(block->second);
+                }
+            };
+            
+            // Code after an rts or jmp is still generated, so its jumps
+            // count; reachable only follows the text of the label block
+            size_t first = cfgLabels[i].statement;
+            size_t end = i + 1 < blockCount ? cfgLabels[i + 1].statement : statementCount;
+            for (size_t b = first < end ? cfg.blockOf(first) : basicBlocks.size();
+                 b < basicBlocks.size() && basicBlocks[b].first < end; ++b) {
+                const ControlFlowGraph::BasicBlock& block = basicBlocks[b];
+                switch (block.exit) {
+                    case ControlFlowGraph::EXIT_DATA:
+                        if (reachable) irregular[i] = 1;
+                        break;
+                    case ControlFlowGraph::EXIT_BRANCH:
+                        addEdge(block.targets[0]);
+                        break;
+                    case ControlFlowGraph::EXIT_JUMP:
+                        if (block.targets[0] == "EndlessLoop") irregular[i] = 1;
+                        else addEdge(block.targets[0]);
+                        reachable = false;
+                        break;
+                    case ControlFlowGraph::EXIT_INDIRECT_JUMP:
+                        irregular[i] = 1;
+                        reachable = false;
+                        break;
+                    case ControlFlowGraph::EXIT_TABLE:
+                    case ControlFlowGraph::EXIT_CALL: {
+                        // A dispatch table jumps within its function, code(),
+                        // and is still a call of JumpEngine
+                        if (block.exit == ControlFlowGraph::EXIT_TABLE) {
+                            for (std::string_view target : block.targets) {
+                                auto entry = blockByName.find(target);
+                                if (entry != blockByName.end()) entered[entry->second] = 1;
+                            }
+                        }
+                        std::string_view callee = cfg.statementList()[block.end - 1].operand;
+                        calls[i].push_back(callee);
+                        auto entry = blockByName.find(callee);
+                        if (entry != blockByName.end()) called[entry->second] = 1;
+                        break;
+                    }
+                    case ControlFlowGraph::EXIT_RETURN:
+                        reachable = false;
+                        break;
+                    case ControlFlowGraph::EXIT_INTERRUPT_RETURN:
+                    case ControlFlowGraph::EXIT_BREAK:
+                        irregular[i] = 1;
+                        reachable = false;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            if (reachable) {
+                if (i + 1 < blockCount) successors[i].push_back(i + 1);
+                else irregular[i] = 1;
+            }
+            for (size_t successor : successors[i]) {
+                predecessors[successor].push_back(i);
+            }
         }
         
-        // Handle decimal constants and names as-is
-        return expr;
+        // Candidate regions, each checked on its own
+        std::vector<std::vector<size_t>> regions;
+        std::vector<int> regionMark(blockCount, -1);
+        std::vector<size_t> stack;
+        for (size_t entry = 0; entry < blockCount; ++entry) {
+            if (!called[entry] || entered[entry]) continue;
+            int mark = static_cast<int>(entry);
+            std::vector<size_t> region;
+            bool valid = true;
+            stack.assign(1, entry);
+            regionMark[entry] = mark;
+            while (valid && !stack.empty()) {
+                size_t block = stack.back();
+                stack.pop_back();
+                region.push_back(block);
+                if (irregular[block] || (block != entry && (called[block] || entered[block]))) {
+                    valid = false;
+                    break;
+                }
+                for (size_t successor : successors[block]) {
+                    if (regionMark[successor] != mark) {
+                        regionMark[successor] = mark;
+                        stack.push_back(successor);
+                    }
+                }
+            }
+            for (size_t block = 0; valid && block < region.size(); ++block) {
+                for (size_t predecessor : predecessors[region[block]]) {
+                    if (regionMark[predecessor] != mark) {
+                        valid = false;
+                        break;
+                    }
+                }
+            }
+            if (valid) {
+                std::sort(region.begin(), region.end());
+                functionByEntry.emplace(labelBlocks[entry].name, static_cast<int>(regions.size()));
+                functionEntries.push_back(entry);
+                regions.push_back(std::move(region));
+            }
+        }
+        
+        // Drop subroutines that call code() until only functions call functions
+        std::vector<char> accepted(regions.size(), 1);
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (size_t function = 0; function < regions.size(); ++function) {
+                if (!accepted[function]) continue;
+                for (size_t block : regions[function]) {
+                    for (std::string_view target : calls[block]) {
+                        auto callee = functionByEntry.find(target);
+                        if (callee == functionByEntry.end() || !accepted[callee->second]) {
+                            accepted[function] = 0;
+                            changed = true;
+                            break;
+                        }
+                    }
+                    if (!accepted[function]) break;
+                }
+            }
+        }
+        
+        std::vector<size_t> entries;
+        functionByEntry.clear();
+        size_t functionBlocks = 0;
+        for (size_t function = 0; function < regions.size(); ++function) {
+            if (!accepted[function]) continue;
+            int index = static_cast<int>(entries.size());
+            functionByEntry.emplace(labelBlocks[functionEntries[function]].name, index);
+            entries.push_back(functionEntries[function]);
+            for (size_t block : regions[function]) {
+                blockFunction[block] = index;
+            }
+            functionBlocks += regions[function].size();
+        }
+        functionEntries.swap(entries);
+        
+        if (stats) {
+            stats->addCount("Subroutines", "well-formed", regions.size());
+            stats->addCount("Subroutines", "functions", functionEntries.size());
+            stats->addCount("Subroutines", "blocks in functions", functionBlocks);
+        }
     }
     
-    // Based on translator.cpp translateOperand patterns
-    std::string translateOperand(const std::string& operand) {
-        if (operand.empty()) return "";
+    static const char* registerName(char name) {
+        switch (name) {
+            case 'x': return "registerX";
+            case 'y': return "registerY";
+            case 's': return "registerS";
+            default: return "registerA";
+        }
+    }
+    
+    // Explicit mode: fills operandScratch with how operand is read and
+    // written. Indexed operands with a zero page base wrap within the
+    // zero page when the instruction has that addressing mode.
+    const MemoryOperand& describeOperand(std::string_view operand, const isa6502::InstructionInfo& info) {
+        MemoryOperand& result = operandScratch;
+        result.immediate = false;
+        result.direct = false;
+        result.value.clear();
+        result.address.clear();
+        
+        if (operand.empty() || operand == "a" || operand == "A") {
+            result.direct = true;
+            result.value = "registerA";
+            return result;
+        }
         
-        // Handle immediate addressing: #value -> value
         if (operand[0] == '#') {
-            return translateExpression(operand.substr(1));
+            result.immediate = true;
+            translateExpression(operand.substr(1), result.value);
+            return result;
         }
         
-        // Handle indirect addressing: (value) -> M(value)
-        if (operand.front() == '(' && operand.back() == ')') {
-            std::string inner = operand.substr(1, operand.length() - 2);
-            return "M(" + translateExpression(inner) + ")";
+        size_t commaPos = operand.find(',');
+        if (commaPos != std::string_view::npos) {
+            std::string_view base = trimWhitespace(operand.substr(0, commaPos));
+            std::string_view index = trimWhitespace(operand.substr(commaPos + 1));
+            bool indexX = index == "x" || index == "X";
+            
+            if (!base.empty() && base.front() == '(' && base.back() == ')') {
+                // (zp),y
+                result.address = "W(";
+                translateExpression(base.substr(1, base.size() - 2), result.address);
+                result.address += ") + registerY";
+            } else if (!base.empty() && base.front() == '(' && operand.back() == ')' && indexX) {
+                // (zp,x), split at the comma inside the parentheses
+                result.address = "W((";
+                translateExpression(trimWhitespace(base.substr(1)), result.address);
+                result.address += " + registerX) & 0xFF)";
+            } else {
+                int32_t address;
+                bool resolved = evaluator.evaluate(base, address);
+                bool zeroPage = resolved && address >= 0 && address < 0x100 &&
+                                info.supports(indexX ? isa6502::ZERO_PAGE_X : isa6502::ZERO_PAGE_Y);
+                std::string& target = options.directRamAccess && resolved && address >= 0 &&
+                                      (zeroPage || address + 0xFF < RAM_SIZE) ? result.value : result.address;
+                target += zeroPage ? "(" : "";
+                translateExpression(base, target);
+                target += indexX ? " + registerX" : " + registerY";
+                target += zeroPage ? ") & 0xFF" : "";
+                if (&target == &result.value) {
+                    result.direct = true;
+                    result.value.insert(0, "ram[");
+                    result.value += ']';
+                    return result;
+                }
+            }
+        } else {
+            int32_t address;
+            if (resolveRamAddress(operand, address)) {
+                result.direct = true;
+                appendRamAccess(operand, address, result.value);
+                return result;
+            }
+            if (operand.front() == '(' && operand.back() == ')') {
+                result.address = "W(";
+                translateExpression(operand.substr(1, operand.size() - 2), result.address);
+                result.address += ')';
+            } else {
+                translateExpression(operand, result.address);
+            }
         }
         
-        // Handle indexed addressing: value,x -> value + x
-        size_t commaPos = operand.find(',');
-        if (commaPos != std::string::npos) {
-            std::string base = operand.substr(0, commaPos);
-            std::string index = operand.substr(commaPos + 1);
+        result.value = "readData(";
+        result.value += result.address;
+        result.value += ')';
+        return result;
+    }
+    
+    static void appendStatement(std::string& out, size_t start, std::string_view statement) {
+        if (out.size() > start) out += ' ';
+        out += statement;
+    }
+    
+    // Appends the live N and Z updates for value
+    void appendNZ(std::string& out, size_t start, uint8_t live, std::string_view value) {
+        if (options.flagMode == FLAGS_LAZY) {
+            appendStatement(out, start, "nzc = (nzc & 0x100) | ");
+            out += value;
+            out += ';';
+            return;
+        }
+        if (live & isa6502::FLAG_Z) {
+            appendStatement(out, start, "z = (");
+            out += value;
+            out += " == 0);";
+        }
+        if (live & isa6502::FLAG_N) {
+            appendStatement(out, start, "n = (");
+            out += value;
+            out += " & 0x80) != 0;";
+        }
+    }
+    
+    // FLAGS_LAZY forms of the instructions whose flags are more than N
+    // and Z of a result; false for the rest, which share the FLAGS_EXPLICIT
+    // code with appendNZ storing the result
+    bool translateLazyInstruction(const JsonInstruction& inst, const isa6502::InstructionInfo& info,
+                                  std::string& out) {
+        using isa6502::packMnemonic;
+        char reg = inst.mnemonic.back();
+        
+        switch (packMnemonic(inst.mnemonic)) {
+            case packMnemonic("bcc"): translateBranch("!(nzc & 0x100)", inst.operand, out); return true;
+            case packMnemonic("bcs"): translateBranch("(nzc & 0x100)", inst.operand, out); return true;
+            case packMnemonic("beq"): translateBranch("!(nzc & 0xFF)", inst.operand, out); return true;
+            case packMnemonic("bne"): translateBranch("(nzc & 0xFF)", inst.operand, out); return true;
+            case packMnemonic("bmi"): translateBranch("(nzc & 0x280)", inst.operand, out); return true;
+            case packMnemonic("bpl"): translateBranch("!(nzc & 0x280)", inst.operand, out); return true;
+            
+            case packMnemonic("clc"): out += "nzc &= 0x2FF;"; return true;
+            case packMnemonic("sec"): out += "nzc |= 0x100;"; return true;
+            
+            case packMnemonic("adc"):
+            case packMnemonic("sbc"): {
+                // A - M - borrow is A + ~M + C, so both leave the carry in bit 8
+                bool add = inst.mnemonic == "adc";
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += "{ uint8_t value = ";
+                out += operand.value;
+                out += add ? "; nzc = registerA + value + ((nzc >> 8) & 1);"
+                           : "; nzc = registerA + (value ^ 0xFF) + ((nzc >> 8) & 1);";
+                out += add ? " v = (~(registerA ^ value) & (registerA ^ nzc) & 0x80) != 0;"
+                           : " v = ((registerA ^ value) & (registerA ^ nzc) & 0x80) != 0;";
+                out += " registerA = static_cast<uint8_t>(nzc); }";
+                return true;
+            }
+            
+            case packMnemonic("cmp"):
+            case packMnemonic("cpx"):
+            case packMnemonic("cpy"): {
+                // Bit 8 of R + 0x100 - M is set exactly when R >= M
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += "nzc = ";
+                out += registerName(reg == 'p' ? 'a' : reg);
+                out += " + 0x100 - (";
+                out += operand.value;
+                out += ");";
+                return true;
+            }
+            
+            case packMnemonic("bit"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += "{ uint8_t value = ";
+                out += operand.value;
+                out += "; nzc = (nzc & 0x100) | (registerA & value) | ((value & 0x80) << 2);";
+                out += " v = (value & 0x40) != 0; }";
+                return true;
+            }
+            
+            case packMnemonic("inc"):
+            case packMnemonic("dec"):
+            case packMnemonic("asl"):
+            case packMnemonic("lsr"):
+            case packMnemonic("rol"):
+            case packMnemonic("ror"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                std::string_view target = operand.direct ? std::string_view(operand.value) : "value";
+                std::string_view mnemonic = inst.mnemonic;
+                
+                if (!operand.direct) {
+                    out += "{ uint8_t value = ";
+                    out += operand.value;
+                    out += "; ";
+                }
+                if (mnemonic == "inc" || mnemonic == "dec") {
+                    out += mnemonic == "inc" ? "++" : "--";
+                    out += target;
+                    out += "; nzc = (nzc & 0x100) | ";
+                    out += target;
+                    out += ';';
+                } else {
+                    out += "nzc = ";
+                    if (mnemonic == "asl" || mnemonic == "rol") {
+                        out += '(';
+                        out += target;
+                        out += mnemonic == "asl" ? " << 1);" : " << 1) | ((nzc >> 8) & 1);";
+                    } else {
+                        out += "((";
+                        out += target;
+                        out += " & 1) << 8) | (";
+                        out += target;
+                        out += mnemonic == "lsr" ? " >> 1);" : " >> 1) | ((nzc >> 1) & 0x80);";
+                    }
+                    out += ' ';
+                    out += target;
+                    out += " = static_cast<uint8_t>(nzc);";
+                }
+                if (!operand.direct) {
+                    out += " writeData(";
+                    out += operand.address;
+                    out += ", value); }";
+                }
+                return true;
+            }
+            
+            default:
+                return false;
+        }
+    }
+    
+    // FLAGS_EXPLICIT and FLAGS_LAZY translation: registers are plain bytes
+    // and only the flags in live are computed. Control flow, the stack and
+    // the mode flags are shared with translateInstruction.
+    void translateInstructionExplicit(const JsonInstruction& inst, uint8_t live, std::string& out) {
+        using namespace isa6502;
+        int index = mnemonicIndex(inst.mnemonic);
+        if (index < 0) {
+            translateInstruction(inst, out);
+            return;
+        }
+        const InstructionInfo& info = instruction(index);
+        if (options.flagMode == FLAGS_LAZY && translateLazyInstruction(inst, info, out)) {
+            return;
+        }
+        live &= info.flagsWritten;
+        size_t start = out.size();
+        char reg = inst.mnemonic.back();
+        
+        switch (packMnemonic(inst.mnemonic)) {
+            case packMnemonic("lda"):
+            case packMnemonic("ldx"):
+            case packMnemonic("ldy"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += registerName(reg);
+                out += " = ";
+                out += operand.value;
+                out += ';';
+                appendNZ(out, start, live, registerName(reg));
+                return;
+            }
+            
+            case packMnemonic("sta"):
+            case packMnemonic("stx"):
+            case packMnemonic("sty"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                if (operand.direct) {
+                    out += operand.value;
+                    out += " = ";
+                    out += registerName(reg);
+                    out += ';';
+                } else {
+                    out += "writeData(";
+                    out += operand.address;
+                    out += ", ";
+                    out += registerName(reg);
+                    out += ");";
+                }
+                return;
+            }
+            
+            case packMnemonic("tax"): out += "registerX = registerA;"; appendNZ(out, start, live, "registerX"); return;
+            case packMnemonic("tay"): out += "registerY = registerA;"; appendNZ(out, start, live, "registerY"); return;
+            case packMnemonic("txa"): out += "registerA = registerX;"; appendNZ(out, start, live, "registerA"); return;
+            case packMnemonic("tya"): out += "registerA = registerY;"; appendNZ(out, start, live, "registerA"); return;
+            case packMnemonic("tsx"): out += "registerX = registerS;"; appendNZ(out, start, live, "registerX"); return;
+            case packMnemonic("txs"): out += "registerS = registerX;"; return;
+            
+            case packMnemonic("inx"): out += "++registerX;"; appendNZ(out, start, live, "registerX"); return;
+            case packMnemonic("iny"): out += "++registerY;"; appendNZ(out, start, live, "registerY"); return;
+            case packMnemonic("dex"): out += "--registerX;"; appendNZ(out, start, live, "registerX"); return;
+            case packMnemonic("dey"): out += "--registerY;"; appendNZ(out, start, live, "registerY"); return;
+            
+            case packMnemonic("and"):
+            case packMnemonic("eor"):
+            case packMnemonic("ora"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += reg == 'd' ? "registerA &= " : reg == 'r' ? "registerA ^= " : "registerA |= ";
+                out += operand.value;
+                out += ';';
+                appendNZ(out, start, live, "registerA");
+                return;
+            }
             
-            // Trim whitespace
-            base = std::regex_replace(base, std::regex("^\\s+|\\s+$"), "");
-            index = std::regex_replace(index, std::regex("^\\s+|\\s+$"), "");
+            case packMnemonic("adc"):
+            case packMnemonic("sbc"): {
+                bool add = inst.mnemonic == "adc";
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                out += "{ uint8_t value = ";
+                out += operand.value;
+                out += add ? "; unsigned result = registerA + value + c;" : "; unsigned result = registerA - value - !c;";
+                if (live & FLAG_V) {
+                    out += add ? " v = (~(registerA ^ value) & (registerA ^ result) & 0x80) != 0;"
+                               : " v = ((registerA ^ value) & (registerA ^ result) & 0x80) != 0;";
+                }
+                if (live & FLAG_C) {
+                    out += add ? " c = result > 0xFF;" : " c = result < 0x100;";
+                }
+                out += " registerA = static_cast<uint8_t>(result);";
+                appendNZ(out, start, live, "registerA");
+                out += " }";
+                return;
+            }
             
-            // Special case for (value),y -> W(value) + y
-            if (base.front() == '(' && base.back() == ')' && index == "y") {
-                std::string inner = base.substr(1, base.length() - 2);
-                return "W(" + translateExpression(inner) + ") + y";
+            case packMnemonic("cmp"):
+            case packMnemonic("cpx"):
+            case packMnemonic("cpy"):
+            case packMnemonic("bit"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                if (live == 0) {
+                    // Nothing to compute, but an I/O read still has to happen
+                    if (!operand.immediate && !operand.direct) {
+                        out += operand.value;
+                        out += ';';
+                    } else {
+                        out += "/* ";
+                        out += inst.mnemonic;
+                        out += ": flags unused */";
+                    }
+                    return;
+                }
+                
+                const char* compared = registerName(reg == 'p' ? 'a' : reg);
+                out += "{ uint8_t value = ";
+                out += operand.value;
+                out += ';';
+                if (reg == 't') {
+                    if (live & FLAG_Z) out += " z = (registerA & value) == 0;";
+                    if (live & FLAG_N) out += " n = (value & 0x80) != 0;";
+                    if (live & FLAG_V) out += " v = (value & 0x40) != 0;";
+                } else {
+                    if (live & FLAG_C) { out += " c = "; out += compared; out += " >= value;"; }
+                    if (live & FLAG_Z) { out += " z = "; out += compared; out += " == value;"; }
+                    if (live & FLAG_N) { out += " n = (("; out += compared; out += " - value) & 0x80) != 0;"; }
+                }
+                out += " }";
+                return;
+            }
+            
+            case packMnemonic("inc"):
+            case packMnemonic("dec"):
+            case packMnemonic("asl"):
+            case packMnemonic("lsr"):
+            case packMnemonic("rol"):
+            case packMnemonic("ror"): {
+                const MemoryOperand& operand = describeOperand(inst.operand, info);
+                std::string_view target = operand.direct ? std::string_view(operand.value) : "value";
+                std::string_view mnemonic = inst.mnemonic;
+                bool rotate = mnemonic == "rol" || mnemonic == "ror";
+                bool braces = !operand.direct || rotate;
+                
+                if (braces) out += "{ ";
+                if (!operand.direct) {
+                    out += "uint8_t value = ";
+                    out += operand.value;
+                    out += "; ";
+                }
+                if (rotate) {
+                    out += "bool carry = c; ";
+                }
+                if ((live & FLAG_C) && mnemonic != "inc" && mnemonic != "dec") {
+                    out += "c = (";
+                    out += target;
+                    out += mnemonic == "asl" || mnemonic == "rol" ? " & 0x80) != 0; " : " & 0x01) != 0; ";
+                }
+                
+                if (mnemonic == "inc" || mnemonic == "dec") {
+                    out += mnemonic == "inc" ? "++" : "--";
+                    out += target;
+                    out += ';';
+                } else if (!rotate) {
+                    out += target;
+                    out += mnemonic == "asl" ? " <<= 1;" : " >>= 1;";
+                } else {
+                    out += target;
+                    out += " = static_cast<uint8_t>(";
+                    out += '(';
+                    out += target;
+                    out += mnemonic == "rol" ? " << 1) | carry);" : " >> 1) | (carry << 7));";
+                }
+                
+                if (!operand.direct) {
+                    out += " writeData(";
+                    out += operand.address;
+                    out += ", value);";
+                }
+                appendNZ(out, start, live, target);
+                if (braces) out += " }";
+                return;
             }
             
-            return translateExpression(base) + " + " + index;
+            case packMnemonic("clc"):
+            case packMnemonic("sec"):
+            case packMnemonic("clv"):
+                if (live == 0) {
+                    out += "/* ";
+                    out += inst.mnemonic;
+                    out += ": flag unused */";
+                } else {
+                    out += inst.mnemonic == "clc" ? "c = 0;" : inst.mnemonic == "sec" ? "c = 1;" : "v = 0;";
+                }
+                return;
+            
+            default:
+                translateInstruction(inst, out);
+                return;
         }
-        
-        // Everything else needs memory access: value -> M(value)
-        return "M(" + translateExpression(operand) + ")";
-    }
-    
-    // Based on translator.cpp translateBranch pattern
-    std::string translateBranch(const std::string& condition, const std::string& destination) {
-        return "if (" + condition + ")\n        goto " + destination + ";";
-    }
-    
-    // Based on translator.cpp translateInstruction patterns
-    std::string translateInstruction(const JsonInstruction& inst) {
-        std::string mnemonic = inst.mnemonic;
-        std::string operand = inst.operand;
-        
-        // Load instructions
-        if (mnemonic == "lda") return "a = " + translateOperand(operand) + ";";
-        if (mnemonic == "ldx") return "x = " + translateOperand(operand) + ";";
-        if (mnemonic == "ldy") return "y = " + translateOperand(operand) + ";";
-        
-        // Store instructions
-        if (mnemonic == "sta") return "writeData(" + translateExpression(operand) + ", a);";
-        if (mnemonic == "stx") return "writeData(" + translateExpression(operand) + ", x);";
-        if (mnemonic == "sty") return "writeData(" + translateExpression(operand) + ", y);";
-        
-        // Transfer instructions
-        if (mnemonic == "tax") return "x = a;";
-        if (mnemonic == "tay") return "y = a;";
-        if (mnemonic == "txa") return "a = x;";
-        if (mnemonic == "tya") return "a = y;";
-        if (mnemonic == "tsx") return "x = s;";
-        if (mnemonic == "txs") return "s = x;";
-        
-        // Stack instructions
-        if (mnemonic == "pha") return "pha();";
-        if (mnemonic == "php") return "php();";
-        if (mnemonic == "pla") return "pla();";
-        if (mnemonic == "plp") return "plp();";
-        
-        // Logical instructions
-        if (mnemonic == "and") return "a &= " + translateOperand(operand) + ";";
-        if (mnemonic == "eor") return "a ^= " + translateOperand(operand) + ";";
-        if (mnemonic == "ora") return "a |= " + translateOperand(operand) + ";";
-        if (mnemonic == "bit") return "bit(" + translateOperand(operand) + ");";
-        
-        // Arithmetic instructions
-        if (mnemonic == "adc") return "a += " + translateOperand(operand) + ";";
-        if (mnemonic == "sbc") return "a -= " + translateOperand(operand) + ";";
-        
-        // Compare instructions
-        if (mnemonic == "cmp") return "compare(a, " + translateOperand(operand) + ");";
-        if (mnemonic == "cpx") return "compare(x, " + translateOperand(operand) + ");";
-        if (mnemonic == "cpy") return "compare(y, " + translateOperand(operand) + ");";
-        
-        // Increment/Decrement
-        if (mnemonic == "inc") return "++" + translateOperand(operand) + ";";
-        if (mnemonic == "inx") return "++x;";
-        if (mnemonic == "iny") return "++y;";
-        if (mnemonic == "dec") return "--" + translateOperand(operand) + ";";
-        if (mnemonic == "dex") return "--x;";
-        if (mnemonic == "dey") return "--y;";
-        
-        // Shift instructions
-        if (mnemonic == "asl") {
-            if (operand.empty()) return "a <<= 1;";
-            return translateOperand(operand) + " <<= 1;";
-        }
-        if (mnemonic == "lsr") {
-            if (operand.empty()) return "a >>= 1;";
-            return translateOperand(operand) + " >>= 1;";
-        }
-        if (mnemonic == "rol") {
-            if (operand.empty()) return "a.rol();";
-            return translateOperand(operand) + ".rol();";
-        }
-        if (mnemonic == "ror") {
-            if (operand.empty()) return "a.ror();";
-            return translateOperand(operand) + ".ror();";
-        }
-        
-        // Jump instructions
-        if (mnemonic == "jmp") {
-            if (operand == "EndlessLoop") return "return;";
-            return "goto " + operand + ";";
-        }
-        
-        if (mnemonic == "jsr") {
-            if (operand == "JumpEngine") {
-                // Special case - would need more context to implement properly
-                return "/* JSR JumpEngine - needs jump table implementation */";
-            }
-            return "JSR(" + operand + ", " + std::to_string(returnLabelIndex++) + ");";
-        }
-        
-        if (mnemonic == "rts") return "goto Return;";
-        
-        // Branch instructions
-        if (mnemonic == "bcc") return translateBranch("!c", operand);
-        if (mnemonic == "bcs") return translateBranch("c", operand);
-        if (mnemonic == "beq") return translateBranch("z", operand);
-        if (mnemonic == "bmi") return translateBranch("n", operand);
-        if (mnemonic == "bne") return translateBranch("!z", operand);
-        if (mnemonic == "bpl") return translateBranch("!n", operand);
-        if (mnemonic == "bvc") return translateBranch("!v", operand);
-        if (mnemonic == "bvs") return translateBranch("v", operand);
-        
-        // Flag instructions
-        if (mnemonic == "clc") return "c = 0;";
-        if (mnemonic == "cld") return "/* cld */";
-        if (mnemonic == "cli") return "/* cli */";
-        if (mnemonic == "clv") return "/* clv */";
-        if (mnemonic == "sec") return "c = 1;";
-        if (mnemonic == "sed") return "/* sed */";
-        if (mnemonic == "sei") return "/* sei */";
-        
-        // Misc instructions
-        if (mnemonic == "brk") return "/* brk */";
-        if (mnemonic == "nop") return "; // nop";
-        if (mnemonic == "rti") return "return;";
-        
-        return "/* Unknown instruction: " + mnemonic + " */";
     }
-    
+
 public:
     void parseJsonFile(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open JSON file: " + filename);
+        StatsPhase reading(stats, "read");
+        MappedFile file(filename);
+        reading.stop();
+        StatsPhase parsing(stats, "section parse");
+        
+        // Parse all sections in a single pass over the document. Binary
+        // .6502ir images are recognised by their magic bytes.
+        SectionLoader loader(*this);
+        if (isIrImage(file.view())) {
+            IrReader(file.view()).replay(loader);
+        } else {
+            JsonReader reader;
+            reader.parse(file.view(), loader);
         }
         
-        std::ostringstream buffer;
-        buffer << file.rdbuf();
-        std::string jsonContent = buffer.str();
-        
-        // Parse all sections
-        parseJsonSection(jsonContent, "constants");
-        parseJsonSection(jsonContent, "labels");
-        parseJsonSection(jsonContent, "instructions");
-        parseJsonSection(jsonContent, "data");
-        parseJsonSection(jsonContent, "directives");
-        parseJsonSection(jsonContent, "program_flow");
-        
         // Build comment map for line number lookups
         for (const auto& item : programFlow) {
             if (!item.comment.empty()) {
                 commentMap[item.lineNumber] = item.comment;
             }
         }
+        
+        buildIndexes();
+        
+        if (stats) {
+            stats->addCount("Records", "constants", constants.size());
+            stats->addCount("Records", "labels", labels.size());
+            stats->addCount("Records", "instructions", instructions.size());
+            stats->addCount("Records", "data", data.size());
+            stats->addCount("Records", "directives", directives.size());
+        }
     }
     
     void generateCppFiles(const std::string& outputDir) {
@@ -501,28 +1517,139 @@ public:
             mkdir(outputDir.c_str(), 0755);
         #endif
         
-        generateConstantHeader(outputDir);
-        generateSourceFile(outputDir);
-        generateDataFiles(outputDir);
+        OutputFiles files;
+        {
+            StatsPhase phase(stats, "codegen");
+            generateConstantHeader(files);
+            generateSourceFile(files);
+            generateDataFiles(files);
+        }
         
-        std::cout << "Generated C++ files in " << outputDir << ":" << std::endl;
-        std::cout << "  SMB.cpp" << std::endl;
-        std::cout << "  SMBData.cpp" << std::endl;
-        std::cout << "  SMBDataPointers.hpp" << std::endl;
-        std::cout << "  SMBConstants.hpp" << std::endl;
+        StatsPhase phase(stats, "write");
+        for (const auto& output : files) {
+            writeFileIfChanged(outputDir + "/" + output.first, output.second);
+        }
+    }
+    
+    // Writes the basic blocks of the program as Graphviz when filename
+    // ends in .dot and as JSON otherwise
+    void writeControlFlowGraph(const std::string& filename) {
+        buildControlFlowGraph();
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot create output file: " + filename);
+        }
+        const std::string dotExtension = ".dot";
+        if (filename.size() >= dotExtension.size() &&
+            filename.compare(filename.size() - dotExtension.size(), dotExtension.size(), dotExtension) == 0) {
+            cfg.writeDot(file);
+        } else {
+            cfg.writeJson(file);
+        }
+    }
+    
+    // Phases and record counts go to runStats; null turns them off
+    void setStats(RunStats* runStats) {
+        stats = runStats;
+    }
+    
+    void setCodegenOptions(const CodegenOptions& codegenOptions) {
+        options = codegenOptions;
+    }
+    
+    // Reads the "Name = $XXXX" lines convert --assemble writes next to the
+    // binary. Every data table then sits at its label's address in that
+    // binary, so table addresses the engine stores in RAM are the ones the
+    // assembled program stores.
+    void loadSymbols(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open symbol file: " + filename);
+        }
+        symbolAddresses.clear();
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            std::string_view text = trimWhitespace(line);
+            if (text.empty()) continue;
+            size_t equals = text.find('=');
+            std::string_view name = trimWhitespace(text.substr(0, equals == std::string_view::npos ? 0 : equals));
+            std::string_view value = equals == std::string_view::npos ? std::string_view() : trimWhitespace(text.substr(equals + 1));
+            std::string digits(value.size() > 1 && value[0] == '$' ? value.substr(1) : std::string_view());
+            char* end = nullptr;
+            long address = digits.empty() ? -1 : std::strtol(digits.c_str(), &end, 16);
+            if (name.empty() || !end || *end != '\0' || address < 0 || address > 0xFFFF) {
+                throw std::runtime_error(filename + " line " + std::to_string(lineNumber) + ": expected Name = $XXXX");
+            }
+            symbolAddresses[std::string(name)] = static_cast<int>(address);
+        }
+    }
+    
+    // Drops everything parsed so far, keeping the label block cache
+    void reset() {
+        constants.clear();
+        labels.clear();
+        instructions.clear();
+        data.clear();
+        directives.clear();
+        programFlow.clear();
+        commentMap.clear();
+        instructionIndexByLine.clear();
+        dataIndexByLine.clear();
+        jumpTableByLine.clear();
+        labelIndexByName.clear();
+        strings.reset();
+        evaluator.clear();
+        returnLabelIndex = 0;
+        labelBlocks.clear();
+        cfg.clear();
+        functionEntries.clear();
+        functionByEntry.clear();
+    }
+    
+    // Label blocks of SMB.cpp rendered afresh by the last generateCppFiles,
+    // out of blockCount()
+    size_t renderedBlockCount() const {
+        return blocksRendered;
     }
     
+    size_t blockCount() const {
+        return blocksTotal;
+    }
+
 private:
-    void generateConstantHeader(const std::string& outputDir) {
-        std::ofstream file(outputDir + "/SMBConstants.hpp");
+    // Leaves files whose content has not changed alone, so their
+    // timestamps do not trigger rebuilds downstream
+    static void writeFileIfChanged(const std::string& path, const std::string& content) {
+        std::ifstream existing(path, std::ios::binary);
+        if (existing.is_open()) {
+            std::string current((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+            if (current == content) {
+                return;
+            }
+        }
+        existing.close();
+        
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot create output file: " + path);
+        }
+        file << content;
+    }
+    
+    
+    void generateConstantHeader(OutputFiles& files) {
+        std::ostringstream file;
         
         file << "// This is an automatically generated file.\n";
         file << "// Do not edit directly.\n//\n";
         file << "#ifndef SMBCONSTANTS_HPP\n";
         file << "#define SMBCONSTANTS_HPP\n\n";
         
+        std::string value;
         for (const auto& constant : constants) {
-            file << "#define " << constant.name << " " << translateExpression(constant.value);
+            value.clear();
+            translateExpression(constant.value, value);
+            file << "#define " << constant.name << " " << value;
             if (!constant.comment.empty()) {
                 file << " // " << constant.comment;
             }
@@ -530,15 +1657,51 @@ private:
         }
         
         file << "\n#endif // SMBCONSTANTS_HPP\n";
+        files.emplace_back("SMBConstants.hpp", file.str());
     }
     
-    void generateSourceFile(const std::string& outputDir) {
-        std::ofstream file(outputDir + "/SMB.cpp");
+    void generateSourceFile(OutputFiles& files) {
+        std::ostringstream file;
+        std::unordered_map<uint64_t, std::string> usedBlocks;
+        blocksRendered = 0;
+        blocksTotal = 0;
+        
+        // Operands fold through the constants, so a block's text depends on
+        // all of them as well as on its own lines
+        blockHashSeed = hashField(hashBytes(std::string_view()), options.directRamAccess ? "ram" : "M");
+        static const char* const flagModeNames[] = {"runtime", "explicit", "lazy"};
+        blockHashSeed = hashField(blockHashSeed, flagModeNames[options.flagMode]);
+        blockHashSeed = hashField(blockHashSeed, options.threadedReturns ? "threaded" : "switch");
+        for (const auto& constant : constants) {
+            blockHashSeed = hashField(hashField(blockHashSeed, constant.name), constant.value);
+        }
+        buildControlFlowGraph();
+        if (options.flagMode == FLAGS_EXPLICIT) {
+            analyzeFlagLiveness();
+        }
+        buildLabelBlocks();
+        findSubroutines();
+        for (size_t entry : functionEntries) {
+            blockHashSeed = hashField(blockHashSeed, labelBlocks[entry].name);
+        }
         
         file << "// This is an automatically generated file.\n";
         file << "// Do not edit directly.\n//\n";
         file << "#include \"SMB.hpp\"\n\n";
         
+        if (options.threadedReturns) {
+            file << "// Call sites push the address of their Return_N label and rts jumps\n";
+            file << "// straight back to it. Without labels-as-values they fall back to\n";
+            file << "// JSR() and the Return switch.\n";
+            file << "#if defined(__GNUC__)\n";
+            file << "    #define SMB_JSR(subroutine, index) pushReturnAddress(&&Return_##index); goto subroutine; Return_##index:\n";
+            file << "    #define SMB_RTS() goto *popReturnAddress()\n";
+            file << "#else\n";
+            file << "    #define SMB_JSR(subroutine, index) JSR(subroutine, index)\n";
+            file << "    #define SMB_RTS() goto Return\n";
+            file << "#endif\n\n";
+        }
+        
         file << "void SMBEngine::code(int mode)\n{\n";
         file << "    switch (mode)\n    {\n";
         file << "    case 0:\n";
@@ -548,30 +1711,17 @@ private:
         file << "        goto NonMaskableInterrupt;\n";
         file << "    }\n\n";
         
-        // Group program flow items by labels
-        std::string currentLabel;
-        std::vector<ProgramFlowItem> currentItems;
-        
-        for (const auto& item : programFlow) {
-            if (item.type == "label") {
-                // Process previous label if any
-                if (!currentLabel.empty()) {
-                    generateLabelCode(file, currentLabel, currentItems);
-                }
-                
-                currentLabel = item.content;
-                currentItems.clear();
-            } else {
-                currentItems.push_back(item);
+        inFunction = false;
+        for (size_t i = 0; i < labelBlocks.size(); ++i) {
+            if (blockFunction[i] < 0) {
+                emitLabelBlock(file, labelBlocks[i].labelName, labelBlocks[i].items, usedBlocks);
             }
         }
         
-        // Process final label
-        if (!currentLabel.empty()) {
-            generateLabelCode(file, currentLabel, currentItems);
-        }
-        
         // Generate return handler
+        if (options.threadedReturns) {
+            file << "#if !defined(__GNUC__)\n";
+        }
         file << "// Return handler\n";
         file << "// This emulates the RTS instruction using a generated jump table\n//\n";
         file << "Return:\n";
@@ -583,44 +1733,162 @@ private:
         }
         
         file << "    }\n";
+        if (options.threadedReturns) {
+            // Under GCC the last label would otherwise end the function,
+            // which is not a statement
+            file << "#endif\n";
+            file << "    return;\n";
+        }
         file << "}\n";
+        
+        // Subroutine functions, each with its blocks in program order
+        inFunction = true;
+        for (size_t function = 0; function < functionEntries.size(); ++function) {
+            const LabelBlock& entry = labelBlocks[functionEntries[function]];
+            file << "\nvoid SMBEngine::sub_" << entry.name << "()\n{\n";
+            bool first = true;
+            for (size_t i = 0; i < labelBlocks.size(); ++i) {
+                if (blockFunction[i] != static_cast<int>(function)) continue;
+                if (first && i != functionEntries[function]) {
+                    file << "    goto " << entry.name << ";\n";
+                }
+                first = false;
+                emitLabelBlock(file, labelBlocks[i].labelName, labelBlocks[i].items, usedBlocks);
+            }
+            file << "}\n";
+        }
+        inFunction = false;
+        
+        // Blocks that no longer exist fall out of the cache
+        blockCache.swap(usedBlocks);
+        
+        files.emplace_back("SMB.cpp", file.str());
+        
+        if (options.subroutineFunctions) {
+            std::ostringstream header;
+            header << "// This is an automatically generated file.\n";
+            header << "// Do not edit directly.\n//\n";
+            header << "// Included inside the SMBEngine class: the subroutines of SMB.cpp\n";
+            header << "// that are C++ functions.\n//\n";
+            for (size_t entry : functionEntries) {
+                header << "void sub_" << labelBlocks[entry].name << "();\n";
+            }
+            files.emplace_back("SMBSubroutines.hpp", header.str());
+        }
+    }
+    
+    // Extends hash by one terminated field, so adjacent fields cannot run together
+    static uint64_t hashField(uint64_t hash, std::string_view text) {
+        return hashBytes(std::string_view("", 1), hashBytes(text, hash));
+    }
+    
+    // Hash of everything generateLabelCode reads for one block
+    uint64_t hashLabelBlock(std::string_view labelName, const std::vector<const ProgramFlowItem*>& items) const {
+        uint64_t hash = hashField(blockHashSeed, labelName);
+        hash = hashField(hash, inFunction ? "function" : "code");
+        std::string_view cleanLabelName = labelName;
+        if (!cleanLabelName.empty() && cleanLabelName.back() == ':') {
+            cleanLabelName.remove_suffix(1);
+        }
+        const JsonLabel* label = findLabel(cleanLabelName);
+        hash = hashField(hash, label ? label->comment : std::string_view());
+        
+        for (const ProgramFlowItem* item : items) {
+            hash = hashField(hashField(hashField(hash, item->type), item->content), item->comment);
+            if (item->type == "instruction") {
+                const JsonInstruction* instruction = findInstruction(item->lineNumber);
+                hash = hashField(hash, instruction ? instruction->mnemonic : std::string_view("\x02", 1));
+                hash = hashField(hash, instruction ? instruction->operand : std::string_view());
+                if (instruction && instruction->operand == "JumpEngine") {
+                    // Whether the table resolves depends on labels elsewhere
+                    auto table = jumpTableByLine.find(instruction->lineNumber);
+                    bool resolved = table != jumpTableByLine.end() && table->second.resolved;
+                    hash = hashField(hash, resolved ? "table" : "");
+                }
+                if (instruction && options.flagMode == FLAGS_EXPLICIT) {
+                    // Liveness comes from other blocks, so it is part of this one's input
+                    char live = static_cast<char>(liveFlagsAfter[instruction - instructions.data()]);
+                    hash = hashField(hash, std::string_view(&live, 1));
+                }
+            }
+        }
+        return hash;
+    }
+    
+    // Writes one label block, rendering it only when the cache has no
+    // block built from the same input, and numbers its return indices
+    void emitLabelBlock(std::ostream& file, std::string_view labelName,
+                        const std::vector<const ProgramFlowItem*>& items,
+                        std::unordered_map<uint64_t, std::string>& usedBlocks) {
+        uint64_t hash = hashLabelBlock(labelName, items);
+        blocksTotal++;
+        
+        auto used = usedBlocks.find(hash);
+        if (used == usedBlocks.end()) {
+            auto cached = blockCache.find(hash);
+            if (cached != blockCache.end()) {
+                used = usedBlocks.emplace(hash, std::move(cached->second)).first;
+                blockCache.erase(cached);
+            } else {
+                std::ostringstream block;
+                generateLabelCode(block, labelName, items);
+                used = usedBlocks.emplace(hash, block.str()).first;
+                blocksRendered++;
+            }
+        }
+        
+        const std::string& text = used->second;
+        size_t start = 0;
+        for (size_t marker = text.find(RETURN_INDEX_MARKER); marker != std::string::npos;
+             marker = text.find(RETURN_INDEX_MARKER, start)) {
+            file.write(text.data() + start, static_cast<std::streamsize>(marker - start));
+            file << returnLabelIndex++;
+            start = marker + 1;
+        }
+        file.write(text.data() + start, static_cast<std::streamsize>(text.size() - start));
     }
     
-    void generateLabelCode(std::ofstream& file, const std::string& labelName, 
-                          const std::vector<ProgramFlowItem>& items) {
+    void generateLabelCode(std::ostream& file, std::string_view labelName, 
+                          const std::vector<const ProgramFlowItem*>& items) {
         // Remove trailing colon from label name if present, then add it back for C++
-        std::string cleanLabelName = labelName;
+        std::string_view cleanLabelName = labelName;
         if (cleanLabelName.back() == ':') {
-            cleanLabelName = cleanLabelName.substr(0, cleanLabelName.length() - 1);
+            cleanLabelName.remove_suffix(1);
         }
         
         file << "\n" << cleanLabelName << ":";
         
         // Add comment if label has one
-        auto labelIt = std::find_if(labels.begin(), labels.end(),
-            [&cleanLabelName](const JsonLabel& l) { return l.name == cleanLabelName; });
-        if (labelIt != labels.end() && !labelIt->comment.empty()) {
-            file << " // " << labelIt->comment;
+        const JsonLabel* label = findLabel(cleanLabelName);
+        if (label && !label->comment.empty()) {
+            file << " // " << label->comment;
         }
         file << "\n";
         
-        for (const auto& item : items) {
+        for (const ProgramFlowItem* itemPtr : items) {
+            const ProgramFlowItem& item = *itemPtr;
             if (item.type == "instruction") {
                 // Find the instruction details
-                auto instIt = std::find_if(instructions.begin(), instructions.end(),
-                    [&item](const JsonInstruction& inst) { 
-                        return inst.lineNumber == item.lineNumber; 
-                    });
+                const JsonInstruction* instruction = findInstruction(item.lineNumber);
                 
-                if (instIt != instructions.end()) {
-                    file << "    " << translateInstruction(*instIt);
+                if (instruction) {
+                    lineBuffer.clear();
+                    if (options.flagMode == FLAGS_EXPLICIT) {
+                        translateInstructionExplicit(*instruction, liveFlagsAfter[instruction - instructions.data()],
+                                                     lineBuffer);
+                    } else if (options.flagMode == FLAGS_LAZY) {
+                        translateInstructionExplicit(*instruction, isa6502::FLAGS_NZCV, lineBuffer);
+                    } else {
+                        translateInstruction(*instruction, lineBuffer);
+                    }
+                    file << "    " << lineBuffer;
                     if (!item.comment.empty()) {
                         file << " // " << item.comment;
                     }
                     file << "\n";
                     
                     // Add separator after RTS
-                    if (instIt->mnemonic == "rts") {
+                    if (instruction->mnemonic == "rts") {
                         file << "\n//------------------------------------------------------------------------\n";
                     }
                 }
@@ -634,99 +1902,565 @@ private:
         }
     }
     
-    void generateDataFiles(const std::string& outputDir) {
+    // Data layout: every data line owned by a label, in program order,
+    // packed from DATA_STORAGE_BASE, or with a symbol map (loadSymbols) at
+    // its label's address and in address order. Bytes take one byte per value and a
+    // string one per character, .dw/.word/.addr two little-endian bytes,
+    // .dbyte two big-endian bytes, .res its count of fill bytes, and .align
+    // pads with zeros. The tables after jsr JumpEngine belong to the code.
+    static constexpr int DATA_STORAGE_BASE = 0x8000;
+    
+    struct DataLine {
+        const JsonData* record;     // null for .align padding
+        size_t offset;              // into DataLayout::bytes
+        size_t size;
+    };
+    
+    // Consecutive data lines owned by one label
+    struct DataTable {
+        std::string_view name;
+        int address;
+        size_t size;
+        std::vector<DataLine> lines;
+    };
+    
+    struct DataLayout {
+        std::vector<DataTable> tables;
+        std::vector<uint8_t> bytes;         // the ROM from DATA_STORAGE_BASE
+        std::vector<char> resolved;         // per byte: folded to a number
+        size_t unresolvedValues = 0;
+    };
+    
+    enum DataWidth {
+        DATA_BYTE,
+        DATA_WORD,
+        DATA_WORD_BIG_ENDIAN,
+        DATA_RESERVE
+    };
+    
+    static DataWidth dataWidth(std::string_view directive) {
+        if (directive == ".dw" || directive == ".word" || directive == ".addr") return DATA_WORD;
+        if (directive == ".dbyte") return DATA_WORD_BIG_ENDIAN;
+        if (directive == ".res") return DATA_RESERVE;
+        return DATA_BYTE;
+    }
+    
+    static bool isStringValue(std::string_view value) {
+        return value.size() >= 2 && value.front() == '"' && value.back() == '"';
+    }
+    
+    // Calls emit for every character of a string value
+    template <typename Emit>
+    static void forEachStringByte(std::string_view value, Emit emit) {
+        for (size_t i = 1; i + 1 < value.size(); ++i) {
+            if (value[i] == '\\' && i + 2 < value.size()) i++;
+            emit(static_cast<uint8_t>(value[i]));
+        }
+    }
+    
+    // Bytes of one data line; sizes never depend on label values, only on
+    // constants, so the first pass can place every table
+    size_t dataLineSize(const JsonData& record) {
+        switch (dataWidth(record.directive)) {
+            case DATA_WORD:
+            case DATA_WORD_BIG_ENDIAN:
+                return record.values.size() * 2;
+            case DATA_RESERVE: {
+                int32_t count;
+                if (record.values.empty() || !evaluator.evaluate(record.values[0], count) || count < 0) {
+                    throw std::runtime_error("Cannot size .res on line " + std::to_string(record.lineNumber));
+                }
+                return static_cast<size_t>(count);
+            }
+            default: {
+                size_t size = 0;
+                for (std::string_view value : record.values) {
+                    if (isStringValue(value)) forEachStringByte(value, [&](uint8_t) { size++; });
+                    else size++;
+                }
+                return size;
+            }
+        }
+    }
+    
+    DataLayout layoutData() {
+        DataLayout layout;
+        
+        std::unordered_map<int, const JsonDirective*> directiveByLine;
+        for (const auto& directive : directives) {
+            directiveByLine.emplace(directive.lineNumber, &directive);
+        }
+        std::unordered_map<int, char> codeTableLines;
+        for (const auto& table : jumpTableByLine) {
+            for (int line : table.second.lines) codeTableLines.emplace(line, 1);
+        }
+        
+        // Pass 1: tables, lines and addresses. A symbol map only knows where
+        // labels are, so there a table's data must follow its label with no
+        // code or .org in between.
+        bool placed = !symbolAddresses.empty();
+        size_t offset = 0;      // of the next line from DATA_STORAGE_BASE
+        size_t size = 0;
+        std::string_view owner = "UnknownData";
+        bool tableOpen = false;
+        bool followsLabel = false;
+        for (const auto& item : programFlow) {
+            if (item.type == "label") {
+                owner = item.content;
+                if (!owner.empty() && owner.back() == ':') owner.remove_suffix(1);
+                tableOpen = false;
+                followsLabel = true;
+                continue;
+            }
+            if (item.type == "directive") {
+                auto directive = directiveByLine.find(item.lineNumber);
+                if (placed && directive != directiveByLine.end() && directive->second->name == ".org") {
+                    tableOpen = false;
+                    followsLabel = false;
+                }
+                int32_t alignment;
+                if (directive != directiveByLine.end() && directive->second->name == ".align" &&
+                    evaluator.evaluate(directive->second->operand, alignment) && alignment > 1) {
+                    size_t padding = (alignment - (DATA_STORAGE_BASE + offset) % alignment) % alignment;
+                    if (tableOpen && padding > 0) {
+                        layout.tables.back().lines.push_back(DataLine{nullptr, offset, padding});
+                        layout.tables.back().size += padding;
+                    }
+                    offset += padding;
+                    size = std::max(size, offset);
+                }
+                continue;
+            }
+            if (item.type == "instruction") followsLabel = false;
+            if (item.type != "data" || codeTableLines.count(item.lineNumber)) continue;
+            const JsonData* record = findData(item.lineNumber);
+            if (!record) continue;
+            
+            if (!tableOpen) {
+                if (placed) {
+                    auto symbol = symbolAddresses.find(std::string(owner));
+                    if (symbol == symbolAddresses.end() || !followsLabel || symbol->second < DATA_STORAGE_BASE) {
+                        throw std::runtime_error("Cannot place the data on line " + std::to_string(record->lineNumber) +
+                                                 " from the symbol map: it does not directly follow a ROM label");
+                    }
+                    offset = static_cast<size_t>(symbol->second - DATA_STORAGE_BASE);
+                }
+                layout.tables.push_back(DataTable{owner, DATA_STORAGE_BASE + static_cast<int>(offset), 0, {}});
+                tableOpen = true;
+            }
+            size_t lineSize = dataLineSize(*record);
+            layout.tables.back().lines.push_back(DataLine{record, offset, lineSize});
+            layout.tables.back().size += lineSize;
+            offset += lineSize;
+            size = std::max(size, offset);
+        }
+        
+        if (placed) {
+            std::stable_sort(layout.tables.begin(), layout.tables.end(), [](const DataTable& a, const DataTable& b) {
+                return a.address < b.address;
+            });
+            for (size_t i = 1; i < layout.tables.size(); ++i) {
+                const DataTable& previous = layout.tables[i - 1];
+                if (layout.tables[i].address < previous.address + static_cast<int>(previous.size)) {
+                    throw std::runtime_error("Data tables " + std::string(previous.name) + " and " +
+                                             std::string(layout.tables[i].name) + " overlap in the symbol map");
+                }
+            }
+        }
+        
+        // Pass 2: values, with every table name folding to its address, and
+        // with a symbol map every other label too; the copy leaves the
+        // evaluator code generation uses alone
+        ConstantEvaluator values = evaluator;
+        std::vector<std::string> addresses;
+        addresses.reserve(layout.tables.size() + symbolAddresses.size());
+        for (const auto& symbol : symbolAddresses) {
+            addresses.push_back(std::to_string(symbol.second));
+            values.define(symbol.first, addresses.back());
+        }
+        for (const DataTable& table : layout.tables) {
+            addresses.push_back(std::to_string(table.address));
+            values.define(table.name, addresses.back());
+        }
+        
+        layout.bytes.assign(size, 0);
+        layout.resolved.assign(size, 1);
+        for (const DataTable& table : layout.tables) {
+            for (const DataLine& line : table.lines) {
+                if (!line.record) continue;
+                size_t offset = line.offset;
+                DataWidth width = dataWidth(line.record->directive);
+                
+                if (width == DATA_RESERVE) {
+                    int32_t fill = 0;
+                    if (line.record->values.size() > 1 && !values.evaluate(line.record->values[1], fill)) {
+                        std::fill_n(layout.resolved.begin() + offset, line.size, 0);
+                        layout.unresolvedValues++;
+                    }
+                    std::fill_n(layout.bytes.begin() + offset, line.size, static_cast<uint8_t>(fill));
+                    continue;
+                }
+                
+                for (std::string_view value : line.record->values) {
+                    if (width == DATA_BYTE && isStringValue(value)) {
+                        forEachStringByte(value, [&](uint8_t byte) { layout.bytes[offset++] = byte; });
+                        continue;
+                    }
+                    
+                    int32_t folded = 0;
+                    size_t valueSize = width == DATA_BYTE ? 1 : 2;
+                    if (!values.evaluate(value, folded)) {
+                        std::fill_n(layout.resolved.begin() + offset, valueSize, 0);
+                        layout.unresolvedValues++;
+                        folded = 0;
+                    }
+                    uint8_t low = static_cast<uint8_t>(folded);
+                    uint8_t high = static_cast<uint8_t>(folded >> 8);
+                    if (width == DATA_BYTE) {
+                        layout.bytes[offset++] = low;
+                    } else {
+                        layout.bytes[offset++] = width == DATA_WORD ? low : high;
+                        layout.bytes[offset++] = width == DATA_WORD ? high : low;
+                    }
+                }
+            }
+        }
+        
+        if (stats) {
+            stats->addCount("Data layout", "tables", layout.tables.size());
+            stats->addCount("Data layout", "bytes", layout.bytes.size());
+            stats->addCount("Data layout", "unresolved values", layout.unresolvedValues);
+        }
+        return layout;
+    }
+    
+    // Appends bytes as hex literals separated by ", "
+    static void appendHexBytes(const uint8_t* bytes, size_t count, std::string& out) {
+        static const char digits[] = "0123456789ABCDEF";
+        for (size_t i = 0; i < count; ++i) {
+            out += i == 0 ? "0x" : ", 0x";
+            out += digits[bytes[i] >> 4];
+            out += digits[bytes[i] & 0xF];
+        }
+    }
+    
+    // Appends the values of one line that did not fold, for a comment
+    static void appendUnresolvedNote(const DataLayout& layout, const DataLine& line, std::string& out) {
+        if (!line.record || std::all_of(layout.resolved.begin() + line.offset,
+                                        layout.resolved.begin() + line.offset + line.size,
+                                        [](char resolved) { return resolved != 0; })) {
+            return;
+        }
+        out += " /* unresolved:";
+        for (size_t i = 0; i < line.record->values.size(); ++i) {
+            out += i == 0 ? " " : ", ";
+            out += line.record->values[i];
+        }
+        out += " */";
+    }
+    
+    void generateDataFiles(OutputFiles& files) {
+        DataLayout layout = layoutData();
+        int endAddress = DATA_STORAGE_BASE + static_cast<int>(layout.bytes.size());
+        
         // Generate data pointers header
-        std::ofstream headerFile(outputDir + "/SMBDataPointers.hpp");
+        std::ostringstream headerFile;
         headerFile << "// This is an automatically generated file.\n";
         headerFile << "// Do not edit directly.\n//\n";
         headerFile << "#ifndef SMBDATAPOINTERS_HPP\n";
         headerFile << "#define SMBDATAPOINTERS_HPP\n\n";
         
+        // SMB.cpp uses the bare table names, which are goto labels there
+        // too, so the engine declares them, e.g. as members initialized
+        // from dataPointers, rather than defining them as macros
+        headerFile << "// SMB_DATA_TABLES(TABLE) calls TABLE(name) for every data table\n";
+        headerFile << "#define SMB_DATA_TABLES(TABLE)";
+        for (const DataTable& table : layout.tables) {
+            headerFile << " \\\n    TABLE(" << table.name << ")";
+        }
+        headerFile << "\n\n";
+        
         headerFile << "struct SMBDataPointers\n{\n";
         
+        std::ostringstream addressDefaults;
+        addressDefaults << "    SMBDataPointers()\n    {\n";
+        
+        for (const DataTable& table : layout.tables) {
+            headerFile << "    uint16_t " << table.name << "_ptr;\n";
+            addressDefaults << "        this->" << table.name << "_ptr = 0x" 
+                           << std::hex << table.address << std::dec << ";\n";
+        }
+        
+        // 0 when tables placed from a symbol map run up to $FFFF
+        headerFile << "    uint16_t freeSpaceAddress;\n";
+        addressDefaults << "        this->freeSpaceAddress = 0x" << std::hex 
+                       << (endAddress & 0xFFFF) << std::dec << ";\n";
+        addressDefaults << "    }\n";
+        
+        headerFile << "\n" << addressDefaults.str() << "};\n\n";
+        headerFile << "#endif // SMBDATAPOINTERS_HPP\n";
+        files.emplace_back("SMBDataPointers.hpp", headerFile.str());
+        
+        // The same bytes as a flat binary, for tools and engines that load it
+        files.emplace_back("SMBRom.bin", std::string(layout.bytes.begin(), layout.bytes.end()));
+        
+        if (options.romImage) {
+            generateRomImage(files, layout, endAddress);
+            return;
+        }
+        
         // Generate data loading code
-        std::ofstream dataFile(outputDir + "/SMBData.cpp");
+        std::ostringstream dataFile;
         dataFile << "// This is an automatically generated file.\n";
         dataFile << "// Do not edit directly.\n//\n";
         dataFile << "#include \"SMB.hpp\"\n\n";
         dataFile << "void SMBEngine::loadConstantData()\n{\n";
         
-        std::ostringstream addressDefaults;
-        addressDefaults << "    SMBDataPointers()\n    {\n";
-        
-        int storageAddress = 0x8000;
-        
-        // Process data sections
-        for (const auto& dataItem : data) {
-            if (dataItem.directive == ".db" || dataItem.directive == ".byte") {
-                // Find corresponding label
-                std::string labelName = "UnknownData";
-                for (const auto& item : programFlow) {
-                    if (item.lineNumber == dataItem.lineNumber && 
-                        item.lineNumber > 0) {
-                        // Look backwards for the label
-                        for (auto it = programFlow.rbegin(); it != programFlow.rend(); ++it) {
-                            if (it->lineNumber < dataItem.lineNumber && it->type == "label") {
-                                labelName = it->content;
-                                break;
-                            }
+        for (const DataTable& table : layout.tables) {
+            // Generate data array, one source line per row. Byte values
+            // keep their expressions; everything else is the laid-out bytes.
+            dataFile << "    // " << table.name << "\n";
+            dataFile << "    const uint8_t " << table.name << "_data[] = {\n        ";
+            
+            bool first = true;
+            for (const DataLine& line : table.lines) {
+                if (line.size == 0) continue;
+                lineBuffer.clear();
+                if (!first) lineBuffer += ",\n        ";
+                first = false;
+                
+                if (line.record && dataWidth(line.record->directive) == DATA_BYTE) {
+                    for (size_t i = 0; i < line.record->values.size(); ++i) {
+                        if (i > 0) lineBuffer += ", ";
+                        std::string_view value = line.record->values[i];
+                        if (isStringValue(value)) {
+                            std::vector<uint8_t> characters;
+                            forEachStringByte(value, [&](uint8_t byte) { characters.push_back(byte); });
+                            appendHexBytes(characters.data(), characters.size(), lineBuffer);
+                        } else {
+                            translateExpression(value, lineBuffer);
                         }
-                        break;
                     }
+                } else {
+                    appendHexBytes(layout.bytes.data() + line.offset, line.size, lineBuffer);
+                    appendUnresolvedNote(layout, line, lineBuffer);
                 }
-                
-                // Remove trailing colon
-                if (labelName.back() == ':') {
-                    labelName = labelName.substr(0, labelName.length() - 1);
-                }
-                
-                // Generate data array
-                dataFile << "    // " << labelName << "\n";
-                dataFile << "    const uint8_t " << labelName << "_data[] = {\n        ";
-                
-                for (size_t i = 0; i < dataItem.values.size(); ++i) {
-                    if (i > 0) dataFile << ", ";
-                    dataFile << translateExpression(dataItem.values[i]);
-                }
-                
-                dataFile << "\n    };\n";
-                dataFile << "    writeData(" << labelName << ", " << labelName 
-                         << "_data, sizeof(" << labelName << "_data));\n\n";
-                
-                // Generate pointers
-                headerFile << "    uint16_t " << labelName << "_ptr;\n";
-                addressDefaults << "        this->" << labelName << "_ptr = 0x" 
-                               << std::hex << storageAddress << std::dec << ";\n";
-                
-                storageAddress += dataItem.values.size();
+                dataFile << lineBuffer;
             }
+            
+            dataFile << "\n    };\n";
+            dataFile << "    writeData(" << table.name << ", " << table.name 
+                     << "_data, sizeof(" << table.name << "_data));\n\n";
         }
         
-        headerFile << "    uint16_t freeSpaceAddress;\n";
-        addressDefaults << "        this->freeSpaceAddress = 0x" << std::hex 
-                       << storageAddress << std::dec << ";\n";
-        addressDefaults << "    }\n";
-        
-        headerFile << "\n" << addressDefaults.str() << "};\n\n";
-        headerFile << "#endif // SMBDATAPOINTERS_HPP\n";
+        dataFile << "}\n";
+        files.emplace_back("SMBData.cpp", dataFile.str());
+    }
+    
+    // --rom-image: the data layout as one constexpr byte array, which the
+    // engine maps as its ROM instead of copying every table at startup.
+    // Values that do not fold are zero and flagged in a comment.
+    void generateRomImage(OutputFiles& files, const DataLayout& layout, int endAddress) {
+        std::ostringstream image;
+        image << "// This is an automatically generated file.\n";
+        image << "// Do not edit directly.\n//\n";
+        image << "#ifndef SMBROMIMAGE_HPP\n";
+        image << "#define SMBROMIMAGE_HPP\n\n";
+        image << "#include <cstddef>\n#include <cstdint>\n\n";
+        image << "// Every data table at its SMBDataPointers address. The engine serves\n";
+        image << "// reads of SMB_ROM_IMAGE_BASE and up from this array.\n";
+        image << "constexpr uint16_t SMB_ROM_IMAGE_BASE = 0x" << std::hex << DATA_STORAGE_BASE << std::dec << ";\n";
+        image << "constexpr size_t SMB_ROM_IMAGE_SIZE = " << endAddress - DATA_STORAGE_BASE << ";\n\n";
+        image << "alignas(64) inline constexpr uint8_t smbRomImage[SMB_ROM_IMAGE_SIZE > 0 ? SMB_ROM_IMAGE_SIZE : 1] = {\n";
+        
+        size_t next = 0;
+        for (const DataTable& table : layout.tables) {
+            if (static_cast<size_t>(table.address - DATA_STORAGE_BASE) > next) {
+                // .align padding before the table
+                lineBuffer.assign("    ");
+                size_t padding = table.address - DATA_STORAGE_BASE - next;
+                appendHexBytes(layout.bytes.data() + next, padding, lineBuffer);
+                image << lineBuffer << ",\n";
+            }
+            image << "    // " << table.name << " ($" << std::hex << std::uppercase << table.address
+                  << std::dec << std::nouppercase << ")\n";
+            for (const DataLine& line : table.lines) {
+                if (line.size == 0) continue;
+                lineBuffer.assign("    ");
+                appendHexBytes(layout.bytes.data() + line.offset, line.size, lineBuffer);
+                lineBuffer += ',';
+                appendUnresolvedNote(layout, line, lineBuffer);
+                image << lineBuffer << "\n";
+            }
+            next = table.address - DATA_STORAGE_BASE + table.size;
+        }
+        image << "};\n\n";
+        image << "#endif // SMBROMIMAGE_HPP\n";
+        files.emplace_back("SMBRomImage.hpp", image.str());
         
+        // code() still calls this at startup
+        std::ostringstream dataFile;
+        dataFile << "// This is an automatically generated file.\n";
+        dataFile << "// Do not edit directly.\n//\n";
+        dataFile << "#include \"SMB.hpp\"\n\n";
+        dataFile << "void SMBEngine::loadConstantData()\n{\n";
+        dataFile << "    // The tables are in smbRomImage (SMBRomImage.hpp)\n";
         dataFile << "}\n";
+        files.emplace_back("SMBData.cpp", dataFile.str());
     }
 };
 
+#ifndef SMB_TOOLS_NO_MAIN  // bench.cpp includes this file for the converter
+
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input.json> <output_directory>" << std::endl;
+    // --watch keeps running and regenerates whenever the input changes.
+    // --batch generates one directory per file named by a manifest or
+    // pattern, on -j N threads.
+    // --stats and --trace report phase timings as in convert.
+    // --no-direct-ram sends every memory operand through M() and writeData().
+    // --flags explicit computes only the flags later code reads and
+    // --flags lazy keeps them as the last result, both for an engine with
+    // plain register bytes (see FlagMode).
+    // --functions turns well-formed subroutines into member functions
+    // declared in SMBSubroutines.hpp.
+    // --threaded-returns makes rts an indirect goto to the call site, which
+    // needs pushReturnAddress(void*) and popReturnAddress() in the engine.
+    // --rom-image writes the data tables to SMBRomImage.hpp as one constexpr
+    // array for the engine to map as ROM.
+    // --cfg writes the program's basic blocks as Graphviz (.dot) or JSON.
+    // --symbols places the data tables at their addresses in the binary of
+    // convert --assemble, given the .sym file written next to it.
+    CodegenOptions codegenOptions;
+    int threadCount = 1;
+    bool watch = false;
+    bool batch = false;
+    bool printStats = false;
+    std::string traceName;
+    std::string cfgName;
+    std::string symbolsName;
+    std::vector<std::string> arguments;
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string option = argv[argi];
+        if (option == "-j" && argi + 1 < argc) {
+            threadCount = std::atoi(argv[++argi]);
+        } else if (option == "--watch") {
+            watch = true;
+        } else if (option == "--batch") {
+            batch = true;
+        } else if (option == "--no-direct-ram") {
+            codegenOptions.directRamAccess = false;
+        } else if (option == "--flags" && argi + 1 < argc) {
+            std::string mode = argv[++argi];
+            if (mode == "runtime") {
+                codegenOptions.flagMode = FLAGS_RUNTIME;
+            } else if (mode == "explicit") {
+                codegenOptions.flagMode = FLAGS_EXPLICIT;
+            } else if (mode == "lazy") {
+                codegenOptions.flagMode = FLAGS_LAZY;
+            } else {
+                std::cerr << "Error: unknown flag mode " << mode << " (runtime, explicit or lazy)" << std::endl;
+                return 1;
+            }
+        } else if (option == "--functions") {
+            codegenOptions.subroutineFunctions = true;
+        } else if (option == "--threaded-returns") {
+            codegenOptions.threadedReturns = true;
+        } else if (option == "--rom-image") {
+            codegenOptions.romImage = true;
+        } else if (option == "--cfg" && argi + 1 < argc) {
+            cfgName = argv[++argi];
+        } else if (option == "--symbols" && argi + 1 < argc) {
+            symbolsName = argv[++argi];
+        } else if (option == "--stats") {
+            printStats = true;
+        } else if (option == "--trace" && argi + 1 < argc) {
+            traceName = argv[++argi];
+        } else {
+            arguments.push_back(option);
+        }
+    }
+    
+    bool validArguments = batch ? !watch && cfgName.empty() && symbolsName.empty() && (arguments.size() == 1 || arguments.size() == 2)
+                                : arguments.size() == 2;
+    if (!validArguments) {
+        std::cerr << "Usage: " << argv[0] << " [options] [--watch] <input.json|input.6502ir> <output_directory>" << std::endl;
+        std::cerr << "       " << argv[0] << " [options] [-j threads] --batch <manifest|pattern> [output_directory]" << std::endl;
+        std::cerr << "Options: --no-direct-ram, --flags runtime|explicit|lazy, --functions, --threaded-returns, --rom-image, --stats, --trace trace.json" << std::endl;
+        std::cerr << "         --cfg graph.dot|graph.json, --symbols image.sym (not with --batch)" << std::endl;
         std::cerr << "Converts JSON assembly format to C++ code" << std::endl;
         return 1;
     }
     
+    RunStats stats;
+    RunStats* runStats = printStats || !traceName.empty() ? &stats : nullptr;
+    if (!traceName.empty()) {
+        stats.enableTrace();
+    }
+    auto reportStats = [&]() {
+        if (printStats) stats.print(std::cerr);
+        if (!traceName.empty()) stats.writeTrace(traceName);
+    };
+    
+    if (batch) {
+        try {
+            std::vector<BatchJob> jobs = loadBatchJobs(arguments[0], arguments.size() > 1 ? arguments[1] : "", "");
+            WorkStealingPool pool(threadCount);
+            std::vector<JsonToCppConverter> converters(static_cast<size_t>(pool.size()));
+            for (auto& converter : converters) {
+                converter.setStats(runStats);
+                converter.setCodegenOptions(codegenOptions);
+            }
+            int failures = runBatch(jobs, pool, [&](const BatchJob& job, int worker) {
+                JsonToCppConverter& converter = converters[worker];
+                converter.reset();
+                converter.parseJsonFile(job.input);
+                converter.generateCppFiles(job.output);
+            });
+            reportStats();
+            return failures == 0 ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    std::string inputName = arguments[0];
+    std::string outputDir = arguments[1];
+    
     try {
         JsonToCppConverter converter;
-        converter.parseJsonFile(argv[1]);
-        converter.generateCppFiles(argv[2]);
+        converter.setStats(runStats);
+        converter.setCodegenOptions(codegenOptions);
+        if (!symbolsName.empty()) {
+            converter.loadSymbols(symbolsName);
+        }
+        
+        if (watch) {
+            watchFile(inputName, [&]() {
+                converter.reset();
+                converter.parseJsonFile(inputName);
+                converter.generateCppFiles(outputDir);
+                if (!cfgName.empty()) converter.writeControlFlowGraph(cfgName);
+                std::cout << "Rendered " << converter.renderedBlockCount() << " of "
+                          << converter.blockCount() << " label blocks into " << outputDir << std::endl;
+                reportStats();
+                stats.clear();
+            });
+        }
         
-        std::cout << "Successfully converted " << argv[1] << " to C++ in " << argv[2] << std::endl;
+        converter.parseJsonFile(inputName);
+        converter.generateCppFiles(outputDir);
+        if (!cfgName.empty()) {
+            converter.writeControlFlowGraph(cfgName);
+        }
+        
+        std::cout << "Generated C++ files in " << outputDir << ":" << std::endl;
+        std::cout << "  SMB.cpp" << std::endl;
+        std::cout << "  SMBData.cpp" << std::endl;
+        std::cout << "  SMBDataPointers.hpp" << std::endl;
+        std::cout << "  SMBConstants.hpp" << std::endl;
+        std::cout << "Successfully converted " << inputName << " to C++ in " << outputDir << std::endl;
+        reportStats();
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -735,3 +2469,5 @@ int main(int argc, char* argv[]) {
     
     return 0;
 }
+
+#endif // SMB_TOOLS_NO_MAIN
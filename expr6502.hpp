@@ -0,0 +1,228 @@
+// Constant expression evaluation for ca65 operands.
+//
+// ConstantEvaluator folds an operand such as "Player_X_Position+1" or
+// "$0700 | %0101" to a number, looking names up in the constant
+// definitions of the listing. Anything that depends on a label, the
+// program counter or an unknown name does not fold.
+//
+#ifndef EXPR6502_HPP
+#define EXPR6502_HPP
+
+#include <cctype>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+class ConstantEvaluator {
+private:
+    enum NameState {
+        RESOLVING,      // on the evaluation stack; seeing it again is a cycle
+        RESOLVED,
+        UNRESOLVED
+    };
+    
+    struct CachedName {
+        NameState state;
+        int32_t value;
+    };
+    
+    std::unordered_map<std::string_view, std::string_view> definitions;
+    std::unordered_map<std::string_view, CachedName> cache;
+    
+    // Recursive descent over one expression with ca65's precedence: unary
+    // operators (including < and > for the low and high byte), then
+    // * / & ^ << >>, then + - |.
+    class Parser {
+    private:
+        ConstantEvaluator& owner;
+        std::string_view text;
+        size_t pos = 0;
+        bool failed = false;
+        
+        void skipSpaces() {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+        }
+        
+        bool accept(char c) {
+            skipSpaces();
+            if (pos < text.size() && text[pos] == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+        
+        bool acceptPair(char first, char second) {
+            skipSpaces();
+            if (pos + 1 < text.size() && text[pos] == first && text[pos + 1] == second) {
+                pos += 2;
+                return true;
+            }
+            return false;
+        }
+        
+        // Arithmetic wraps at 32 bits like ca65's instead of overflowing
+        static int32_t wrap(uint32_t value) {
+            return static_cast<int32_t>(value);
+        }
+        
+        static bool isNameChar(char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '@' || c == '.';
+        }
+        
+        // Literals are 32 bits wide in ca65; a longer one does not fold
+        int32_t number(int base) {
+            size_t start = pos;
+            int64_t value = 0;
+            while (pos < text.size()) {
+                int digit;
+                char c = static_cast<char>(std::tolower(static_cast<unsigned char>(text[pos])));
+                if (c >= '0' && c <= '9') digit = c - '0';
+                else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                else break;
+                if (digit >= base) break;
+                if (!failed) value = value * base + digit;
+                if (value > UINT32_MAX) failed = true;
+                pos++;
+            }
+            if (pos == start) failed = true;
+            return static_cast<int32_t>(static_cast<uint32_t>(value));
+        }
+        
+        int32_t primary() {
+            skipSpaces();
+            if (pos >= text.size()) {
+                failed = true;
+                return 0;
+            }
+            
+            char c = text[pos];
+            if (c == '(') {
+                pos++;
+                int32_t value = sum();
+                if (!accept(')')) failed = true;
+                return value;
+            }
+            if (c == '$') {
+                pos++;
+                return number(16);
+            }
+            if (c == '%') {
+                pos++;
+                return number(2);
+            }
+            if (std::isdigit(static_cast<unsigned char>(c))) {
+                return number(10);
+            }
+            if (c == '\'' && pos + 2 < text.size() && text[pos + 2] == '\'') {
+                pos += 3;
+                return static_cast<unsigned char>(text[pos - 2]);
+            }
+            if (isNameChar(c) && !std::isdigit(static_cast<unsigned char>(c))) {
+                size_t start = pos;
+                while (pos < text.size() && isNameChar(text[pos])) pos++;
+                int32_t value = 0;
+                if (!owner.resolveName(text.substr(start, pos - start), value)) failed = true;
+                return value;
+            }
+            
+            // '*' for the program counter, string literals and the rest
+            failed = true;
+            return 0;
+        }
+        
+        int32_t unary() {
+            if (accept('-')) return wrap(0u - static_cast<uint32_t>(unary()));
+            if (accept('+')) return unary();
+            if (accept('~')) return ~unary();
+            if (accept('<')) return unary() & 0xFF;
+            if (accept('>')) return (unary() >> 8) & 0xFF;
+            if (accept('^')) return (unary() >> 16) & 0xFF;
+            return primary();
+        }
+        
+        int32_t product() {
+            int32_t value = unary();
+            while (!failed) {
+                if (acceptPair('<', '<')) {
+                    value = wrap(static_cast<uint32_t>(value) << (unary() & 31));
+                } else if (acceptPair('>', '>')) {
+                    value >>= unary() & 31;
+                } else if (accept('*')) {
+                    value = wrap(static_cast<uint32_t>(value) * static_cast<uint32_t>(unary()));
+                } else if (accept('/')) {
+                    int32_t divisor = unary();
+                    if (divisor == 0 || (divisor == -1 && value == INT32_MIN)) failed = true;
+                    else value /= divisor;
+                } else if (accept('&')) {
+                    value &= unary();
+                } else if (accept('^')) {
+                    value ^= unary();
+                } else {
+                    break;
+                }
+            }
+            return value;
+        }
+        
+        int32_t sum() {
+            int32_t value = product();
+            while (!failed) {
+                if (accept('+')) value = wrap(static_cast<uint32_t>(value) + static_cast<uint32_t>(product()));
+                else if (accept('-')) value = wrap(static_cast<uint32_t>(value) - static_cast<uint32_t>(product()));
+                else if (accept('|')) value |= product();
+                else break;
+            }
+            return value;
+        }
+    
+    public:
+        Parser(ConstantEvaluator& evaluator, std::string_view expression)
+            : owner(evaluator), text(expression) {}
+        
+        bool parse(int32_t& value) {
+            value = sum();
+            skipSpaces();
+            return !failed && pos == text.size();
+        }
+    };
+    
+    bool resolveName(std::string_view name, int32_t& value) {
+        auto cached = cache.find(name);
+        if (cached != cache.end()) {
+            value = cached->second.value;
+            return cached->second.state == RESOLVED;
+        }
+        
+        auto definition = definitions.find(name);
+        if (definition == definitions.end()) {
+            return false;
+        }
+        
+        cache[name] = CachedName{RESOLVING, 0};
+        bool resolved = Parser(*this, definition->second).parse(value);
+        cache[name] = CachedName{resolved ? RESOLVED : UNRESOLVED, value};
+        return resolved;
+    }
+
+public:
+    // Forgets all definitions. The views passed to define must stay valid
+    // until then.
+    void clear() {
+        definitions.clear();
+        cache.clear();
+    }
+    
+    // Defines name as expression; a later definition replaces an earlier one
+    void define(std::string_view name, std::string_view expression) {
+        definitions[name] = expression;
+        cache.clear();
+    }
+    
+    // Folds expression to a number; false when it does not fold
+    bool evaluate(std::string_view expression, int32_t& value) {
+        return Parser(*this, expression).parse(value);
+    }
+};
+
+#endif // EXPR6502_HPP
@@ -0,0 +1,172 @@
+// The SMBEngine that harness.cpp runs generated code in.
+//
+// It provides what createcpp's --flags explicit and --flags lazy code
+// calls: the register bytes, ram[], readData()/writeData(), the stack
+// helpers and the return stacks of JSR() and --threaded-returns. Code
+// built with --flags lazy needs -DSMB_FLAGS_LAZY, and code built with
+// --rom-image needs -DSMB_ROM_IMAGE.
+//
+// The PPU, APU and controller registers are a stand-in: a read returns
+// the next value of a byte sequence that every write perturbs. That is
+// deterministic, so two engines that see the same accesses return the
+// same values, and it runs through every value, so polling loops end.
+//
+#ifndef SMB_HPP
+#define SMB_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "SMBConstants.hpp"
+#include "SMBDataPointers.hpp"
+#ifdef SMB_ROM_IMAGE
+#include "SMBRomImage.hpp"
+#endif
+
+// %01010101 in the listing becomes BOOST_BINARY(01010101)
+constexpr int smbBinary(const char* digits) {
+    int value = 0;
+    for (; *digits; ++digits) value = value * 2 + (*digits == '1');
+    return value;
+}
+#define BOOST_BINARY(bits) smbBinary(#bits)
+
+// jsr outside --threaded-returns: push the call site's index for the
+// Return switch and jump
+#define JSR(subroutine, index) do { pushReturnIndex(index); goto subroutine; Return_##index: ; } while (0)
+
+class SMBEngine {
+public:
+    SMBDataPointers dataPointers;
+    
+    // The table names SMB.cpp uses, at their SMBDataPointers addresses
+#define SMB_DATA_TABLE_MEMBER(name) const uint16_t name = dataPointers.name##_ptr;
+    SMB_DATA_TABLES(SMB_DATA_TABLE_MEMBER)
+#undef SMB_DATA_TABLE_MEMBER
+    
+    uint8_t ram[0x800] = {};
+    uint8_t registerA = 0;
+    uint8_t registerX = 0;
+    uint8_t registerY = 0;
+    uint8_t registerS = 0xFF;
+    bool c = false;
+    bool z = false;
+    bool n = false;
+    bool v = false;
+    uint16_t nzc = 0;
+    
+    // 0 runs reset, 1 the NMI handler
+    void code(int mode);
+    
+    uint8_t readData(uint16_t address) {
+        if (address < 0x2000) return ram[address & 0x7FF];
+        if (address >= ROM_BASE) {
+#ifdef SMB_ROM_IMAGE
+            size_t offset = address - SMB_ROM_IMAGE_BASE;
+            return address >= SMB_ROM_IMAGE_BASE && offset < SMB_ROM_IMAGE_SIZE ? smbRomImage[offset] : 0;
+#else
+            return rom[address - ROM_BASE];
+#endif
+        }
+        deviceValue = static_cast<uint8_t>(deviceValue * 5 + 1);
+        return deviceValue;
+    }
+    
+    void writeData(uint16_t address, uint8_t value) {
+        if (address < 0x2000) {
+            ram[address & 0x7FF] = value;
+        } else if (address < ROM_BASE) {
+            deviceValue ^= value;
+        }
+    }
+    
+    // loadConstantData() copies the tables in with this
+    void writeData(uint16_t address, const uint8_t* data, size_t size) {
+        if (address >= ROM_BASE && size <= static_cast<size_t>(0x10000 - address)) {
+            std::memcpy(rom + (address - ROM_BASE), data, size);
+        }
+    }
+    
+    // The little-endian pointer at address, wrapping in zero page like
+    // the 6502's (zp),y
+    uint16_t W(uint16_t address) {
+        uint16_t high = static_cast<uint16_t>((address & 0xFF00) | ((address + 1) & 0xFF));
+        return static_cast<uint16_t>(readData(address) | readData(high) << 8);
+    }
+    
+    void pha() {
+        ram[0x100 + registerS--] = registerA;
+    }
+    
+    void pla() {
+        registerA = ram[0x100 + ++registerS];
+#ifdef SMB_FLAGS_LAZY
+        nzc = static_cast<uint16_t>((nzc & 0x100) | registerA);
+#else
+        z = registerA == 0;
+        n = (registerA & 0x80) != 0;
+#endif
+    }
+    
+    // B and the unused bit read as set, as pushed by php
+    void php() {
+#ifdef SMB_FLAGS_LAZY
+        bool negative = (nzc & 0x280) != 0;
+        bool zero = (nzc & 0xFF) == 0;
+        bool carry = (nzc & 0x100) != 0;
+#else
+        bool negative = n;
+        bool zero = z;
+        bool carry = c;
+#endif
+        ram[0x100 + registerS--] = static_cast<uint8_t>(negative << 7 | v << 6 | 0x30 | zero << 1 | carry);
+    }
+    
+    void plp() {
+        uint8_t p = ram[0x100 + ++registerS];
+        v = (p & 0x40) != 0;
+#ifdef SMB_FLAGS_LAZY
+        // A nonzero low byte clears Z; bit 9 sets N whatever the low byte
+        nzc = static_cast<uint16_t>((p & 0x01) << 8 | (p & 0x80) << 2 | ((p & 0x02) ? 0 : 1));
+#else
+        n = (p & 0x80) != 0;
+        z = (p & 0x02) != 0;
+        c = (p & 0x01) != 0;
+#endif
+    }
+
+#if __has_include("SMBSubroutines.hpp")
+#include "SMBSubroutines.hpp"
+#endif
+
+private:
+    static constexpr uint16_t ROM_BASE = 0x8000;
+    
+    uint8_t rom[0x8000] = {};
+    uint8_t deviceValue = 0;
+    int returnIndices[256];
+    void* returnAddresses[256];
+    uint8_t returnIndexTop = 0;
+    uint8_t returnAddressTop = 0;
+    
+    void loadConstantData();
+    
+    void pushReturnIndex(int index) {
+        returnIndices[returnIndexTop++] = index;
+    }
+    
+    int popReturnIndex() {
+        return returnIndices[--returnIndexTop];
+    }
+    
+    void pushReturnAddress(void* address) {
+        returnAddresses[returnAddressTop++] = address;
+    }
+    
+    void* popReturnAddress() {
+        return returnAddresses[--returnAddressTop];
+    }
+};
+
+#endif // SMB_HPP
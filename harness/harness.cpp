@@ -0,0 +1,78 @@
+// Runs a generated engine against the reference interpreter.
+//
+// Loads the binary convert --assemble wrote for a listing, runs reset and
+// then the requested number of NMIs both in the C++ createcpp generated
+// from the same listing and in cpu6502.hpp, and reports the first
+// difference in RAM or registers and the speed of both (harness6502.hpp).
+// It exits with 1 on a difference, so it can gate a codegen change.
+//
+// From the repository root, with the sample program in this directory:
+//
+//   g++ -std=c++17 -O2 -o convert convert.cpp
+//   g++ -std=c++17 -O2 -o createcpp createcpp.cpp
+//   ./convert --assemble harness/sample.asm sample.bin
+//   ./convert harness/sample.asm sample.json
+//   ./createcpp --flags explicit --symbols sample.bin.sym sample.json generated
+//   g++ -std=c++17 -O2 -I. -Iharness -Igenerated -o run-harness harness/harness.cpp generated/*.cpp
+//   ./run-harness sample.bin 100000
+//
+// --symbols puts the data tables where the binary has them, so table
+// addresses stored in RAM agree. For code generated with --flags lazy,
+// compile with -DSMB_FLAGS_LAZY, and with --rom-image, -DSMB_ROM_IMAGE
+// (see SMB.hpp). --functions and --threaded-returns need nothing more.
+//
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SMB.hpp"
+#include "harness6502.hpp"
+
+static std::vector<uint8_t> readImage(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open input file: " + filename);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char* argv[]) {
+    // --origin is where the binary starts, $8000 unless the listing's
+    // first .org says otherwise
+    int origin = 0x8000;
+    std::vector<std::string> arguments;
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string option = argv[argi];
+        if (option == "--origin" && argi + 1 < argc) {
+            std::string value = argv[++argi];
+            origin = static_cast<int>(std::strtol(value.c_str() + (value[0] == '$'), nullptr, 16));
+        } else {
+            arguments.push_back(option);
+        }
+    }
+    
+    if (arguments.empty() || arguments.size() > 2) {
+        std::cerr << "Usage: " << argv[0] << " [--origin $8000] <image.bin> [frames]" << std::endl;
+        std::cerr << "Compares the engine built into this program with the 6502 interpreter" << std::endl;
+        return 1;
+    }
+    int frames = arguments.size() > 1 ? std::atoi(arguments[1].c_str()) : 1000;
+    
+    try {
+        std::vector<uint8_t> image = readImage(arguments[0]);
+        auto translated = std::make_unique<SMBEngine>();
+        auto hardware = std::make_unique<SMBEngine>();
+        EngineHarness<SMBEngine> harness(*translated, *hardware, image, origin);
+        HarnessReport report = harness.run(frames);
+        report.print(std::cout);
+        return report.matched ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
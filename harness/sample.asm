@@ -0,0 +1,163 @@
+; Sample program for the engine harness (see harness.cpp).
+;
+; Reset clears RAM and fills a table; every NMI runs arithmetic, shifts,
+; branches and subroutine calls over it, and walks one of two messages
+; through a pointer in zero page, as SMB does with its area and enemy
+; data. The pointer only matches between the engine and the interpreter
+; when the data tables sit at their assembled addresses.
+
+FrameCounter = $09
+Sum = $10
+Product = $12
+Temp = $14
+MessagePtr = $18
+Seed = $16
+Buffer = $0300
+
+	.org $8000
+Start:
+	sei
+	cld
+	ldx #$FF
+	txs
+	lda #$00
+	sta FrameCounter
+	sta Sum
+	sta Sum+1
+	lda #$5A
+	sta Seed
+	ldx #$00
+ClearLoop:
+	sta Buffer,x
+	inx
+	bne ClearLoop
+	jsr InitTable
+	lda #$10
+EndlessLoop:
+	jmp EndlessLoop
+
+NonMaskableInterrupt:
+	lda $2002
+	sta $2005
+	inc FrameCounter
+	jsr Random
+	sta Temp
+	jsr Accumulate
+	jsr Multiply
+	lda FrameCounter
+	and #$07
+	tax
+	lda Squares,x
+	ldy FrameCounter
+	sta Buffer,y
+	jsr Rotate
+	jsr ReadMessage
+	ldx Temp
+	ldy Product
+	rti
+
+InitTable:
+	ldy #$07
+InitLoop:
+	lda Squares,y
+	eor #$FF
+	sta Buffer+128,y
+	dey
+	bpl InitLoop
+	rts
+
+Random:
+	lda Seed
+	asl
+	bcc NoEor
+	eor #$1D
+NoEor:
+	sta Seed
+	rts
+
+Accumulate:
+	clc
+	lda Sum
+	adc Temp
+	sta Sum
+	lda Sum+1
+	adc #$00
+	sta Sum+1
+	sec
+	lda Sum
+	sbc #$03
+	bvs Overflow
+	cmp #$80
+	bcs Overflow
+	rts
+Overflow:
+	lda #$00
+	sta Sum
+	rts
+
+Multiply:
+	lda #$00
+	sta Product
+	sta Product+1
+	ldx #$08
+	lda Temp
+	sta Temp+1
+MulLoop:
+	lsr Temp+1
+	bcc MulSkip
+	clc
+	lda Product+1
+	adc FrameCounter
+	sta Product+1
+MulSkip:
+	ror Product+1
+	ror Product
+	dex
+	bne MulLoop
+	rts
+
+Rotate:
+	ldx #$04
+RotLoop:
+	lda Buffer+128,x
+	rol
+	sta Buffer+128,x
+	bit Sum
+	bmi RotSkip
+	inc Buffer+144,x
+RotSkip:
+	dex
+	bne RotLoop
+	rts
+
+ReadMessage:
+	lda FrameCounter
+	and #$01
+	asl
+	tax
+	lda MessagePointers,x
+	sta MessagePtr
+	lda MessagePointers+1,x
+	sta MessagePtr+1
+	lda FrameCounter
+	and #$03
+	tay
+	lda (MessagePtr),y
+	sta Buffer+160,y
+	rts
+
+Squares:
+	.db $00, $01, $04, $09, $10, $19, $24, $31
+
+MessagePointers:
+	.dw MessageA, MessageB
+
+MessageA:
+	.db "NMI!"
+
+MessageB:
+	.db $12, $34, $56, $78
+
+	.org $FFFA
+Vectors:
+	.dw NonMaskableInterrupt, Start, Start
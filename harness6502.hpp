@@ -0,0 +1,194 @@
+// Differential and throughput harness for a generated engine.
+//
+// EngineHarness runs the C++ that createcpp generated and the reference
+// interpreter in cpu6502.hpp over the same program, frame by frame. After
+// reset and after every NMI it compares the interpreter's RAM and A, X
+// and Y with the engine's, and it times both sides, so one run is both
+// the correctness gate and the benchmark for a codegen change.
+//
+// The program image is what convert --assemble writes for the listing the
+// engine was generated from. The interpreter's RAM is its own; everything
+// else below the image -- PPU, APU and controller registers -- goes to a
+// second engine instance that only serves as hardware, so both sides see
+// the same devices without the harness emulating any of them.
+//
+// Engine must provide what the generated code already relies on:
+//
+//   void code(int mode);               // 0 runs reset, 1 runs the NMI handler
+//   uint8_t ram[0x800];
+//   uint8_t registerA, registerX, registerY;
+//   uint8_t readData(uint16_t address);
+//   void writeData(uint16_t address, uint8_t value);
+//
+// The stack page is left out of the comparison: jsr in generated code
+// does not push a return address to it. Table addresses stored in RAM
+// only agree when createcpp placed the data tables with --symbols and the
+// .sym file written next to the image. harness/harness.cpp is a driver.
+//
+#ifndef HARNESS6502_HPP
+#define HARNESS6502_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cpu6502.hpp"
+
+// The NES memory map as the interpreter sees it
+template <typename Engine>
+class NesBus {
+private:
+    uint8_t ram[0x800] = {};
+    const std::vector<uint8_t>& program;
+    int origin;
+    Engine& devices;
+
+public:
+    NesBus(const std::vector<uint8_t>& image, int imageOrigin, Engine& hardware)
+        : program(image), origin(imageOrigin), devices(hardware) {}
+    
+    uint8_t read(uint16_t address) {
+        if (address < 0x2000) return ram[address & 0x7FF];
+        if (address >= origin && static_cast<size_t>(address - origin) < program.size()) {
+            return program[address - origin];
+        }
+        return devices.readData(address);
+    }
+    
+    void write(uint16_t address, uint8_t value) {
+        if (address < 0x2000) {
+            ram[address & 0x7FF] = value;
+        } else if (address < origin) {
+            devices.writeData(address, value);
+        }
+    }
+    
+    const uint8_t* memory() const {
+        return ram;
+    }
+};
+
+struct HarnessReport {
+    int frames = 0;                 // NMIs run on both sides
+    bool matched = true;
+    int mismatchFrame = -1;         // -1 for the state after reset
+    int mismatchAddress = -1;       // RAM address, or -1 for a register
+    const char* mismatchRegister = nullptr;
+    int engineValue = 0;
+    int interpreterValue = 0;
+    uint64_t instructions = 0;      // executed by the interpreter
+    uint64_t cycles = 0;
+    double engineSeconds = 0;
+    double interpreterSeconds = 0;
+    
+    // Instructions per second for both sides; the engine is credited with
+    // the instructions the interpreter needed for the same frames
+    void print(std::ostream& out) const {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        
+        if (matched) {
+            out << "All " << frames << " frames match\n";
+        } else {
+            out << "Mismatch " << (mismatchFrame < 0 ? std::string("after reset")
+                                                     : "in frame " + std::to_string(mismatchFrame)) << ": ";
+            if (mismatchRegister) out << "register " << mismatchRegister;
+            else out << "RAM $" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << mismatchAddress;
+            out << std::hex << std::uppercase << std::setfill('0') << " engine $" << std::setw(2) << engineValue
+                << ", interpreter $" << std::setw(2) << interpreterValue << std::dec << std::setfill(' ') << "\n";
+        }
+        
+        out << std::fixed << std::setprecision(1);
+        out << instructions << " instructions, " << cycles << " cycles\n";
+        out << "Interpreter: " << interpreterSeconds * 1e3 << " ms, "
+            << instructions / std::max(interpreterSeconds, 1e-9) / 1e6 << " M instructions/s\n";
+        out << "Engine:      " << engineSeconds * 1e3 << " ms, "
+            << instructions / std::max(engineSeconds, 1e-9) / 1e6 << " M instructions/s ("
+            << interpreterSeconds / std::max(engineSeconds, 1e-9) << "x the interpreter)\n";
+        
+        out.flags(flags);
+        out.precision(precision);
+    }
+};
+
+template <typename Engine>
+class EngineHarness {
+private:
+    // Enough for any frame of a game; a handler that runs longer is stuck
+    static constexpr uint64_t INSTRUCTION_LIMIT = 10000000;
+    
+    Engine& engine;
+    NesBus<Engine> bus;
+    Cpu6502<NesBus<Engine>> cpu;
+    
+    // Records the first difference in report; false if there is one
+    bool compare(HarnessReport& report, int frame) {
+        auto mismatch = [&](int address, const char* reg, int engineValue, int interpreterValue) {
+            report.matched = false;
+            report.mismatchFrame = frame;
+            report.mismatchAddress = address;
+            report.mismatchRegister = reg;
+            report.engineValue = engineValue;
+            report.interpreterValue = interpreterValue;
+            return false;
+        };
+        
+        const uint8_t* memory = bus.memory();
+        for (int address = 0; address < 0x800; ++address) {
+            if (address >= 0x100 && address < 0x200) continue;
+            if (engine.ram[address] != memory[address]) {
+                return mismatch(address, nullptr, engine.ram[address], memory[address]);
+            }
+        }
+        
+        const auto& registers = cpu.registers();
+        if (engine.registerA != registers.a) return mismatch(-1, "A", engine.registerA, registers.a);
+        if (engine.registerX != registers.x) return mismatch(-1, "X", engine.registerX, registers.x);
+        if (engine.registerY != registers.y) return mismatch(-1, "Y", engine.registerY, registers.y);
+        return true;
+    }
+    
+    template <typename Run>
+    static double timed(Run run) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    // translated runs the generated code; hardware serves the
+    // interpreter's device registers and runs no code of its own
+    EngineHarness(Engine& translated, Engine& hardware, const std::vector<uint8_t>& image, int origin)
+        : engine(translated), bus(image, origin, hardware), cpu(bus) {}
+    
+    // Runs reset and then frames NMIs on both sides, stopping at the
+    // first difference
+    HarnessReport run(int frames) {
+        HarnessReport report;
+        
+        report.engineSeconds += timed([&]() { engine.code(0); });
+        report.interpreterSeconds += timed([&]() {
+            cpu.reset();
+            cpu.runUntilIdle(INSTRUCTION_LIMIT);
+        });
+        
+        if (compare(report, -1)) {
+            for (int frame = 0; frame < frames; ++frame) {
+                report.engineSeconds += timed([&]() { engine.code(1); });
+                report.interpreterSeconds += timed([&]() { cpu.runNmi(INSTRUCTION_LIMIT); });
+                report.frames++;
+                if (!compare(report, frame)) break;
+            }
+        }
+        
+        report.instructions = cpu.instructions();
+        report.cycles = cpu.cycles();
+        return report;
+    }
+};
+
+#endif // HARNESS6502_HPP
@@ -0,0 +1,189 @@
+// Per-run bump arena and string interning shared by the tools.
+//
+// Identifiers, mnemonics and comments read from a listing repeat heavily,
+// so each distinct string is copied into an arena once and handed out as a
+// std::string_view. Interned views of equal strings share the same bytes,
+// and every string also has a dense integer id. Nothing is freed until the
+// owner goes away or is reset.
+//
+#ifndef INTERN_HPP
+#define INTERN_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <vector>
+
+// 64-bit FNV-1a; pass a previous result as seed to hash several pieces
+inline uint64_t hashBytes(std::string_view text, uint64_t seed = 1469598103934665603ull) {
+    uint64_t hash = seed;
+    for (char c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+class Arena {
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    
+    std::vector<std::unique_ptr<char[]>> blocks;        // all BLOCK_SIZE bytes
+    std::vector<std::unique_ptr<char[]>> largeBlocks;   // one oversized request each
+    size_t currentBlock = 0;
+    char* cursor = nullptr;
+    size_t remaining = 0;
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        if (bytes + padding > remaining) {
+            // Oversized requests get a block of their own
+            if (bytes + alignment > BLOCK_SIZE / 4) {
+                largeBlocks.emplace_back(new char[bytes + alignment]);
+                char* block = largeBlocks.back().get();
+                return block + (alignment - reinterpret_cast<uintptr_t>(block) % alignment) % alignment;
+            }
+            
+            // Move on to the next block, reusing those kept by reset()
+            if (cursor != nullptr) {
+                currentBlock++;
+            }
+            if (currentBlock == blocks.size()) {
+                blocks.emplace_back(new char[BLOCK_SIZE]);
+            }
+            cursor = blocks[currentBlock].get();
+            remaining = BLOCK_SIZE;
+            padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+        char* result = cursor + padding;
+        cursor += padding + bytes;
+        remaining -= padding + bytes;
+        return result;
+    }
+    
+    std::string_view copy(std::string_view text) {
+        if (text.empty()) return std::string_view();
+        char* bytes = static_cast<char*>(allocate(text.size(), 1));
+        std::memcpy(bytes, text.data(), text.size());
+        return std::string_view(bytes, text.size());
+    }
+    
+    // Invalidates everything handed out so far. Standard blocks are kept
+    // and refilled, so a tool converting many files allocates them once.
+    void reset() {
+        largeBlocks.clear();
+        currentBlock = 0;
+        cursor = nullptr;
+        remaining = 0;
+    }
+};
+
+// A fixed list of strings stored in an arena, e.g. the values of a data line
+class StringList {
+private:
+    const std::string_view* items = nullptr;
+    size_t count = 0;
+
+public:
+    StringList() = default;
+    StringList(const std::string_view* first, size_t size) : items(first), count(size) {}
+    
+    const std::string_view* begin() const { return items; }
+    const std::string_view* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::string_view operator[](size_t index) const { return items[index]; }
+};
+
+class StringInterner {
+private:
+    Arena arena;
+    std::vector<std::string_view> strings;  // by id; id 0 is the empty string
+    std::vector<uint32_t> slots;            // open-addressing table of ids, 0 = free
+    
+    void growSlots() {
+        std::vector<uint32_t> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 1024 : old.size() * 2, 0);
+        size_t mask = slots.size() - 1;
+        for (uint32_t id : old) {
+            if (id != 0) {
+                size_t slot = hashBytes(strings[id]) & mask;
+                while (slots[slot] != 0) slot = (slot + 1) & mask;
+                slots[slot] = id;
+            }
+        }
+    }
+
+public:
+    StringInterner() {
+        strings.emplace_back();
+    }
+    
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+    
+    // Returns the id of text, storing it on first sight
+    uint32_t id(std::string_view text) {
+        if (text.empty()) return 0;
+        if ((strings.size() + 1) * 2 > slots.size()) {
+            growSlots();
+        }
+        
+        size_t mask = slots.size() - 1;
+        size_t slot = hashBytes(text) & mask;
+        while (slots[slot] != 0) {
+            if (strings[slots[slot]] == text) {
+                return slots[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+        
+        uint32_t newId = static_cast<uint32_t>(strings.size());
+        strings.push_back(arena.copy(text));
+        slots[slot] = newId;
+        return newId;
+    }
+    
+    // Returns the canonical view of text; equal strings share one address
+    std::string_view intern(std::string_view text) {
+        return strings[id(text)];
+    }
+    
+    std::string_view operator[](uint32_t stringId) const {
+        return strings[stringId];
+    }
+    
+    // Number of distinct strings, including the empty string
+    size_t size() const {
+        return strings.size();
+    }
+    
+    // Interns every entry and stores the list itself in the arena
+    StringList internList(const std::vector<std::string_view>& items) {
+        if (items.empty()) return StringList();
+        auto* list = static_cast<std::string_view*>(
+            arena.allocate(items.size() * sizeof(std::string_view), alignof(std::string_view)));
+        for (size_t i = 0; i < items.size(); ++i) {
+            new (&list[i]) std::string_view(intern(items[i]));
+        }
+        return StringList(list, items.size());
+    }
+    
+    // Forgets every string but keeps the arena blocks and table capacity
+    void reset() {
+        arena.reset();
+        strings.resize(1);
+        std::fill(slots.begin(), slots.end(), 0);
+    }
+};
+
+#endif // INTERN_HPP
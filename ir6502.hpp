@@ -0,0 +1,351 @@
+// Compact binary intermediate format (.6502ir) shared by the tools.
+//
+// convert can write a token stream in this format instead of JSON, and
+// createcpp and unconvert read it straight out of a memory mapping. The
+// file is a fixed header followed by 4-byte aligned tables:
+//
+//   IrToken[tokenCount]            one fixed-width record per source line
+//   uint32_t[valueCount]           string ids of data directive values
+//   uint32_t[...]                  per-section lists of token indices
+//   IrString[stringCount]          offset/length of each unique string
+//   char[stringDataSize]           string bytes, not NUL-terminated
+//
+// All integers are stored in the writer's byte order; readers reject files
+// whose byte-order mark does not match. String id 0 is the empty string.
+//
+#ifndef IR6502_HPP
+#define IR6502_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "intern.hpp"
+
+constexpr char IR_MAGIC[8] = {'6', '5', '0', '2', 'I', 'R', '\r', '\n'};
+constexpr uint32_t IR_VERSION = 1;
+constexpr uint32_t IR_BYTE_ORDER_MARK = 0x01020304;
+
+// Same order as the sections of the JSON document
+enum IrSectionId {
+    IR_CONSTANTS,
+    IR_LABELS,
+    IR_INSTRUCTIONS,
+    IR_DATA,
+    IR_DIRECTIVES,
+    IR_PROGRAM_FLOW,
+    IR_SECTION_COUNT
+};
+
+enum IrTokenType : uint8_t {
+    IR_LABEL,
+    IR_INSTRUCTION,
+    IR_DATA_BYTES,
+    IR_DATA_WORDS,
+    IR_DIRECTIVE,
+    IR_CONSTANT_DECL,
+    IR_COMMENT,
+    IR_UNKNOWN
+};
+
+struct IrSection {
+    uint32_t offset;    // file offset of the token index list
+    uint32_t count;
+};
+
+struct IrHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t tokenOffset;
+    uint32_t tokenCount;
+    uint32_t valueOffset;
+    uint32_t valueCount;
+    uint32_t stringIndexOffset;
+    uint32_t stringCount;
+    uint32_t stringDataOffset;
+    uint32_t stringDataSize;
+    IrSection sections[IR_SECTION_COUNT];
+};
+
+struct IrToken {
+    int32_t line;
+    uint8_t type;       // IrTokenType
+    uint8_t reserved[3];
+    uint32_t value;     // string ids
+    uint32_t operand;
+    uint32_t comment;
+    uint32_t firstValue;
+    uint32_t valueCount;
+    uint32_t padding;
+};
+
+struct IrString {
+    uint32_t offset;    // relative to stringDataOffset
+    uint32_t length;
+};
+
+static_assert(sizeof(IrToken) == 32, "IrToken is a fixed-width record");
+
+inline bool isIrImage(std::string_view image) {
+    return image.size() >= sizeof(IR_MAGIC) && std::memcmp(image.data(), IR_MAGIC, sizeof(IR_MAGIC)) == 0;
+}
+
+// Builds an image in memory. Strings are deduplicated as they are added.
+class IrBuilder {
+private:
+    std::vector<IrToken> tokens;
+    std::vector<uint32_t> values;
+    std::vector<uint32_t> sections[IR_SECTION_COUNT];
+    StringInterner strings;
+
+public:
+    uint32_t addString(std::string_view text) {
+        return strings.id(text);
+    }
+
+    // Appends a token and returns its index for use in section lists
+    uint32_t addToken(int line, IrTokenType type, std::string_view value, std::string_view operand,
+                      std::string_view comment, const std::vector<std::string_view>& dataValues) {
+        IrToken token = {};
+        token.line = line;
+        token.type = type;
+        token.value = addString(value);
+        token.operand = addString(operand);
+        token.comment = addString(comment);
+        token.firstValue = static_cast<uint32_t>(values.size());
+        token.valueCount = static_cast<uint32_t>(dataValues.size());
+        for (std::string_view dataValue : dataValues) {
+            values.push_back(addString(dataValue));
+        }
+        tokens.push_back(token);
+        return static_cast<uint32_t>(tokens.size() - 1);
+    }
+    
+    void addToSection(IrSectionId section, uint32_t tokenIndex) {
+        sections[section].push_back(tokenIndex);
+    }
+    
+    // Lays the tables out after the header and returns the complete image
+    std::string finish() const {
+        IrHeader header = {};
+        std::memcpy(header.magic, IR_MAGIC, sizeof(IR_MAGIC));
+        header.version = IR_VERSION;
+        header.byteOrder = IR_BYTE_ORDER_MARK;
+        
+        uint64_t offset = sizeof(IrHeader);
+        auto place = [&offset](uint64_t bytes) {
+            uint64_t start = offset;
+            offset += (bytes + 3) & ~uint64_t(3);
+            return static_cast<uint32_t>(start);
+        };
+        
+        header.tokenCount = static_cast<uint32_t>(tokens.size());
+        header.tokenOffset = place(tokens.size() * sizeof(IrToken));
+        header.valueCount = static_cast<uint32_t>(values.size());
+        header.valueOffset = place(values.size() * sizeof(uint32_t));
+        for (int section = 0; section < IR_SECTION_COUNT; ++section) {
+            header.sections[section].count = static_cast<uint32_t>(sections[section].size());
+            header.sections[section].offset = place(sections[section].size() * sizeof(uint32_t));
+        }
+        std::vector<IrString> stringIndex;
+        stringIndex.reserve(strings.size());
+        uint64_t stringDataSize = 0;
+        for (uint32_t id = 0; id < strings.size(); ++id) {
+            stringIndex.push_back(IrString{static_cast<uint32_t>(stringDataSize),
+                                           static_cast<uint32_t>(strings[id].size())});
+            stringDataSize += strings[id].size();
+        }
+        header.stringCount = static_cast<uint32_t>(stringIndex.size());
+        header.stringIndexOffset = place(stringIndex.size() * sizeof(IrString));
+        header.stringDataSize = static_cast<uint32_t>(stringDataSize);
+        header.stringDataOffset = place(stringDataSize);
+        
+        if (offset > UINT32_MAX) {
+            throw std::runtime_error("Program is too large for the .6502ir format");
+        }
+        
+        std::string image(static_cast<size_t>(offset), '\0');
+        auto copy = [&image](uint32_t at, const void* source, size_t bytes) {
+            if (bytes > 0) std::memcpy(&image[at], source, bytes);
+        };
+        copy(0, &header, sizeof(header));
+        copy(header.tokenOffset, tokens.data(), tokens.size() * sizeof(IrToken));
+        copy(header.valueOffset, values.data(), values.size() * sizeof(uint32_t));
+        for (int section = 0; section < IR_SECTION_COUNT; ++section) {
+            copy(header.sections[section].offset, sections[section].data(),
+                 sections[section].size() * sizeof(uint32_t));
+        }
+        copy(header.stringIndexOffset, stringIndex.data(), stringIndex.size() * sizeof(IrString));
+        for (uint32_t id = 0; id < strings.size(); ++id) {
+            copy(header.stringDataOffset + stringIndex[id].offset, strings[id].data(), strings[id].size());
+        }
+        return image;
+    }
+};
+
+// Read-only accessor over an image, typically a memory mapping. Nothing is
+// copied or parsed; the tables are validated once and then used in place.
+class IrReader {
+private:
+    const char* base;
+    size_t size;
+    const IrHeader* header;
+    
+    void check(bool condition, const char* reason) const {
+        if (!condition) {
+            throw std::runtime_error(std::string("Invalid .6502ir file: ") + reason);
+        }
+    }
+    
+    void checkTable(uint32_t offset, uint64_t count, size_t elementSize, const char* name) const {
+        check(offset % 4 == 0 && offset + count * elementSize <= size, name);
+    }
+    
+    template <typename T>
+    const T* table(uint32_t offset) const {
+        return reinterpret_cast<const T*>(base + offset);
+    }
+
+public:
+    explicit IrReader(std::string_view image) : base(image.data()), size(image.size()) {
+        check(isIrImage(image) && size >= sizeof(IrHeader), "bad header");
+        header = reinterpret_cast<const IrHeader*>(base);
+        check(header->byteOrder == IR_BYTE_ORDER_MARK, "written with a different byte order");
+        check(header->version == IR_VERSION, "unsupported version");
+        
+        checkTable(header->tokenOffset, header->tokenCount, sizeof(IrToken), "token table out of range");
+        checkTable(header->valueOffset, header->valueCount, sizeof(uint32_t), "value table out of range");
+        checkTable(header->stringIndexOffset, header->stringCount, sizeof(IrString), "string index out of range");
+        check(header->stringCount > 0, "missing empty string");
+        check(header->stringDataOffset + uint64_t(header->stringDataSize) <= size, "string data out of range");
+        for (int section = 0; section < IR_SECTION_COUNT; ++section) {
+            checkTable(header->sections[section].offset, header->sections[section].count, sizeof(uint32_t),
+                       "section out of range");
+        }
+        
+        // Validate every reference once so accessors can skip the checks
+        const IrString* strings = table<IrString>(header->stringIndexOffset);
+        for (uint32_t i = 0; i < header->stringCount; ++i) {
+            check(strings[i].offset + uint64_t(strings[i].length) <= header->stringDataSize, "string out of range");
+        }
+        const uint32_t* values = table<uint32_t>(header->valueOffset);
+        for (uint32_t i = 0; i < header->valueCount; ++i) {
+            check(values[i] < header->stringCount, "bad value string id");
+        }
+        const IrToken* tokens = table<IrToken>(header->tokenOffset);
+        for (uint32_t i = 0; i < header->tokenCount; ++i) {
+            const IrToken& token = tokens[i];
+            check(token.value < header->stringCount && token.operand < header->stringCount &&
+                  token.comment < header->stringCount, "bad token string id");
+            check(token.type <= IR_UNKNOWN, "bad token type");
+            check(token.firstValue + uint64_t(token.valueCount) <= header->valueCount, "bad token values");
+        }
+        for (int section = 0; section < IR_SECTION_COUNT; ++section) {
+            const uint32_t* indices = table<uint32_t>(header->sections[section].offset);
+            for (uint32_t i = 0; i < header->sections[section].count; ++i) {
+                check(indices[i] < header->tokenCount, "bad section token index");
+            }
+        }
+    }
+    
+    uint32_t tokenCount() const {
+        return header->tokenCount;
+    }
+    
+    const IrToken& token(uint32_t index) const {
+        return table<IrToken>(header->tokenOffset)[index];
+    }
+    
+    std::string_view string(uint32_t id) const {
+        const IrString& entry = table<IrString>(header->stringIndexOffset)[id];
+        return std::string_view(base + header->stringDataOffset + entry.offset, entry.length);
+    }
+    
+    std::string_view value(const IrToken& token, uint32_t index) const {
+        return string(table<uint32_t>(header->valueOffset)[token.firstValue + index]);
+    }
+    
+    uint32_t sectionSize(IrSectionId section) const {
+        return header->sections[section].count;
+    }
+    
+    const IrToken& sectionToken(IrSectionId section, uint32_t index) const {
+        return token(table<uint32_t>(header->sections[section].offset)[index]);
+    }
+    
+    // Feeds the image to a JsonReader handler (see jsonreader.hpp) as the
+    // same records and fields convert writes to JSON, so a tool can load
+    // either format through one code path.
+    template <typename Handler>
+    void replay(Handler& handler) const {
+        static const char* const sectionNames[IR_SECTION_COUNT] = {
+            "constants", "labels", "instructions", "data", "directives", "program_flow"
+        };
+        static const char* const flowTypes[] = {
+            "label", "instruction", "data", "data", "directive", "constant", "unknown", "unknown"
+        };
+        std::string content;
+        
+        for (int section = 0; section < IR_SECTION_COUNT; ++section) {
+            IrSectionId id = static_cast<IrSectionId>(section);
+            for (uint32_t i = 0; i < sectionSize(id); ++i) {
+                const IrToken& record = sectionToken(id, i);
+                std::string_view value = string(record.value);
+                std::string_view operand = string(record.operand);
+                
+                handler.beginRecord(sectionNames[section]);
+                switch (id) {
+                    case IR_CONSTANTS:
+                        handler.stringField("name", value);
+                        handler.stringField("value", operand);
+                        break;
+                    case IR_LABELS:
+                        handler.stringField("name", value);
+                        break;
+                    case IR_INSTRUCTIONS:
+                        handler.stringField("mnemonic", value);
+                        handler.stringField("operand", operand);
+                        break;
+                    case IR_DATA:
+                        handler.stringField("directive", value);
+                        handler.stringField("type", record.type == IR_DATA_BYTES ? "bytes" : "words");
+                        for (uint32_t v = 0; v < record.valueCount; ++v) {
+                            handler.arrayString("values", this->value(record, v));
+                        }
+                        break;
+                    case IR_DIRECTIVES:
+                        handler.stringField("name", value);
+                        handler.stringField("operand", operand);
+                        break;
+                    default:
+                        content.assign(value.data(), value.size());
+                        if (!operand.empty()) {
+                            content += ' ';
+                            content.append(operand.data(), operand.size());
+                        } else if (record.valueCount > 0) {
+                            content += ' ';
+                            for (uint32_t v = 0; v < record.valueCount; ++v) {
+                                if (v > 0) content += ", ";
+                                std::string_view dataValue = this->value(record, v);
+                                content.append(dataValue.data(), dataValue.size());
+                            }
+                        }
+                        handler.stringField("type", flowTypes[record.type]);
+                        handler.stringField("content", content);
+                        break;
+                }
+                handler.numberField("line", record.line);
+                if (record.comment != 0) {
+                    handler.stringField("comment", string(record.comment));
+                }
+                handler.endRecord();
+            }
+        }
+    }
+};
+
+#endif // IR6502_HPP
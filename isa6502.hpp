@@ -0,0 +1,369 @@
+// Shared description of the 6502 instruction set.
+//
+// Every official opcode is listed once in OPCODES; the per-mnemonic view,
+// the opcode decode table and the mnemonic hash are all derived from it at
+// compile time, so the tools classify and encode instructions from a single
+// source of truth without allocating.
+//
+#ifndef ISA6502_HPP
+#define ISA6502_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace isa6502 {
+
+enum AddressingMode : uint8_t {
+    IMPLIED,
+    ACCUMULATOR,
+    IMMEDIATE,
+    ZERO_PAGE,
+    ZERO_PAGE_X,
+    ZERO_PAGE_Y,
+    ABSOLUTE,
+    ABSOLUTE_X,
+    ABSOLUTE_Y,
+    INDIRECT,
+    INDEXED_INDIRECT,   // (zp,x)
+    INDIRECT_INDEXED,   // (zp),y
+    RELATIVE,
+    MODE_COUNT
+};
+
+// Instruction length in bytes, including the opcode
+constexpr uint8_t modeSize(AddressingMode mode) {
+    switch (mode) {
+        case IMPLIED:
+        case ACCUMULATOR:
+            return 1;
+        case ABSOLUTE:
+        case ABSOLUTE_X:
+        case ABSOLUTE_Y:
+        case INDIRECT:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+// Processor status bits, at their positions in the pushed status byte
+enum StatusFlag : uint8_t {
+    FLAG_C = 0x01,
+    FLAG_Z = 0x02,
+    FLAG_I = 0x04,
+    FLAG_D = 0x08,
+    FLAG_B = 0x10,
+    FLAG_V = 0x40,
+    FLAG_N = 0x80
+};
+
+constexpr uint8_t FLAGS_NZ = FLAG_N | FLAG_Z;
+constexpr uint8_t FLAGS_NZC = FLAG_N | FLAG_Z | FLAG_C;
+constexpr uint8_t FLAGS_NZCV = FLAG_N | FLAG_Z | FLAG_C | FLAG_V;
+constexpr uint8_t FLAGS_ALL = FLAGS_NZCV | FLAG_I | FLAG_D;
+
+struct OpcodeInfo {
+    const char* mnemonic;
+    AddressingMode mode;
+    uint8_t opcode;
+    uint8_t cycles;     // base cycle count, before page-crossing or branch penalties
+};
+
+constexpr OpcodeInfo OPCODES[] = {
+    {"adc", IMMEDIATE, 0x69, 2}, {"adc", ZERO_PAGE, 0x65, 3}, {"adc", ZERO_PAGE_X, 0x75, 4},
+    {"adc", ABSOLUTE, 0x6D, 4}, {"adc", ABSOLUTE_X, 0x7D, 4}, {"adc", ABSOLUTE_Y, 0x79, 4},
+    {"adc", INDEXED_INDIRECT, 0x61, 6}, {"adc", INDIRECT_INDEXED, 0x71, 5},
+
+    {"and", IMMEDIATE, 0x29, 2}, {"and", ZERO_PAGE, 0x25, 3}, {"and", ZERO_PAGE_X, 0x35, 4},
+    {"and", ABSOLUTE, 0x2D, 4}, {"and", ABSOLUTE_X, 0x3D, 4}, {"and", ABSOLUTE_Y, 0x39, 4},
+    {"and", INDEXED_INDIRECT, 0x21, 6}, {"and", INDIRECT_INDEXED, 0x31, 5},
+
+    {"asl", ACCUMULATOR, 0x0A, 2}, {"asl", ZERO_PAGE, 0x06, 5}, {"asl", ZERO_PAGE_X, 0x16, 6},
+    {"asl", ABSOLUTE, 0x0E, 6}, {"asl", ABSOLUTE_X, 0x1E, 7},
+
+    {"bcc", RELATIVE, 0x90, 2}, {"bcs", RELATIVE, 0xB0, 2}, {"beq", RELATIVE, 0xF0, 2},
+    {"bmi", RELATIVE, 0x30, 2}, {"bne", RELATIVE, 0xD0, 2}, {"bpl", RELATIVE, 0x10, 2},
+    {"bvc", RELATIVE, 0x50, 2}, {"bvs", RELATIVE, 0x70, 2},
+
+    {"bit", ZERO_PAGE, 0x24, 3}, {"bit", ABSOLUTE, 0x2C, 4},
+
+    {"brk", IMPLIED, 0x00, 7},
+
+    {"clc", IMPLIED, 0x18, 2}, {"cld", IMPLIED, 0xD8, 2}, {"cli", IMPLIED, 0x58, 2},
+    {"clv", IMPLIED, 0xB8, 2},
+
+    {"cmp", IMMEDIATE, 0xC9, 2}, {"cmp", ZERO_PAGE, 0xC5, 3}, {"cmp", ZERO_PAGE_X, 0xD5, 4},
+    {"cmp", ABSOLUTE, 0xCD, 4}, {"cmp", ABSOLUTE_X, 0xDD, 4}, {"cmp", ABSOLUTE_Y, 0xD9, 4},
+    {"cmp", INDEXED_INDIRECT, 0xC1, 6}, {"cmp", INDIRECT_INDEXED, 0xD1, 5},
+
+    {"cpx", IMMEDIATE, 0xE0, 2}, {"cpx", ZERO_PAGE, 0xE4, 3}, {"cpx", ABSOLUTE, 0xEC, 4},
+    {"cpy", IMMEDIATE, 0xC0, 2}, {"cpy", ZERO_PAGE, 0xC4, 3}, {"cpy", ABSOLUTE, 0xCC, 4},
+
+    {"dec", ZERO_PAGE, 0xC6, 5}, {"dec", ZERO_PAGE_X, 0xD6, 6}, {"dec", ABSOLUTE, 0xCE, 6},
+    {"dec", ABSOLUTE_X, 0xDE, 7},
+    {"dex", IMPLIED, 0xCA, 2}, {"dey", IMPLIED, 0x88, 2},
+
+    {"eor", IMMEDIATE, 0x49, 2}, {"eor", ZERO_PAGE, 0x45, 3}, {"eor", ZERO_PAGE_X, 0x55, 4},
+    {"eor", ABSOLUTE, 0x4D, 4}, {"eor", ABSOLUTE_X, 0x5D, 4}, {"eor", ABSOLUTE_Y, 0x59, 4},
+    {"eor", INDEXED_INDIRECT, 0x41, 6}, {"eor", INDIRECT_INDEXED, 0x51, 5},
+
+    {"inc", ZERO_PAGE, 0xE6, 5}, {"inc", ZERO_PAGE_X, 0xF6, 6}, {"inc", ABSOLUTE, 0xEE, 6},
+    {"inc", ABSOLUTE_X, 0xFE, 7},
+    {"inx", IMPLIED, 0xE8, 2}, {"iny", IMPLIED, 0xC8, 2},
+
+    {"jmp", ABSOLUTE, 0x4C, 3}, {"jmp", INDIRECT, 0x6C, 5},
+    {"jsr", ABSOLUTE, 0x20, 6},
+
+    {"lda", IMMEDIATE, 0xA9, 2}, {"lda", ZERO_PAGE, 0xA5, 3}, {"lda", ZERO_PAGE_X, 0xB5, 4},
+    {"lda", ABSOLUTE, 0xAD, 4}, {"lda", ABSOLUTE_X, 0xBD, 4}, {"lda", ABSOLUTE_Y, 0xB9, 4},
+    {"lda", INDEXED_INDIRECT, 0xA1, 6}, {"lda", INDIRECT_INDEXED, 0xB1, 5},
+
+    {"ldx", IMMEDIATE, 0xA2, 2}, {"ldx", ZERO_PAGE, 0xA6, 3}, {"ldx", ZERO_PAGE_Y, 0xB6, 4},
+    {"ldx", ABSOLUTE, 0xAE, 4}, {"ldx", ABSOLUTE_Y, 0xBE, 4},
+
+    {"ldy", IMMEDIATE, 0xA0, 2}, {"ldy", ZERO_PAGE, 0xA4, 3}, {"ldy", ZERO_PAGE_X, 0xB4, 4},
+    {"ldy", ABSOLUTE, 0xAC, 4}, {"ldy", ABSOLUTE_X, 0xBC, 4},
+
+    {"lsr", ACCUMULATOR, 0x4A, 2}, {"lsr", ZERO_PAGE, 0x46, 5}, {"lsr", ZERO_PAGE_X, 0x56, 6},
+    {"lsr", ABSOLUTE, 0x4E, 6}, {"lsr", ABSOLUTE_X, 0x5E, 7},
+
+    {"nop", IMPLIED, 0xEA, 2},
+
+    {"ora", IMMEDIATE, 0x09, 2}, {"ora", ZERO_PAGE, 0x05, 3}, {"ora", ZERO_PAGE_X, 0x15, 4},
+    {"ora", ABSOLUTE, 0x0D, 4}, {"ora", ABSOLUTE_X, 0x1D, 4}, {"ora", ABSOLUTE_Y, 0x19, 4},
+    {"ora", INDEXED_INDIRECT, 0x01, 6}, {"ora", INDIRECT_INDEXED, 0x11, 5},
+
+    {"pha", IMPLIED, 0x48, 3}, {"php", IMPLIED, 0x08, 3}, {"pla", IMPLIED, 0x68, 4},
+    {"plp", IMPLIED, 0x28, 4},
+
+    {"rol", ACCUMULATOR, 0x2A, 2}, {"rol", ZERO_PAGE, 0x26, 5}, {"rol", ZERO_PAGE_X, 0x36, 6},
+    {"rol", ABSOLUTE, 0x2E, 6}, {"rol", ABSOLUTE_X, 0x3E, 7},
+
+    {"ror", ACCUMULATOR, 0x6A, 2}, {"ror", ZERO_PAGE, 0x66, 5}, {"ror", ZERO_PAGE_X, 0x76, 6},
+    {"ror", ABSOLUTE, 0x6E, 6}, {"ror", ABSOLUTE_X, 0x7E, 7},
+
+    {"rti", IMPLIED, 0x40, 6}, {"rts", IMPLIED, 0x60, 6},
+
+    {"sbc", IMMEDIATE, 0xE9, 2}, {"sbc", ZERO_PAGE, 0xE5, 3}, {"sbc", ZERO_PAGE_X, 0xF5, 4},
+    {"sbc", ABSOLUTE, 0xED, 4}, {"sbc", ABSOLUTE_X, 0xFD, 4}, {"sbc", ABSOLUTE_Y, 0xF9, 4},
+    {"sbc", INDEXED_INDIRECT, 0xE1, 6}, {"sbc", INDIRECT_INDEXED, 0xF1, 5},
+
+    {"sec", IMPLIED, 0x38, 2}, {"sed", IMPLIED, 0xF8, 2}, {"sei", IMPLIED, 0x78, 2},
+
+    {"sta", ZERO_PAGE, 0x85, 3}, {"sta", ZERO_PAGE_X, 0x95, 4}, {"sta", ABSOLUTE, 0x8D, 4},
+    {"sta", ABSOLUTE_X, 0x9D, 5}, {"sta", ABSOLUTE_Y, 0x99, 5},
+    {"sta", INDEXED_INDIRECT, 0x81, 6}, {"sta", INDIRECT_INDEXED, 0x91, 6},
+
+    {"stx", ZERO_PAGE, 0x86, 3}, {"stx", ZERO_PAGE_Y, 0x96, 4}, {"stx", ABSOLUTE, 0x8E, 4},
+    {"sty", ZERO_PAGE, 0x84, 3}, {"sty", ZERO_PAGE_X, 0x94, 4}, {"sty", ABSOLUTE, 0x8C, 4},
+
+    {"tax", IMPLIED, 0xAA, 2}, {"tay", IMPLIED, 0xA8, 2}, {"tsx", IMPLIED, 0xBA, 2},
+    {"txa", IMPLIED, 0x8A, 2}, {"txs", IMPLIED, 0x9A, 2}, {"tya", IMPLIED, 0x98, 2},
+};
+
+// Status flags each mnemonic reads and writes, whatever its addressing mode
+struct FlagEffect {
+    const char* mnemonic;
+    uint8_t reads;
+    uint8_t writes;
+};
+
+constexpr FlagEffect FLAG_EFFECTS[] = {
+    {"adc", FLAG_C | FLAG_D, FLAGS_NZCV}, {"sbc", FLAG_C | FLAG_D, FLAGS_NZCV},
+    {"and", 0, FLAGS_NZ}, {"eor", 0, FLAGS_NZ}, {"ora", 0, FLAGS_NZ}, {"bit", 0, FLAGS_NZ | FLAG_V},
+    {"asl", 0, FLAGS_NZC}, {"lsr", 0, FLAGS_NZC}, {"rol", FLAG_C, FLAGS_NZC}, {"ror", FLAG_C, FLAGS_NZC},
+    {"bcc", FLAG_C, 0}, {"bcs", FLAG_C, 0}, {"beq", FLAG_Z, 0}, {"bne", FLAG_Z, 0},
+    {"bmi", FLAG_N, 0}, {"bpl", FLAG_N, 0}, {"bvc", FLAG_V, 0}, {"bvs", FLAG_V, 0},
+    {"brk", FLAGS_ALL, FLAG_I},
+    {"clc", 0, FLAG_C}, {"cld", 0, FLAG_D}, {"cli", 0, FLAG_I}, {"clv", 0, FLAG_V},
+    {"sec", 0, FLAG_C}, {"sed", 0, FLAG_D}, {"sei", 0, FLAG_I},
+    {"cmp", 0, FLAGS_NZC}, {"cpx", 0, FLAGS_NZC}, {"cpy", 0, FLAGS_NZC},
+    {"dec", 0, FLAGS_NZ}, {"dex", 0, FLAGS_NZ}, {"dey", 0, FLAGS_NZ},
+    {"inc", 0, FLAGS_NZ}, {"inx", 0, FLAGS_NZ}, {"iny", 0, FLAGS_NZ},
+    {"jmp", 0, 0}, {"jsr", 0, 0}, {"rts", 0, 0}, {"rti", 0, FLAGS_ALL},
+    {"lda", 0, FLAGS_NZ}, {"ldx", 0, FLAGS_NZ}, {"ldy", 0, FLAGS_NZ},
+    {"sta", 0, 0}, {"stx", 0, 0}, {"sty", 0, 0}, {"nop", 0, 0},
+    {"pha", 0, 0}, {"php", FLAGS_ALL, 0}, {"pla", 0, FLAGS_NZ}, {"plp", 0, FLAGS_ALL},
+    {"tax", 0, FLAGS_NZ}, {"tay", 0, FLAGS_NZ}, {"tsx", 0, FLAGS_NZ}, {"txa", 0, FLAGS_NZ},
+    {"txs", 0, 0}, {"tya", 0, FLAGS_NZ},
+};
+
+constexpr size_t OPCODE_COUNT = sizeof(OPCODES) / sizeof(OPCODES[0]);
+constexpr size_t MNEMONIC_COUNT = 56;
+static_assert(OPCODE_COUNT == 151, "the 6502 has 151 official opcodes");
+
+// Marks an addressing mode a mnemonic does not support
+constexpr uint16_t NO_OPCODE = 0x100;
+
+struct InstructionInfo {
+    const char* mnemonic;
+    uint16_t opcodes[MODE_COUNT];   // NO_OPCODE where the mode is unsupported
+    uint8_t cycles[MODE_COUNT];
+    uint8_t flagsRead;              // StatusFlag bits
+    uint8_t flagsWritten;
+
+    constexpr bool supports(AddressingMode mode) const {
+        return opcodes[mode] != NO_OPCODE;
+    }
+};
+
+// Mnemonics pack into 15 bits, five per lowercase letter. Anything that
+// is not three lowercase letters packs to -1.
+constexpr int32_t packMnemonic(std::string_view word) {
+    if (word.length() != 3) return -1;
+    int32_t key = 0;
+    for (char c : word) {
+        if (c < 'a' || c > 'z') return -1;
+        key = (key << 5) | (c - 'a');
+    }
+    return key;
+}
+
+constexpr int32_t packMnemonicIgnoreCase(std::string_view word) {
+    if (word.length() != 3) return -1;
+    int32_t key = 0;
+    for (char c : word) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c < 'a' || c > 'z') return -1;
+        key = (key << 5) | (c - 'a');
+    }
+    return key;
+}
+
+// Multiplicative hash that is collision-free over the 56 packed mnemonics;
+// the multiplier was found by search and is re-checked below.
+constexpr size_t HASH_SLOTS = 128;
+constexpr uint32_t HASH_MULTIPLIER = 0xF59B66D5u;
+
+constexpr size_t hashSlot(int32_t key) {
+    return static_cast<uint32_t>(static_cast<uint32_t>(key) * HASH_MULTIPLIER) >> 25;
+}
+
+namespace detail {
+
+constexpr bool sameMnemonic(const char* a, const char* b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+struct Tables {
+    std::array<InstructionInfo, MNEMONIC_COUNT> instructions{};
+    std::array<int8_t, HASH_SLOTS> slotIndex{};
+    std::array<int32_t, HASH_SLOTS> slotKey{};
+    std::array<int16_t, 256> decode{};     // opcode -> index into OPCODES, -1 if illegal
+    bool perfect = true;
+};
+
+constexpr Tables buildTables() {
+    Tables tables;
+
+    for (size_t slot = 0; slot < HASH_SLOTS; ++slot) {
+        tables.slotIndex[slot] = -1;
+        tables.slotKey[slot] = -1;
+    }
+    for (size_t opcode = 0; opcode < 256; ++opcode) {
+        tables.decode[opcode] = -1;
+    }
+
+    size_t mnemonicCount = 0;
+    for (size_t i = 0; i < OPCODE_COUNT; ++i) {
+        const OpcodeInfo& info = OPCODES[i];
+        tables.decode[info.opcode] = static_cast<int16_t>(i);
+
+        size_t index = 0;
+        while (index < mnemonicCount && !sameMnemonic(tables.instructions[index].mnemonic, info.mnemonic)) {
+            index++;
+        }
+
+        InstructionInfo& instruction = tables.instructions[index];
+        if (index == mnemonicCount) {
+            instruction.mnemonic = info.mnemonic;
+            for (size_t mode = 0; mode < MODE_COUNT; ++mode) {
+                instruction.opcodes[mode] = NO_OPCODE;
+                instruction.cycles[mode] = 0;
+            }
+
+            int32_t key = packMnemonic(info.mnemonic);
+            size_t slot = hashSlot(key);
+            if (tables.slotKey[slot] != -1) {
+                tables.perfect = false;
+            }
+            tables.slotKey[slot] = key;
+            tables.slotIndex[slot] = static_cast<int8_t>(index);
+            mnemonicCount++;
+        }
+
+        instruction.opcodes[info.mode] = info.opcode;
+        instruction.cycles[info.mode] = info.cycles;
+    }
+
+    if (mnemonicCount != MNEMONIC_COUNT) {
+        tables.perfect = false;
+    }
+
+    // Every mnemonic needs exactly one flag entry
+    size_t flagEntries = 0;
+    for (const FlagEffect& effect : FLAG_EFFECTS) {
+        for (size_t index = 0; index < mnemonicCount; ++index) {
+            if (sameMnemonic(tables.instructions[index].mnemonic, effect.mnemonic)) {
+                tables.instructions[index].flagsRead = effect.reads;
+                tables.instructions[index].flagsWritten = effect.writes;
+                flagEntries++;
+            }
+        }
+    }
+    if (flagEntries != MNEMONIC_COUNT || sizeof(FLAG_EFFECTS) / sizeof(FLAG_EFFECTS[0]) != MNEMONIC_COUNT) {
+        tables.perfect = false;
+    }
+    return tables;
+}
+
+constexpr Tables TABLES = buildTables();
+static_assert(TABLES.perfect, "mnemonic hash must be collision-free and every mnemonic needs its flags");
+
+} // namespace detail
+
+// Index of a packed mnemonic in instruction(), or -1
+constexpr int lookupKey(int32_t key) {
+    if (key < 0) return -1;
+    size_t slot = hashSlot(key);
+    return detail::TABLES.slotKey[slot] == key ? detail::TABLES.slotIndex[slot] : -1;
+}
+
+// Exact match against the lowercase mnemonics
+constexpr int mnemonicIndex(std::string_view word) {
+    return lookupKey(packMnemonic(word));
+}
+
+constexpr int mnemonicIndexIgnoreCase(std::string_view word) {
+    return lookupKey(packMnemonicIgnoreCase(word));
+}
+
+constexpr bool isInstruction(std::string_view word) {
+    return mnemonicIndex(word) >= 0;
+}
+
+constexpr const InstructionInfo& instruction(int index) {
+    return detail::TABLES.instructions[static_cast<size_t>(index)];
+}
+
+// Decodes an opcode byte; returns nullptr for opcodes outside the official set
+constexpr const OpcodeInfo* decode(uint8_t opcode) {
+    int16_t index = detail::TABLES.decode[opcode];
+    return index < 0 ? nullptr : &OPCODES[index];
+}
+
+static_assert(isInstruction("lda") && isInstruction("rti") && !isInstruction("LDA") && !isInstruction("ld"),
+              "mnemonic lookup is exact and lowercase");
+static_assert(mnemonicIndexIgnoreCase("JSR") == mnemonicIndex("jsr"), "case-folded lookup");
+static_assert(instruction(mnemonicIndex("adc")).flagsWritten == FLAGS_NZCV &&
+              instruction(mnemonicIndex("rol")).flagsRead == FLAG_C &&
+              instruction(mnemonicIndex("sta")).flagsWritten == 0,
+              "flag effects follow the mnemonic");
+static_assert(decode(0x4C) != nullptr && decode(0x4C)->mode == ABSOLUTE && decode(0x02) == nullptr,
+              "decode table covers official opcodes only");
+
+} // namespace isa6502
+
+#endif // ISA6502_HPP
@@ -0,0 +1,257 @@
+// Single-pass, SAX-style reader for the JSON interchange format written
+// by convert.
+//
+// The document is walked once, front to back. Every object found inside
+// an array is reported as a record of the section named by the array's
+// key, and its scalar fields are handed to the handler as they are read,
+// so callers fill their own structs in place without building a tree.
+//
+#ifndef JSONREADER_HPP
+#define JSONREADER_HPP
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// A handler provides:
+//
+//   void beginRecord(std::string_view section);
+//   void stringField(std::string_view key, std::string_view value);
+//   void numberField(std::string_view key, long long value);
+//   void arrayString(std::string_view key, std::string_view value);
+//   void endRecord();
+//
+// Values passed to the handler are only valid for the duration of the call.
+class JsonReader {
+private:
+    const char* begin = nullptr;
+    const char* cursor = nullptr;
+    const char* end = nullptr;
+    std::string scratch;
+    
+    [[noreturn]] void fail(const char* reason) const {
+        throw std::runtime_error("Invalid JSON at offset " + std::to_string(cursor - begin) + ": " + reason);
+    }
+    
+    void skipWhitespace() {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t')) {
+            cursor++;
+        }
+    }
+    
+    void expect(char c) {
+        skipWhitespace();
+        if (cursor >= end || *cursor != c) {
+            fail("unexpected character");
+        }
+        cursor++;
+    }
+    
+    static int hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+    
+    void appendUtf8(uint32_t codePoint) {
+        if (codePoint < 0x80) {
+            scratch += static_cast<char>(codePoint);
+        } else if (codePoint < 0x800) {
+            scratch += static_cast<char>(0xC0 | (codePoint >> 6));
+            scratch += static_cast<char>(0x80 | (codePoint & 0x3F));
+        } else {
+            scratch += static_cast<char>(0xE0 | (codePoint >> 12));
+            scratch += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            scratch += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+    }
+    
+    // Returns a view of the string starting at the cursor (just past its
+    // opening quote). Strings without escapes are sliced from the
+    // document; the rest are unescaped into the scratch buffer.
+    std::string_view parseString() {
+        const char* start = cursor;
+        while (cursor < end && *cursor != '"' && *cursor != '\\') {
+            cursor++;
+        }
+        if (cursor >= end) {
+            fail("unterminated string");
+        }
+        if (*cursor == '"') {
+            return std::string_view(start, static_cast<size_t>(cursor++ - start));
+        }
+        
+        scratch.assign(start, static_cast<size_t>(cursor - start));
+        while (cursor < end && *cursor != '"') {
+            if (*cursor != '\\') {
+                scratch += *cursor++;
+                continue;
+            }
+            if (++cursor >= end) {
+                fail("unterminated escape");
+            }
+            switch (*cursor++) {
+                case '"': scratch += '"'; break;
+                case '\\': scratch += '\\'; break;
+                case '/': scratch += '/'; break;
+                case 'b': scratch += '\b'; break;
+                case 'f': scratch += '\f'; break;
+                case 'n': scratch += '\n'; break;
+                case 'r': scratch += '\r'; break;
+                case 't': scratch += '\t'; break;
+                case 'u': {
+                    uint32_t codePoint = 0;
+                    for (int i = 0; i < 4; ++i) {
+                        int digit = cursor < end ? hexDigit(*cursor++) : -1;
+                        if (digit < 0) {
+                            fail("bad \\u escape");
+                        }
+                        codePoint = (codePoint << 4) | static_cast<uint32_t>(digit);
+                    }
+                    appendUtf8(codePoint);
+                    break;
+                }
+                default:
+                    fail("unknown escape");
+            }
+        }
+        if (cursor >= end) {
+            fail("unterminated string");
+        }
+        cursor++;
+        return scratch;
+    }
+    
+    // Returns the raw text of a number and advances past it
+    std::string_view parseNumberText() {
+        const char* start = cursor;
+        while (cursor < end && (std::isdigit(static_cast<unsigned char>(*cursor)) || *cursor == '-' ||
+                                *cursor == '+' || *cursor == '.' || *cursor == 'e' || *cursor == 'E')) {
+            cursor++;
+        }
+        return std::string_view(start, static_cast<size_t>(cursor - start));
+    }
+    
+    void skipLiteral() {
+        while (cursor < end && std::isalpha(static_cast<unsigned char>(*cursor))) {
+            cursor++;
+        }
+    }
+    
+    template <typename Handler>
+    void parseObject(Handler& handler, bool isRecord) {
+        skipWhitespace();
+        if (cursor < end && *cursor == '}') {
+            cursor++;
+            return;
+        }
+        
+        while (true) {
+            expect('"');
+            std::string_view key = parseString();
+            std::string escapedKey;
+            if (key.data() == scratch.data()) {
+                // Keep an unescaped key alive while its value reuses scratch
+                escapedKey = scratch;
+                key = escapedKey;
+            }
+            expect(':');
+            skipWhitespace();
+            if (cursor >= end) {
+                fail("missing value");
+            }
+            
+            char c = *cursor;
+            if (c == '"') {
+                cursor++;
+                std::string_view value = parseString();
+                if (isRecord) handler.stringField(key, value);
+            } else if (c == '[') {
+                cursor++;
+                parseArray(handler, key, isRecord);
+            } else if (c == '{') {
+                cursor++;
+                parseObject(handler, false);
+            } else if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+                std::string_view text = parseNumberText();
+                long long value = 0;
+                std::from_chars(text.data(), text.data() + text.size(), value);
+                if (isRecord) handler.numberField(key, value);
+            } else {
+                skipLiteral();
+            }
+            
+            skipWhitespace();
+            if (cursor < end && *cursor == ',') {
+                cursor++;
+                continue;
+            }
+            expect('}');
+            return;
+        }
+    }
+    
+    template <typename Handler>
+    void parseArray(Handler& handler, std::string_view key, bool parentIsRecord) {
+        skipWhitespace();
+        if (cursor < end && *cursor == ']') {
+            cursor++;
+            return;
+        }
+        
+        while (true) {
+            skipWhitespace();
+            if (cursor >= end) {
+                fail("unterminated array");
+            }
+            
+            char c = *cursor;
+            if (c == '{') {
+                cursor++;
+                handler.beginRecord(key);
+                parseObject(handler, true);
+                handler.endRecord();
+            } else if (c == '"') {
+                cursor++;
+                std::string_view value = parseString();
+                if (parentIsRecord) handler.arrayString(key, value);
+            } else if (c == '[') {
+                cursor++;
+                parseArray(handler, key, false);
+            } else if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+                std::string_view text = parseNumberText();
+                if (parentIsRecord) handler.arrayString(key, text);
+            } else {
+                skipLiteral();
+            }
+            
+            skipWhitespace();
+            if (cursor < end && *cursor == ',') {
+                cursor++;
+                continue;
+            }
+            expect(']');
+            return;
+        }
+    }
+
+public:
+    template <typename Handler>
+    void parse(std::string_view document, Handler& handler) {
+        begin = cursor = document.data();
+        end = document.data() + document.size();
+        
+        expect('{');
+        parseObject(handler, false);
+        skipWhitespace();
+        if (cursor != end) {
+            fail("trailing characters after document");
+        }
+    }
+};
+
+#endif // JSONREADER_HPP
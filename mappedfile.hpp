@@ -0,0 +1,86 @@
+// Read-only, whole-file input buffer shared by the conversion tools.
+//
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #include <fstream>
+    #include <iterator>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Read-only view of a whole input file. On POSIX systems the file is
+// mapped with mmap so parsers can slice it in place without copying;
+// elsewhere it falls back to reading the file into an owned buffer.
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::string buffer;
+#else
+    void* mapping = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open file: " + filename);
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open file: " + filename);
+        }
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat file: " + filename);
+        }
+        
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0) {
+            mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                close(fd);
+                throw std::runtime_error("Cannot map file: " + filename);
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+        }
+        close(fd);
+#endif
+    }
+    
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapping) {
+            munmap(mapping, size);
+        }
+#endif
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    std::string_view view() const {
+        return std::string_view(data, size);
+    }
+};
+
+#endif // MAPPEDFILE_HPP
@@ -0,0 +1,282 @@
+// --stats instrumentation shared by the tools.
+//
+// A RunStats collects the wall and CPU time of named phases, counts such
+// as tokens by type, and optionally a Chrome trace-event log of every
+// phase. Converters hold a RunStats pointer that is null unless --stats or
+// --trace was given, and mark phases with StatsPhase scopes, which cost
+// nothing when it is null.
+//
+// Heap allocations are only counted when the tool is built with
+// -DSMB_COUNT_ALLOCATIONS, which replaces the global operator new. Each
+// tool is a single translation unit, so the replacement is defined here.
+//
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+    #pragma comment(lib, "psapi.lib")
+#else
+    #include <sys/resource.h>
+    #include <time.h>
+#endif
+
+#ifdef SMB_COUNT_ALLOCATIONS
+// Kept out of line so the compiler does not pair the inlined free() with
+// a new it assumes to be the standard one
+#if defined(__GNUC__)
+    #define SMB_ALLOCATOR_NOINLINE __attribute__((noinline))
+#else
+    #define SMB_ALLOCATOR_NOINLINE
+#endif
+
+inline std::atomic<uint64_t> heapAllocations{0};
+inline std::atomic<uint64_t> heapAllocatedBytes{0};
+
+SMB_ALLOCATOR_NOINLINE void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    heapAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* block = std::malloc(size == 0 ? 1 : size)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+SMB_ALLOCATOR_NOINLINE void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+SMB_ALLOCATOR_NOINLINE void operator delete(void* block, size_t) noexcept {
+    std::free(block);
+}
+#endif
+
+// CPU time of the whole process, all threads, in nanoseconds
+inline int64_t processCpuNs() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    auto ticks = [](const FILETIME& time) {
+        return (static_cast<int64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// Largest resident set the process has had so far, in bytes
+inline uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+class RunStats {
+private:
+    struct Phase {
+        std::string name;
+        int64_t wallNs = 0;
+        int64_t cpuNs = 0;
+        uint64_t calls = 0;
+    };
+    
+    struct Count {
+        std::string group;
+        std::string name;
+        uint64_t value = 0;
+    };
+    
+    struct TraceEvent {
+        std::string name;
+        int64_t startNs;
+        int64_t durationNs;
+        int thread;
+    };
+    
+    mutable std::mutex mutex;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::vector<Phase> phases;      // in order of first use
+    std::vector<Count> counts;      // likewise
+    std::map<std::thread::id, int> threadNumbers;
+    std::vector<TraceEvent> events;
+    bool tracing = false;
+
+public:
+    // Keeps every phase as a trace event for writeTrace
+    void enableTrace() {
+        tracing = true;
+    }
+    
+    int64_t elapsedNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+    
+    // Adds one run of a phase that started startNs after this RunStats was
+    // made. A traceOnly phase, such as one chunk of a parallel phase, is
+    // only kept as a trace event. Safe to call from several threads.
+    void addPhase(const std::string& name, int64_t startNs, int64_t wallNs, int64_t cpuNs, bool traceOnly) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tracing) {
+            auto thread = threadNumbers.emplace(std::this_thread::get_id(), static_cast<int>(threadNumbers.size()));
+            events.push_back(TraceEvent{name, startNs, wallNs, thread.first->second});
+        }
+        if (traceOnly) return;
+        
+        auto phase = std::find_if(phases.begin(), phases.end(), [&](const Phase& p) { return p.name == name; });
+        if (phase == phases.end()) {
+            phases.push_back(Phase{name});
+            phase = phases.end() - 1;
+        }
+        phase->wallNs += wallNs;
+        phase->cpuNs += cpuNs;
+        phase->calls++;
+    }
+    
+    // Adds value to a counter, listed under group in the report
+    void addCount(const std::string& group, const std::string& name, uint64_t value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto count = std::find_if(counts.begin(), counts.end(), [&](const Count& c) {
+            return c.group == group && c.name == name;
+        });
+        if (count == counts.end()) {
+            counts.push_back(Count{group, name});
+            count = counts.end() - 1;
+        }
+        count->value += value;
+    }
+    
+    // Forgets everything recorded so far, as between watch updates
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        phases.clear();
+        counts.clear();
+        events.clear();
+        origin = std::chrono::steady_clock::now();
+    }
+    
+    void print(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        
+        out << std::left << std::setw(24) << "Phase" << std::right << std::setw(12) << "Wall ms"
+            << std::setw(12) << "CPU ms" << std::setw(8) << "Calls" << "\n";
+        out << std::fixed << std::setprecision(2);
+        for (const Phase& phase : phases) {
+            out << std::left << std::setw(24) << phase.name << std::right
+                << std::setw(12) << phase.wallNs / 1e6 << std::setw(12) << phase.cpuNs / 1e6
+                << std::setw(8) << phase.calls << "\n";
+        }
+        
+        std::string group;
+        for (const Count& count : counts) {
+            if (count.group != group) {
+                group = count.group;
+                out << group << ":\n";
+            }
+            out << "  " << std::left << std::setw(22) << count.name << std::right << std::setw(12)
+                << count.value << "\n";
+        }
+
+#ifdef SMB_COUNT_ALLOCATIONS
+        out << "Heap allocations: " << heapAllocations.load() << " (" << std::setprecision(1)
+            << heapAllocatedBytes.load() / (1024.0 * 1024.0) << " MiB requested)\n";
+#else
+        out << "Heap allocations: not counted (build with -DSMB_COUNT_ALLOCATIONS)\n";
+#endif
+        out << "Peak RSS: " << std::setprecision(1) << peakResidentBytes() / (1024.0 * 1024.0) << " MiB\n";
+        
+        out.flags(flags);
+        out.precision(precision);
+    }
+    
+    // Writes the phases as Chrome trace events, for chrome://tracing or
+    // Perfetto. Needs enableTrace() before the run.
+    void writeTrace(const std::string& filename) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream trace(filename, std::ios::binary);
+        if (!trace.is_open()) {
+            throw std::runtime_error("Cannot create trace file: " + filename);
+        }
+        
+        trace << std::fixed << std::setprecision(3);
+        trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        for (size_t i = 0; i < events.size(); ++i) {
+            const TraceEvent& event = events[i];
+            trace << "  {\"name\": \"" << event.name << "\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1"
+                  << ", \"tid\": " << event.thread << ", \"ts\": " << event.startNs / 1e3
+                  << ", \"dur\": " << event.durationNs / 1e3 << "}" << (i + 1 < events.size() ? "," : "") << "\n";
+        }
+        trace << "]}\n";
+    }
+};
+
+// Times the enclosing scope as one run of a phase; does nothing when
+// stats is null
+class StatsPhase {
+private:
+    RunStats* stats;
+    const char* name;
+    bool traceOnly;
+    int64_t startNs = 0;
+    int64_t startCpuNs = 0;
+
+public:
+    StatsPhase(RunStats* runStats, const char* phaseName, bool onlyTrace = false)
+        : stats(runStats), name(phaseName), traceOnly(onlyTrace) {
+        if (stats) {
+            startNs = stats->elapsedNs();
+            startCpuNs = processCpuNs();
+        }
+    }
+    
+    ~StatsPhase() {
+        stop();
+    }
+    
+    // Ends the phase before the scope does
+    void stop() {
+        if (stats) {
+            stats->addPhase(name, startNs, stats->elapsedNs() - startNs, processCpuNs() - startCpuNs, traceOnly);
+            stats = nullptr;
+        }
+    }
+    
+    StatsPhase(const StatsPhase&) = delete;
+    StatsPhase& operator=(const StatsPhase&) = delete;
+};
+
+#endif // STATS_HPP
@@ -0,0 +1,178 @@
+// Work-stealing thread pool shared by the tools' parallel modes.
+//
+// Each worker owns a deque of task indices. It takes work from the back of
+// its own deque and, once that is empty, steals from the front of the
+// others', so uneven tasks (one huge listing among many small ones) do not
+// leave threads idle. The calling thread works as worker 0.
+//
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t, int)> task;
+    uint64_t generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+    std::atomic<size_t> remaining{0};
+    std::exception_ptr failure;
+    
+    bool takeTask(int worker, size_t& index) {
+        Queue& own = *queues[worker];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                index = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            Queue& victim = *queues[(worker + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                index = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void work(int worker) {
+        size_t index;
+        while (remaining.load() > 0 && takeTask(worker, index)) {
+            try {
+                task(index, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure) failure = std::current_exception();
+            }
+            remaining--;
+        }
+    }
+    
+    void workerLoop(int worker) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                busyWorkers++;
+            }
+            work(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busyWorkers--;
+            }
+            done.notify_all();
+        }
+    }
+
+public:
+    // threadCount includes the calling thread; 0 means one per hardware thread
+    explicit WorkStealingPool(int threadCount) {
+        if (threadCount <= 0) {
+            threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        }
+        for (int i = 0; i < threadCount; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (int i = 1; i < threadCount; ++i) {
+            threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    int size() const {
+        return static_cast<int>(queues.size());
+    }
+    
+    // Calls body(index, worker) for every index in [0, count) and returns
+    // when all calls have finished. worker is in [0, size()) and no two
+    // calls with the same worker run at once, so it can select per-thread
+    // state. The first exception thrown by body is rethrown here.
+    template <typename Body>
+    void run(size_t count, Body body) {
+        if (count == 0) return;
+        
+        // The task is published before any index is queued, so a worker
+        // that takes an index always sees it
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = body;
+            failure = nullptr;
+            remaining = count;
+        }
+        
+        // Contiguous runs per worker keep neighbouring tasks together
+        for (size_t worker = 0; worker < queues.size(); ++worker) {
+            size_t first = count * worker / queues.size();
+            size_t last = count * (worker + 1) / queues.size();
+            std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+            for (size_t index = first; index < last; ++index) {
+                queues[worker]->tasks.push_back(index);
+            }
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+        }
+        wake.notify_all();
+        
+        work(0);
+        
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&]() { return remaining.load() == 0 && busyWorkers == 0; });
+            task = nullptr;
+            error = failure;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+#endif // THREADPOOL_HPP
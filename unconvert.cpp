@@ -5,459 +5,372 @@
 #include <vector>
 #include <map>
 #include <algorithm>
-#include <regex>
 #include <cctype>
+#include <cstdlib>
+#include <string_view>
 
+#include "batch.hpp"
+#include "intern.hpp"
+#include "ir6502.hpp"
+#include "jsonreader.hpp"
+#include "mappedfile.hpp"
+#include "stats.hpp"
+
+// String fields are interned views owned by the converter's StringInterner
 struct ProgramLine {
     int lineNumber;
-    std::string type;
-    std::string content;
-    std::string comment;
+    std::string_view type;
+    std::string_view content;
+    std::string_view comment;
     
     // For reconstructing original format
-    std::string name;
-    std::string value;
-    std::string operand;
-    std::string mnemonic;
-    std::string directive;
-    std::vector<std::string> values;
+    std::string_view name;
+    std::string_view value;
+    std::string_view operand;
+    std::string_view mnemonic;
+    std::string_view directive;
+    StringList values;
 };
 
 class JsonToAssemblyConverter {
 private:
     std::vector<ProgramLine> programFlow;
-    std::map<int, ProgramLine> lineMap;
+    StringInterner strings;
+    RunStats* stats = nullptr;
     
-    std::string unescapeJson(const std::string& str) {
-        std::string unescaped;
-        for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '\\' && i + 1 < str.length()) {
-                switch (str[i + 1]) {
-                    case '"': unescaped += '"'; i++; break;
-                    case '\\': unescaped += '\\'; i++; break;
-                    case 'b': unescaped += '\b'; i++; break;
-                    case 'f': unescaped += '\f'; i++; break;
-                    case 'n': unescaped += '\n'; i++; break;
-                    case 'r': unescaped += '\r'; i++; break;
-                    case 't': unescaped += '\t'; i++; break;
-                    default: unescaped += str[i]; break;
-                }
-            } else {
-                unescaped += str[i];
+    // Receives records from JsonReader and builds ProgramLines in place.
+    // program_flow only repeats the other sections, so it is skipped.
+    struct SectionLoader {
+        JsonToAssemblyConverter& owner;
+        ProgramLine* line = nullptr;
+        std::vector<std::string_view> values;
+        
+        explicit SectionLoader(JsonToAssemblyConverter& converter) : owner(converter) {}
+        
+        void beginRecord(std::string_view section) {
+            if (section != "constants" && section != "labels" && section != "instructions" &&
+                section != "data" && section != "directives") {
+                line = nullptr;
+                return;
             }
+            owner.programFlow.emplace_back();
+            line = &owner.programFlow.back();
+            line->type = owner.strings.intern(section);
+            line->lineNumber = -1;
         }
-        return unescaped;
-    }
-    
-    std::string extractStringValue(const std::string& json, const std::string& key) {
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return "";
         
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return "";
-        
-        size_t startQuote = json.find("\"", colonPos);
-        if (startQuote == std::string::npos) return "";
-        
-        size_t endQuote = startQuote + 1;
-        while (endQuote < json.length()) {
-            if (json[endQuote] == '"' && json[endQuote - 1] != '\\') {
-                break;
+        void stringField(std::string_view key, std::string_view text) {
+            if (!line) return;
+            std::string_view value = owner.strings.intern(text);
+            
+            if (key == "comment") {
+                line->comment = value;
+            } else if (line->type == "constants") {
+                if (key == "name") line->name = value;
+                else if (key == "value") line->value = value;
+            } else if (line->type == "labels") {
+                if (key == "name") line->name = value;
+            } else if (line->type == "instructions") {
+                if (key == "mnemonic") line->mnemonic = value;
+                else if (key == "operand") line->operand = value;
+            } else if (line->type == "data") {
+                if (key == "directive") line->directive = value;
+            } else if (line->type == "directives") {
+                if (key == "name") line->name = value;
+                else if (key == "operand") line->operand = value;
             }
-            endQuote++;
         }
         
-        if (endQuote >= json.length()) return "";
-        
-        return unescapeJson(json.substr(startQuote + 1, endQuote - startQuote - 1));
-    }
-    
-    int extractIntValue(const std::string& json, const std::string& key) {
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return -1;
-        
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return -1;
-        
-        size_t numStart = colonPos + 1;
-        while (numStart < json.length() && (json[numStart] == ' ' || json[numStart] == '\t')) {
-            numStart++;
+        void numberField(std::string_view key, long long value) {
+            if (line && key == "line") {
+                line->lineNumber = static_cast<int>(value);
+            }
         }
         
-        size_t numEnd = numStart;
-        while (numEnd < json.length() && (std::isdigit(json[numEnd]) || json[numEnd] == '-')) {
-            numEnd++;
+        void arrayString(std::string_view key, std::string_view value) {
+            if (line && line->type == "data" && key == "values") {
+                values.push_back(owner.strings.intern(value));
+            }
         }
         
-        if (numEnd > numStart) {
-            return std::stoi(json.substr(numStart, numEnd - numStart));
+        void endRecord() {
+            // Only numbered lines can be placed back into the listing
+            if (line && line->lineNumber <= 0) {
+                owner.programFlow.pop_back();
+            } else if (line && !values.empty()) {
+                line->values = owner.strings.internList(values);
+            }
+            values.clear();
+            line = nullptr;
         }
-        
-        return -1;
-    }
+    };
     
-    std::vector<std::string> extractArrayValues(const std::string& json, const std::string& key) {
-        std::vector<std::string> values;
-        std::string searchKey = "\"" + key + "\"";
-        size_t keyPos = json.find(searchKey);
-        if (keyPos == std::string::npos) return values;
-        
-        size_t colonPos = json.find(":", keyPos);
-        if (colonPos == std::string::npos) return values;
-        
-        size_t arrayStart = json.find("[", colonPos);
-        if (arrayStart == std::string::npos) return values;
-        
-        size_t arrayEnd = json.find("]", arrayStart);
-        if (arrayEnd == std::string::npos) return values;
-        
-        std::string arrayContent = json.substr(arrayStart + 1, arrayEnd - arrayStart - 1);
-        
-        // Parse array elements - handle both quoted and unquoted values
-        size_t pos = 0;
-        while (pos < arrayContent.length()) {
-            // Skip whitespace and commas
-            while (pos < arrayContent.length() && (arrayContent[pos] == ' ' || 
-                   arrayContent[pos] == '\t' || arrayContent[pos] == ',' || 
-                   arrayContent[pos] == '\n' || arrayContent[pos] == '\r')) {
-                pos++;
+    // Appends str to out with whitespace runs collapsed to one space and
+    // the ends trimmed, which is all ca65 needs from us
+    static void formatForCa65(std::string_view str, std::string& out) {
+        bool pendingSpace = false;
+        bool wroteAny = false;
+        for (char c : str) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r') {
+                pendingSpace = wroteAny;
+                continue;
             }
-            
-            if (pos >= arrayContent.length()) break;
-            
-            if (arrayContent[pos] == '"') {
-                // Handle quoted string
-                size_t startQuote = pos;
-                size_t endQuote = startQuote + 1;
-                while (endQuote < arrayContent.length()) {
-                    if (arrayContent[endQuote] == '"' && arrayContent[endQuote - 1] != '\\') {
-                        break;
-                    }
-                    endQuote++;
-                }
-                
-                if (endQuote < arrayContent.length()) {
-                    values.push_back(unescapeJson(arrayContent.substr(startQuote + 1, endQuote - startQuote - 1)));
-                    pos = endQuote + 1;
-                }
-            } else {
-                // Handle unquoted value (should not occur in proper JSON, but handle it)
-                size_t valueStart = pos;
-                while (pos < arrayContent.length() && arrayContent[pos] != ',' && 
-                       arrayContent[pos] != ']' && arrayContent[pos] != '\n') {
-                    pos++;
-                }
-                std::string value = arrayContent.substr(valueStart, pos - valueStart);
-                // Trim the value
-                value = std::regex_replace(value, std::regex("^\\s+|\\s+$"), "");
-                if (!value.empty()) {
-                    values.push_back(value);
-                }
+            if (pendingSpace) {
+                out += ' ';
+                pendingSpace = false;
             }
+            out += c;
+            wroteAny = true;
         }
-        
-        return values;
     }
     
-    void parseJsonSection(const std::string& json, const std::string& sectionName) {
-        std::string searchPattern = "\"" + sectionName + "\"";
-        size_t sectionStart = json.find(searchPattern);
-        if (sectionStart == std::string::npos) return;
-        
-        size_t arrayStart = json.find("[", sectionStart);
-        if (arrayStart == std::string::npos) return;
-        
-        int bracketCount = 0;
-        size_t pos = arrayStart;
-        
-        // Find the matching closing bracket
-        while (pos < json.length()) {
-            if (json[pos] == '[') bracketCount++;
-            else if (json[pos] == ']') bracketCount--;
-            
-            if (bracketCount == 0) break;
-            pos++;
-        }
-        
-        if (pos >= json.length()) return;
-        
-        std::string arrayContent = json.substr(arrayStart + 1, pos - arrayStart - 1);
-        
-        // Parse individual objects in the array
-        size_t objStart = 0;
-        while (objStart < arrayContent.length()) {
-            size_t objBegin = arrayContent.find("{", objStart);
-            if (objBegin == std::string::npos) break;
-            
-            int braceCount = 0;
-            size_t objEnd = objBegin;
-            
-            while (objEnd < arrayContent.length()) {
-                if (arrayContent[objEnd] == '{') braceCount++;
-                else if (arrayContent[objEnd] == '}') braceCount--;
-                
-                if (braceCount == 0) break;
-                objEnd++;
-            }
-            
-            if (objEnd >= arrayContent.length()) break;
-            
-            std::string objContent = arrayContent.substr(objBegin, objEnd - objBegin + 1);
-            parseJsonObject(objContent, sectionName);
-            
-            objStart = objEnd + 1;
+    // Appends separator and the formatted text, or nothing when the
+    // formatted text is empty. Returns whether anything was appended.
+    static bool appendField(std::string_view text, const char* separator, std::string& out) {
+        size_t before = out.size();
+        out += separator;
+        size_t start = out.size();
+        formatForCa65(text, out);
+        if (out.size() == start) {
+            out.resize(before);
+            return false;
         }
+        return true;
     }
     
-    void parseJsonObject(const std::string& objJson, const std::string& sectionName) {
-        ProgramLine line;
-        line.type = sectionName;
-        line.lineNumber = extractIntValue(objJson, "line");
-        line.comment = extractStringValue(objJson, "comment");
-        
-        if (sectionName == "constants") {
-            line.name = extractStringValue(objJson, "name");
-            line.value = extractStringValue(objJson, "value");
-        }
-        else if (sectionName == "labels") {
-            line.name = extractStringValue(objJson, "name");
-        }
-        else if (sectionName == "instructions") {
-            line.mnemonic = extractStringValue(objJson, "mnemonic");
-            line.operand = extractStringValue(objJson, "operand");
-        }
-        else if (sectionName == "data") {
-            line.directive = extractStringValue(objJson, "directive");
-            line.values = extractArrayValues(objJson, "values");
-        }
-        else if (sectionName == "directives") {
-            line.name = extractStringValue(objJson, "name");
-            line.operand = extractStringValue(objJson, "operand");
-        }
-        
-        if (line.lineNumber > 0) {
-            lineMap[line.lineNumber] = line;
-        }
-    }
-    
-    std::string formatForCa65(const std::string& str) {
-        // Handle ca65-specific formatting requirements
-        std::string formatted = str;
-        
-        // Remove any extra whitespace
-        formatted = std::regex_replace(formatted, std::regex("\\s+"), " ");
-        formatted = std::regex_replace(formatted, std::regex("^\\s+|\\s+$"), "");
-        
-        // Handle empty strings
-        if (formatted.empty()) {
-            return "";
+public:
+    void parseJsonFile(const std::string& filename) {
+        StatsPhase reading(stats, "read");
+        MappedFile file(filename);
+        reading.stop();
+        StatsPhase parsing(stats, "section parse");
+        
+        // Parse every section in a single pass over the document. Binary
+        // .6502ir images are recognised by their magic bytes.
+        SectionLoader loader(*this);
+        if (isIrImage(file.view())) {
+            IrReader(file.view()).replay(loader);
+        } else {
+            JsonReader reader;
+            reader.parse(file.view(), loader);
         }
         
-        // Handle quoted strings properly
-        if (formatted.front() == '"' && formatted.back() == '"' && formatted.length() >= 2) {
-            return formatted; // Keep quoted strings as-is
+        // Order by line number; when two records claim the same line the
+        // one read last wins
+        std::stable_sort(programFlow.begin(), programFlow.end(), 
+                         [](const ProgramLine& a, const ProgramLine& b) {
+                             return a.lineNumber < b.lineNumber;
+                         });
+        
+        size_t kept = 0;
+        for (size_t i = 0; i < programFlow.size(); ++i) {
+            if (i + 1 < programFlow.size() && programFlow[i + 1].lineNumber == programFlow[i].lineNumber) {
+                continue;
+            }
+            if (kept != i) {
+                programFlow[kept] = std::move(programFlow[i]);
+            }
+            kept++;
         }
+        programFlow.resize(kept);
         
-        // Handle special ca65 syntax
-        // Don't modify expressions that contain ca65 operators
-        if (formatted.find_first_of("()[]{}#$%<>") != std::string::npos) {
-            return formatted; // Keep ca65 expressions as-is
+        if (stats) {
+            std::map<std::string_view, uint64_t> sectionCounts;
+            for (const ProgramLine& line : programFlow) {
+                sectionCounts[line.type]++;
+            }
+            for (const auto& section : sectionCounts) {
+                stats->addCount("Records", std::string(section.first), section.second);
+            }
         }
-        
-        return formatted;
     }
     
-    bool isInstruction(const std::string& mnemonic) {
-        static const std::vector<std::string> instructions = {
-            "lda", "ldx", "ldy", "sta", "stx", "sty",
-            "tax", "tay", "txa", "tya", "tsx", "txs",
-            "pha", "php", "pla", "plp",
-            "and", "eor", "ora", "bit",
-            "adc", "sbc", "cmp", "cpx", "cpy",
-            "inc", "inx", "iny", "dec", "dex", "dey",
-            "asl", "lsr", "rol", "ror",
-            "jmp", "jsr", "rts",
-            "bcc", "bcs", "beq", "bmi", "bne", "bpl", "bvc", "bvs",
-            "clc", "cld", "cli", "clv", "sec", "sed", "sei",
-            "brk", "nop", "rti"
-        };
-        
-        std::string lower_mnemonic = mnemonic;
-        std::transform(lower_mnemonic.begin(), lower_mnemonic.end(), 
-                      lower_mnemonic.begin(), ::tolower);
-        
-        return std::find(instructions.begin(), instructions.end(), lower_mnemonic) != instructions.end();
+    // Forgets the previous input so the converter can be reused for the
+    // next file, keeping the arena blocks and table capacity
+    void reset() {
+        programFlow.clear();
+        strings.reset();
     }
     
-public:
-    void parseJsonFile(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open JSON file: " + filename);
-        }
-        
-        std::ostringstream buffer;
-        buffer << file.rdbuf();
-        std::string jsonContent = buffer.str();
-        
-        // Parse each section
-        parseJsonSection(jsonContent, "constants");
-        parseJsonSection(jsonContent, "labels");
-        parseJsonSection(jsonContent, "instructions");
-        parseJsonSection(jsonContent, "data");
-        parseJsonSection(jsonContent, "directives");
-        
-        // Create ordered program flow
-        for (const auto& pair : lineMap) {
-            programFlow.push_back(pair.second);
-        }
-        
-        // Sort by line number
-        std::sort(programFlow.begin(), programFlow.end(), 
-                  [](const ProgramLine& a, const ProgramLine& b) {
-                      return a.lineNumber < b.lineNumber;
-                  });
+    // Phases and record counts go to runStats; null turns them off
+    void setStats(RunStats* runStats) {
+        stats = runStats;
     }
     
     std::string generateAssembly() {
-        std::ostringstream asm_output;
+        StatsPhase phase(stats, "codegen");
+        std::string asmOutput;
+        std::string reconstructedLine;
+        std::string scratch;
         
         for (const auto& line : programFlow) {
-            std::string reconstructed_line;
+            reconstructedLine.clear();
             
             if (line.type == "constants") {
                 // ca65 constant format: NAME = VALUE
-                reconstructed_line = formatForCa65(line.name + " = " + line.value);
+                scratch.assign(line.name.data(), line.name.size());
+                scratch += " = ";
+                scratch += line.value;
+                formatForCa65(scratch, reconstructedLine);
             }
             else if (line.type == "labels") {
                 // ca65 label format: LABEL: (no indentation)
-                reconstructed_line = formatForCa65(line.name) + ":";
+                formatForCa65(line.name, reconstructedLine);
+                reconstructedLine += ':';
             }
             else if (line.type == "instructions") {
-                // ca65 instruction format: indented mnemonic and operand
-                std::string mnemonic = formatForCa65(line.mnemonic);
-                std::string operand = formatForCa65(line.operand);
-                
+                // ca65 instruction format: indented mnemonic and operand.
+                // Mnemonics the ISA table does not know are written as is.
                 // Skip empty instructions
-                if (mnemonic.empty()) {
+                if (!appendField(line.mnemonic, "    ", reconstructedLine)) {
                     continue;
                 }
-                
-                // Ensure proper ca65 instruction formatting
-                if (isInstruction(mnemonic)) {
-                    reconstructed_line = "    " + mnemonic; // 4-space indentation for instructions
-                    if (!operand.empty()) {
-                        reconstructed_line += " " + operand;
-                    }
-                } else {
-                    // If not recognized as instruction, treat as is
-                    reconstructed_line = "    " + mnemonic;
-                    if (!operand.empty()) {
-                        reconstructed_line += " " + operand;
-                    }
-                }
+                appendField(line.operand, " ", reconstructedLine);
             }
             else if (line.type == "data") {
                 // ca65 data directive format
-                std::string directive = formatForCa65(line.directive);
-                
                 // Skip empty data directives
-                if (directive.empty()) {
+                if (!appendField(line.directive, "    ", reconstructedLine)) {
                     continue;
                 }
                 
-                reconstructed_line = "    " + directive; // Indent data directives
-                
-                if (!line.values.empty()) {
-                    // Filter out empty values and build the values string
-                    std::vector<std::string> validValues;
-                    for (const auto& value : line.values) {
-                        std::string formattedValue = formatForCa65(value);
-                        if (!formattedValue.empty()) {
-                            validValues.push_back(formattedValue);
-                        }
-                    }
-                    
-                    if (!validValues.empty()) {
-                        reconstructed_line += " ";
-                        for (size_t i = 0; i < validValues.size(); ++i) {
-                            if (i > 0) reconstructed_line += ", ";
-                            reconstructed_line += validValues[i];
-                        }
+                // Filter out empty values while building the values string
+                const char* separator = " ";
+                for (std::string_view value : line.values) {
+                    if (appendField(value, separator, reconstructedLine)) {
+                        separator = ", ";
                     }
                 }
             }
             else if (line.type == "directives") {
                 // ca65 assembler directive format (usually not indented)
-                std::string directive = formatForCa65(line.name);
-                std::string operand = formatForCa65(line.operand);
+                scratch.clear();
+                formatForCa65(line.name, scratch);
                 
                 // Skip empty directives
-                if (directive.empty()) {
+                if (scratch.empty()) {
                     continue;
                 }
                 
                 // Most ca65 directives start with . and are not indented
-                if (directive.front() == '.') {
-                    reconstructed_line = directive;
-                } else {
-                    reconstructed_line = "    " + directive; // Indent if not a standard directive
-                }
-                
-                if (!operand.empty()) {
-                    reconstructed_line += " " + operand;
+                if (scratch.front() != '.') {
+                    reconstructedLine = "    "; // Indent if not a standard directive
                 }
+                reconstructedLine += scratch;
+                appendField(line.operand, " ", reconstructedLine);
             }
             
             // Add comment if present (ca65 uses ; for comments)
             if (!line.comment.empty()) {
-                std::string comment = formatForCa65(line.comment);
-                if (!reconstructed_line.empty()) {
+                if (!reconstructedLine.empty()) {
                     // Align comments at a consistent column (e.g., column 40)
-                    while (reconstructed_line.length() < 40) {
-                        reconstructed_line += " ";
+                    if (reconstructedLine.length() < 40) {
+                        reconstructedLine.append(40 - reconstructedLine.length(), ' ');
                     }
-                    reconstructed_line += "; " + comment;
-                } else {
-                    // Comment-only line
-                    reconstructed_line = "; " + comment;
                 }
+                // A line without code becomes a comment-only line
+                reconstructedLine += "; ";
+                formatForCa65(line.comment, reconstructedLine);
             }
             
             // Only output non-empty lines
-            if (!reconstructed_line.empty()) {
-                asm_output << reconstructed_line << "\n";
+            if (!reconstructedLine.empty()) {
+                asmOutput += reconstructedLine;
+                asmOutput += '\n';
             }
         }
         
-        return asm_output.str();
+        return asmOutput;
     }
 };
 
+#ifndef SMB_TOOLS_NO_MAIN  // bench.cpp includes this file for the converter
+
+static void writeAssembly(JsonToAssemblyConverter& converter, const std::string& outputName, RunStats* stats) {
+    std::string asmOutput = converter.generateAssembly();
+    
+    StatsPhase phase(stats, "write");
+    std::ofstream outputFile(outputName);
+    if (!outputFile.is_open()) {
+        throw std::runtime_error("Cannot create output file: " + outputName);
+    }
+    
+    outputFile << asmOutput;
+    outputFile.close();
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input.json> <output.asm>" << std::endl;
+    // --batch converts every file named by a manifest or pattern, on -j N threads.
+    // --stats and --trace report phase timings as in convert.
+    int threadCount = 1;
+    bool batch = false;
+    bool printStats = false;
+    std::string traceName;
+    std::vector<std::string> arguments;
+    for (int argi = 1; argi < argc; ++argi) {
+        std::string option = argv[argi];
+        if (option == "-j" && argi + 1 < argc) {
+            threadCount = std::atoi(argv[++argi]);
+        } else if (option == "--batch") {
+            batch = true;
+        } else if (option == "--stats") {
+            printStats = true;
+        } else if (option == "--trace" && argi + 1 < argc) {
+            traceName = argv[++argi];
+        } else {
+            arguments.push_back(option);
+        }
+    }
+    
+    bool validArguments = batch ? arguments.size() == 1 || arguments.size() == 2 : arguments.size() == 2;
+    if (!validArguments) {
+        std::cerr << "Usage: " << argv[0] << " [--stats] [--trace trace.json] <input.json> <output.asm>" << std::endl;
+        std::cerr << "       " << argv[0] << " [-j threads] [--stats] [--trace trace.json] "
+                  << "--batch <manifest|pattern> [output_dir]" << std::endl;
         std::cerr << "Converts JSON assembly format back to ca65-compatible assembly source" << std::endl;
         return 1;
     }
     
+    RunStats stats;
+    RunStats* runStats = printStats || !traceName.empty() ? &stats : nullptr;
+    if (!traceName.empty()) {
+        stats.enableTrace();
+    }
+    auto reportStats = [&]() {
+        if (printStats) stats.print(std::cerr);
+        if (!traceName.empty()) stats.writeTrace(traceName);
+    };
+    
+    if (batch) {
+        try {
+            std::vector<BatchJob> jobs = loadBatchJobs(arguments[0], arguments.size() > 1 ? arguments[1] : "", ".asm");
+            WorkStealingPool pool(threadCount);
+            std::vector<JsonToAssemblyConverter> converters(static_cast<size_t>(pool.size()));
+            for (auto& converter : converters) {
+                converter.setStats(runStats);
+            }
+            int failures = runBatch(jobs, pool, [&](const BatchJob& job, int worker) {
+                JsonToAssemblyConverter& converter = converters[worker];
+                converter.reset();
+                converter.parseJsonFile(job.input);
+                writeAssembly(converter, job.output, runStats);
+            });
+            reportStats();
+            return failures == 0 ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
     try {
         JsonToAssemblyConverter converter;
-        converter.parseJsonFile(argv[1]);
-        
-        std::string asmOutput = converter.generateAssembly();
-        
-        std::ofstream outputFile(argv[2]);
-        if (!outputFile.is_open()) {
-            throw std::runtime_error("Cannot create output file: " + std::string(argv[2]));
-        }
-        
-        outputFile << asmOutput;
-        outputFile.close();
+        converter.setStats(runStats);
+        converter.parseJsonFile(arguments[0]);
+        writeAssembly(converter, arguments[1], runStats);
         
-        std::cout << "Successfully converted " << argv[1] << " to ca65-compatible " << argv[2] << std::endl;
+        std::cout << "Successfully converted " << arguments[0] << " to ca65-compatible " << arguments[1] << std::endl;
+        reportStats();
         
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -466,3 +379,5 @@ int main(int argc, char* argv[]) {
     
     return 0;
 }
+
+#endif // SMB_TOOLS_NO_MAIN
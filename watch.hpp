@@ -0,0 +1,63 @@
+// Polling file watcher for the tools' --watch modes.
+//
+#ifndef WATCH_HPP
+#define WATCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Modification stamp of a file, or 0 when it cannot be read. Size is
+// folded in so a rewrite within the same timestamp tick is still seen.
+inline uint64_t fileStamp(const std::string& filename) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(filename.c_str(), &info) != 0) return 0;
+    uint64_t nanoseconds = static_cast<uint64_t>(info.st_mtime) * 1000000000ull;
+#else
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) return 0;
+#if defined(__APPLE__)
+    uint64_t nanoseconds = static_cast<uint64_t>(info.st_mtimespec.tv_sec) * 1000000000ull +
+                           static_cast<uint64_t>(info.st_mtimespec.tv_nsec);
+#else
+    uint64_t nanoseconds = static_cast<uint64_t>(info.st_mtim.tv_sec) * 1000000000ull +
+                           static_cast<uint64_t>(info.st_mtim.tv_nsec);
+#endif
+#endif
+    return nanoseconds ^ (static_cast<uint64_t>(info.st_size) << 1);
+}
+
+// Calls update once, then again every time the file changes, until the
+// process is interrupted. An update that throws is reported and the watch
+// goes on, so a half-saved file does not end the session.
+template <typename Update>
+void watchFile(const std::string& filename, Update update) {
+    const auto pollInterval = std::chrono::milliseconds(100);
+    uint64_t lastStamp = 0;
+    
+    std::cout << "Watching " << filename << " (Ctrl+C to stop)" << std::endl;
+    while (true) {
+        uint64_t stamp = fileStamp(filename);
+        if (stamp != 0 && stamp != lastStamp) {
+            lastStamp = stamp;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                update();
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                std::cout << "Updated in " << static_cast<long long>(elapsed.count() + 0.5) << " ms" << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+            }
+        }
+        std::this_thread::sleep_for(pollInterval);
+    }
+}
+
+#endif // WATCH_HPP